@@ -0,0 +1,95 @@
+#!/usr/bin/python3
+
+#
+# This script benchmarks the reading of the frames by the plugin, in
+# order to compare the raw frames ("/instances/{id}/frames/{n}/raw")
+# against the copy and the parsing of the full DICOM files. It
+# downloads the uncompressed NIfTI file of one series several times,
+# and reports the latency, together with the statistics of the frame
+# decoders that are published as metrics by the plugin.
+#
+# Run this script twice against the same series, once with the
+# configuration option "Neuro.RawFrames" set to "true", and once set
+# to "false" (Orthanc must be restarted in between). The persistent
+# cache of the NIfTI files ("Neuro.CacheDirectory") must be disabled,
+# and the metrics of Orthanc ("MetricsEnabled") must be enabled.
+#
+# Usage: ./BenchmarkRawFrames.py [--url URL] [--username USER]
+#            [--password PASSWORD] [--repeat N] SERIES
+#
+
+import argparse
+import base64
+import json
+import time
+import urllib.request
+
+
+METRICS = [
+    ('orthanc_neuro_decoder_raw_frames_count', 'Raw frames'),
+    ('orthanc_neuro_decoder_full_instances_count', 'Full DICOM instances'),
+    ('orthanc_neuro_decoder_metadata_requests_count', 'Requests for the transfer syntax'),
+    ('orthanc_neuro_decoder_read_mb', 'Read from Orthanc (MB)'),
+    ('orthanc_neuro_decoder_duration_ms', 'Decoding time, summed over threads (ms)'),
+]
+
+
+parser = argparse.ArgumentParser(description = 'Benchmark of the raw frames in the neuro plugin.')
+parser.add_argument('--url', default = 'http://localhost:8042', help = 'URL of Orthanc')
+parser.add_argument('--username', default = None, help = 'Username to Orthanc')
+parser.add_argument('--password', default = None, help = 'Password to Orthanc')
+parser.add_argument('--repeat', type = int, default = 5, help = 'Number of downloads')
+parser.add_argument('series', help = 'Orthanc identifier of the series')
+args = parser.parse_args()
+
+
+def DoGet(uri):
+    request = urllib.request.Request(args.url + uri)
+
+    if args.username != None and args.password != None:
+        credentials = base64.b64encode(('%s:%s' % (args.username, args.password)).encode('ascii'))
+        request.add_header('Authorization', 'Basic %s' % credentials.decode('ascii'))
+
+    with urllib.request.urlopen(request) as response:
+        return response.read()
+
+
+def GetMetrics():
+    metrics = {}
+
+    for line in DoGet('/tools/metrics-prometheus').decode('ascii').splitlines():
+        items = line.split()
+        if len(items) >= 2 and not line.startswith('#'):
+            metrics[items[0]] = float(items[1])
+
+    for (name, description) in METRICS:
+        if not name in metrics:
+            raise Exception('Metric "%s" is not available, check "MetricsEnabled"' % name)
+
+    return metrics
+
+
+if not 'neuro' in json.loads(DoGet('/plugins')):
+    raise Exception('The neuro plugin is not loaded')
+
+latencies = []
+before = GetMetrics()
+
+for i in range(args.repeat):
+    start = time.time()
+    size = len(DoGet('/series/%s/nifti' % args.series))
+    latencies.append(time.time() - start)
+    print('Download %d: %.3f seconds, %d bytes' % (i + 1, latencies[-1], size))
+
+after = GetMetrics()
+
+print('')
+print('Average latency (seconds): %.3f' % (sum(latencies) / len(latencies)))
+print('Minimum latency (seconds): %.3f' % min(latencies))
+
+for (name, description) in METRICS:
+    print('%s, per download: %.1f' % (description, (after[name] - before[name]) / args.repeat))
+
+if after['orthanc_neuro_decoder_raw_frames_count'] == before['orthanc_neuro_decoder_raw_frames_count'] and \
+   after['orthanc_neuro_decoder_full_instances_count'] == before['orthanc_neuro_decoder_full_instances_count']:
+    print('WARNING: No frame was decoded, is the cache of the NIfTI files disabled?')
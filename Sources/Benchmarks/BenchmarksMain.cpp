@@ -0,0 +1,285 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+/**
+ * Microbenchmarks of the conversion kernels, and of the conversion of
+ * the DICOM pixel formats into the NIfTI datatypes. The throughput
+ * (bytes read plus bytes written per second) is reported for each
+ * instruction set that is supported by the CPU. Build with
+ * "-DBUILD_BENCHMARKS=ON", then run "./Benchmarks".
+ **/
+
+#include "../Framework/NiftiWriter.h"
+#include "../Framework/PixelKernels.h"
+
+#include <Images/Image.h>
+#include <OrthancException.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <cassert>
+#include <memory>
+#include <stdio.h>
+#include <vector>
+
+
+static const size_t  COUNT_VOXELS = 512 * 512;  // Size of a typical MRI slice
+static const double  MINIMUM_DURATION = 0.25;   // In seconds
+
+
+namespace
+{
+  class IBenchmark : public boost::noncopyable
+  {
+  public:
+    virtual ~IBenchmark()
+    {
+    }
+
+    virtual const char* GetName() const = 0;
+
+    // Number of bytes that are read and written by one call to "Run()"
+    virtual size_t GetTrafficSize() const = 0;
+
+    virtual void Run() = 0;
+  };
+
+
+  template <typename Source, typename Target>
+  class ConversionBenchmark : public IBenchmark
+  {
+  public:
+    typedef void (*Kernel) (Target*, const Source*, size_t);
+
+  private:
+    const char*          name_;
+    Kernel               kernel_;
+    std::vector<Source>  source_;
+    std::vector<Target>  target_;
+
+  public:
+    ConversionBenchmark(const char* name,
+                        Kernel kernel) :
+      name_(name),
+      kernel_(kernel),
+      source_(COUNT_VOXELS),
+      target_(COUNT_VOXELS)
+    {
+      for (size_t i = 0; i < COUNT_VOXELS; i++)
+      {
+        source_[i] = static_cast<Source>(i * 7919);
+      }
+    }
+
+    virtual const char* GetName() const ORTHANC_OVERRIDE
+    {
+      return name_;
+    }
+
+    virtual size_t GetTrafficSize() const ORTHANC_OVERRIDE
+    {
+      return COUNT_VOXELS * (sizeof(Source) + sizeof(Target));
+    }
+
+    virtual void Run() ORTHANC_OVERRIDE
+    {
+      kernel_(&target_[0], &source_[0], COUNT_VOXELS);
+    }
+  };
+
+
+  // Writes one slice of 512x512 pixels into a NIfTI file, flipping the rows and converting the pixels
+  class NiftiWriterBenchmark : public IBenchmark
+  {
+  private:
+    std::string                          name_;
+    Orthanc::Image                       slice_;
+    double                               rescaleSlope_;
+    std::string                          buffer_;
+    std::unique_ptr<Neuro::NiftiWriter>  writer_;
+
+  public:
+    NiftiWriterBenchmark(const std::string& name,
+                         Orthanc::PixelFormat format,
+                         int datatype,
+                         double rescaleSlope) :
+      name_(name),
+      slice_(format, 512, 512, false),
+      rescaleSlope_(rescaleSlope)
+    {
+      assert(512 * 512 == COUNT_VOXELS);
+
+      for (unsigned int y = 0; y < slice_.GetHeight(); y++)
+      {
+        uint8_t* p = reinterpret_cast<uint8_t*>(slice_.GetRow(y));
+        for (unsigned int x = 0; x < slice_.GetPitch(); x++)
+        {
+          p[x] = static_cast<uint8_t>(x * 7 + y);
+        }
+      }
+
+      nifti_image nifti;
+      memset(&nifti, 0, sizeof(nifti));
+      nifti.nifti_type = NIFTI_FTYPE_NIFTI1_1;
+      nifti.datatype = datatype;
+      nifti.nbyper = (datatype == NIFTI_TYPE_FLOAT32 ? 4 : Orthanc::GetBytesPerPixel(format));
+      nifti.scl_slope = 1;
+      nifti.dim[0] = nifti.ndim = 3;
+      nifti.dim[1] = nifti.nx = 512;
+      nifti.dim[2] = nifti.ny = 512;
+      nifti.dim[3] = nifti.nz = 1;
+      nifti.pixdim[1] = nifti.dx = 1;
+      nifti.pixdim[2] = nifti.dy = 1;
+      nifti.pixdim[3] = nifti.dz = 1;
+      nifti.nvox = COUNT_VOXELS;
+
+      buffer_.resize(Neuro::NiftiWriter::ComputeFileSize(nifti));
+      writer_.reset(new Neuro::NiftiWriter(&buffer_[0], buffer_.size()));
+      writer_->WriteHeader(nifti);
+    }
+
+    virtual const char* GetName() const ORTHANC_OVERRIDE
+    {
+      return name_.c_str();
+    }
+
+    virtual size_t GetTrafficSize() const ORTHANC_OVERRIDE
+    {
+      return COUNT_VOXELS * Orthanc::GetBytesPerPixel(slice_.GetFormat()) + (buffer_.size() - 352);
+    }
+
+    virtual void Run() ORTHANC_OVERRIDE
+    {
+      writer_->WriteSlice(0, slice_, rescaleSlope_, 0);
+    }
+  };
+}
+
+
+static void RescaleUInt16ToFloat32(float* target,
+                                   const uint16_t* source,
+                                   size_t count)
+{
+  Neuro::PixelKernels::RescaleUInt16ToFloat32(target, source, count, 0.5f, -1024.0f);
+}
+
+
+static void RescaleInt16ToFloat32(float* target,
+                                  const int16_t* source,
+                                  size_t count)
+{
+  Neuro::PixelKernels::RescaleInt16ToFloat32(target, source, count, 0.5f, -1024.0f);
+}
+
+
+static void RescaleUInt32ToFloat32(float* target,
+                                   const uint32_t* source,
+                                   size_t count)
+{
+  Neuro::PixelKernels::RescaleUInt32ToFloat32(target, source, count, 0.5f, -1024.0f);
+}
+
+
+static double MeasureThroughput(IBenchmark& benchmark)
+{
+  benchmark.Run();  // Warm up the caches
+
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  uint64_t countRuns = 0;
+  double elapsed = 0;
+
+  while (elapsed < MINIMUM_DURATION)
+  {
+    for (unsigned int i = 0; i < 16; i++)
+    {
+      benchmark.Run();
+    }
+
+    countRuns += 16;
+    elapsed = static_cast<double>((boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()) / 1000000.0;
+  }
+
+  return static_cast<double>(countRuns) * static_cast<double>(benchmark.GetTrafficSize()) / elapsed / 1e9;
+}
+
+
+int main()
+{
+  std::vector<IBenchmark*> benchmarks;
+  benchmarks.push_back(new ConversionBenchmark<uint16_t, uint16_t>("SwapBytes16", Neuro::PixelKernels::SwapBytes16));
+  benchmarks.push_back(new ConversionBenchmark<uint32_t, uint32_t>("SwapBytes32", Neuro::PixelKernels::SwapBytes32));
+  benchmarks.push_back(new ConversionBenchmark<uint8_t, uint16_t>("WidenUInt8ToUInt16", Neuro::PixelKernels::WidenUInt8ToUInt16));
+  benchmarks.push_back(new ConversionBenchmark<uint16_t, int32_t>("WidenUInt16ToInt32", Neuro::PixelKernels::WidenUInt16ToInt32));
+  benchmarks.push_back(new ConversionBenchmark<int16_t, int32_t>("WidenInt16ToInt32", Neuro::PixelKernels::WidenInt16ToInt32));
+  benchmarks.push_back(new ConversionBenchmark<uint16_t, float>("RescaleUInt16ToFloat32", RescaleUInt16ToFloat32));
+  benchmarks.push_back(new ConversionBenchmark<int16_t, float>("RescaleInt16ToFloat32", RescaleInt16ToFloat32));
+  benchmarks.push_back(new ConversionBenchmark<uint32_t, float>("RescaleUInt32ToFloat32", RescaleUInt32ToFloat32));
+
+  // Conversions of the DICOM pixel formats to the NIfTI datatypes
+  benchmarks.push_back(new NiftiWriterBenchmark("Grayscale8 -> UINT8", Orthanc::PixelFormat_Grayscale8, NIFTI_TYPE_UINT8, 1));
+  benchmarks.push_back(new NiftiWriterBenchmark("Grayscale16 -> UINT16", Orthanc::PixelFormat_Grayscale16, NIFTI_TYPE_UINT16, 1));
+  benchmarks.push_back(new NiftiWriterBenchmark("SignedGrayscale16 -> INT16", Orthanc::PixelFormat_SignedGrayscale16, NIFTI_TYPE_INT16, 1));
+  benchmarks.push_back(new NiftiWriterBenchmark("Grayscale32 -> UINT32", Orthanc::PixelFormat_Grayscale32, NIFTI_TYPE_UINT32, 1));
+  benchmarks.push_back(new NiftiWriterBenchmark("Float32 -> FLOAT32", Orthanc::PixelFormat_Float32, NIFTI_TYPE_FLOAT32, 1));
+  benchmarks.push_back(new NiftiWriterBenchmark("RGB24 -> RGB24", Orthanc::PixelFormat_RGB24, NIFTI_TYPE_RGB24, 1));
+  benchmarks.push_back(new NiftiWriterBenchmark("Grayscale8 -> UINT16", Orthanc::PixelFormat_Grayscale8, NIFTI_TYPE_UINT16, 1));
+  benchmarks.push_back(new NiftiWriterBenchmark("SignedGrayscale16 -> INT32", Orthanc::PixelFormat_SignedGrayscale16, NIFTI_TYPE_INT32, 1));
+  benchmarks.push_back(new NiftiWriterBenchmark("SignedGrayscale16 -> FLOAT32", Orthanc::PixelFormat_SignedGrayscale16, NIFTI_TYPE_FLOAT32, 0.5));
+  benchmarks.push_back(new NiftiWriterBenchmark("Grayscale32 -> FLOAT32", Orthanc::PixelFormat_Grayscale32, NIFTI_TYPE_FLOAT32, 0.5));
+
+  const Neuro::InstructionSet best = Neuro::PixelKernels::GetInstructionSet();
+
+  printf("Throughput in GB/s (bytes read + bytes written), with %d voxels per call, default instruction set: %s\n\n",
+         static_cast<int>(COUNT_VOXELS), Neuro::PixelKernels::EnumerationToString(best));
+
+  printf("%-32s", "Kernel");
+
+  std::vector<Neuro::InstructionSet> instructionSets;
+  for (int i = Neuro::InstructionSet_Scalar; i <= Neuro::InstructionSet_AVX2; i++)
+  {
+    const Neuro::InstructionSet instructionSet = static_cast<Neuro::InstructionSet>(i);
+    if (Neuro::PixelKernels::IsSupported(instructionSet))
+    {
+      instructionSets.push_back(instructionSet);
+      printf("%10s", Neuro::PixelKernels::EnumerationToString(instructionSet));
+    }
+  }
+
+  printf("\n");
+
+  for (size_t i = 0; i < benchmarks.size(); i++)
+  {
+    printf("%-32s", benchmarks[i]->GetName());
+
+    for (size_t j = 0; j < instructionSets.size(); j++)
+    {
+      Neuro::PixelKernels::SetInstructionSet(instructionSets[j]);
+      printf("%10.2f", MeasureThroughput(*benchmarks[i]));
+      fflush(stdout);
+    }
+
+    printf("\n");
+    delete benchmarks[i];
+  }
+
+  Neuro::PixelKernels::SetInstructionSet(best);
+
+  return 0;
+}
@@ -0,0 +1,311 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "BidsDataset.h"
+
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+#include <set>
+
+
+namespace Neuro
+{
+  // Splits the description into its lower-cased alphanumeric words
+  static void Tokenize(std::set<std::string>& tokens,
+                       const std::string& description)
+  {
+    std::string lower = description;
+    Orthanc::Toolbox::ToLowerCase(lower);
+
+    std::string current;
+
+    for (size_t i = 0; i <= lower.size(); i++)
+    {
+      if (i < lower.size() &&
+          ((lower[i] >= 'a' && lower[i] <= 'z') ||
+           (lower[i] >= '0' && lower[i] <= '9')))
+      {
+        current.push_back(lower[i]);
+      }
+      else if (!current.empty())
+      {
+        tokens.insert(current);
+        current.clear();
+      }
+    }
+  }
+
+
+  // Whole words are matched, so that e.g. "rest" doesn't match "restore" or "interest"
+  static bool HasToken(const std::set<std::string>& tokens,
+                       const char* keyword)
+  {
+    return tokens.find(keyword) != tokens.end();
+  }
+
+
+  const BidsDataset::Series& BidsDataset::GetSeries(size_t index) const
+  {
+    if (index >= series_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      return series_[index];
+    }
+  }
+
+
+  bool BidsDataset::IsBefore(size_t a,
+                             size_t b) const
+  {
+    // Order of the runs: By series number, then by order of insertion
+    if (series_[a].seriesNumber_ != series_[b].seriesNumber_)
+    {
+      return series_[a].seriesNumber_ < series_[b].seriesNumber_;
+    }
+    else
+    {
+      return a < b;
+    }
+  }
+
+
+  BidsDataset::BidsDataset(const std::string& subject) :
+    subject_(subject)
+  {
+    if (subject.empty() ||
+        SanitizeLabel(subject) != subject)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Invalid BIDS label for the subject: " + subject);
+    }
+  }
+
+
+  bool BidsDataset::AddSeries(const std::string& orthancId,
+                              const std::string& session,
+                              const std::string& modality,
+                              const std::string& description,
+                              int32_t seriesNumber)
+  {
+    if (SanitizeLabel(session) != session)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Invalid BIDS label for the session: " + session);
+    }
+
+    Series series;
+    series.datatype_ = ClassifySeries(series.task_, series.suffix_, modality, description);
+
+    if (series.datatype_ == BidsDatatype_Unknown ||
+        series.datatype_ == BidsDatatype_Diffusion)
+    {
+      return false;
+    }
+    else
+    {
+      series.orthancId_ = orthancId;
+      series.session_ = session;
+      series.seriesNumber_ = seriesNumber;
+      series_.push_back(series);
+      return true;
+    }
+  }
+
+
+  const std::string& BidsDataset::GetOrthancId(size_t index) const
+  {
+    return GetSeries(index).orthancId_;
+  }
+
+
+  std::string BidsDataset::GetPath(size_t index) const
+  {
+    const Series& series = GetSeries(index);
+
+    size_t countSiblings = 0;
+    size_t run = 1;
+
+    for (size_t i = 0; i < series_.size(); i++)
+    {
+      if (series_[i].session_ == series.session_ &&
+          series_[i].datatype_ == series.datatype_ &&
+          series_[i].task_ == series.task_ &&
+          series_[i].suffix_ == series.suffix_)
+      {
+        countSiblings++;
+
+        if (IsBefore(i, index))
+        {
+          run++;
+        }
+      }
+    }
+
+    std::string folder = "sub-" + subject_;
+    std::string filename = "sub-" + subject_;
+
+    if (!series.session_.empty())
+    {
+      folder += "/ses-" + series.session_;
+      filename += "_ses-" + series.session_;
+    }
+
+    if (!series.task_.empty())
+    {
+      filename += "_task-" + series.task_;
+    }
+
+    if (countSiblings > 1)
+    {
+      filename += "_run-" + boost::lexical_cast<std::string>(run);
+    }
+
+    return folder + "/" + GetFolder(series.datatype_) + "/" + filename + "_" + series.suffix_;
+  }
+
+
+  std::string BidsDataset::SanitizeLabel(const std::string& value)
+  {
+    std::string result;
+    result.reserve(value.size());
+
+    for (size_t i = 0; i < value.size(); i++)
+    {
+      const char c = value[i];
+
+      if ((c >= 'a' && c <= 'z') ||
+          (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9'))
+      {
+        result.push_back(c);
+      }
+    }
+
+    return result;
+  }
+
+
+  BidsDatatype BidsDataset::ClassifySeries(std::string& task,
+                                           std::string& suffix,
+                                           const std::string& modality,
+                                           const std::string& description)
+  {
+    task.clear();
+    suffix.clear();
+
+    if (modality == "PT")
+    {
+      suffix = "pet";
+      return BidsDatatype_PET;
+    }
+    else if (modality != "MR")
+    {
+      return BidsDatatype_Unknown;
+    }
+
+    std::set<std::string> s;
+    Tokenize(s, description);
+
+    if (HasToken(s, "localizer") ||
+        HasToken(s, "scout") ||
+        HasToken(s, "survey"))
+    {
+      return BidsDatatype_Unknown;
+    }
+    else if (HasToken(s, "dwi") ||
+             HasToken(s, "dti") ||
+             HasToken(s, "diff") ||
+             HasToken(s, "diffusion"))
+    {
+      suffix = "dwi";
+      return BidsDatatype_Diffusion;
+    }
+    else if (HasToken(s, "bold") ||
+             HasToken(s, "fmri") ||
+             HasToken(s, "rest") ||
+             HasToken(s, "resting") ||
+             HasToken(s, "task"))
+    {
+      // The "task" entity is mandatory for functional data
+      if (HasToken(s, "rest") ||
+          HasToken(s, "resting"))
+      {
+        task = "rest";
+      }
+      else
+      {
+        task = SanitizeLabel(description);
+        Orthanc::Toolbox::ToLowerCase(task);
+      }
+
+      suffix = "bold";
+      return BidsDatatype_Functional;
+    }
+    else if (HasToken(s, "flair"))
+    {
+      suffix = "FLAIR";
+      return BidsDatatype_Anatomical;
+    }
+    else if (HasToken(s, "t2") ||
+             HasToken(s, "t2w"))
+    {
+      suffix = "T2w";
+      return BidsDatatype_Anatomical;
+    }
+    else if (HasToken(s, "t1") ||
+             HasToken(s, "t1w") ||
+             HasToken(s, "mprage") ||
+             HasToken(s, "spgr"))
+    {
+      suffix = "T1w";
+      return BidsDatatype_Anatomical;
+    }
+    else
+    {
+      return BidsDatatype_Unknown;
+    }
+  }
+
+
+  const char* BidsDataset::GetFolder(BidsDatatype datatype)
+  {
+    switch (datatype)
+    {
+      case BidsDatatype_Anatomical:
+        return "anat";
+
+      case BidsDatatype_Functional:
+        return "func";
+
+      case BidsDatatype_Diffusion:
+        return "dwi";
+
+      case BidsDatatype_PET:
+        return "pet";
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+}
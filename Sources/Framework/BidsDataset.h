@@ -0,0 +1,105 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "NeuroEnumerations.h"
+
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+namespace Neuro
+{
+  /**
+   * Assigns a path in a BIDS dataset (https://bids.neuroimaging.io/)
+   * to each series of one subject. The datatype and the suffix of a
+   * series are guessed from its modality and its description. The
+   * "run" entity is added to the series that would otherwise share
+   * the same path, following the order of their series numbers.
+   **/
+  class BidsDataset : public boost::noncopyable
+  {
+  private:
+    struct Series
+    {
+      std::string   orthancId_;
+      std::string   session_;
+      BidsDatatype  datatype_;
+      std::string   task_;
+      std::string   suffix_;
+      int32_t       seriesNumber_;
+    };
+
+    std::string          subject_;
+    std::vector<Series>  series_;
+
+    const Series& GetSeries(size_t index) const;
+
+    bool IsBefore(size_t a,
+                  size_t b) const;
+
+  public:
+    explicit BidsDataset(const std::string& subject);
+
+    const std::string& GetSubject() const
+    {
+      return subject_;
+    }
+
+    /**
+     * The session label can be empty if the subject has a single
+     * session. Returns "false" if the series cannot be classified
+     * (e.g. localizers), in which case it is not added. Diffusion
+     * series are not added either, as BIDS requires their ".bval" and
+     * ".bvec" files, which are not generated yet.
+     **/
+    bool AddSeries(const std::string& orthancId,
+                   const std::string& session,
+                   const std::string& modality,
+                   const std::string& description,
+                   int32_t seriesNumber);
+
+    size_t GetCountSeries() const
+    {
+      return series_.size();
+    }
+
+    const std::string& GetOrthancId(size_t index) const;
+
+    // Path without the extension, e.g. "sub-01/ses-01/anat/sub-01_ses-01_T1w"
+    std::string GetPath(size_t index) const;
+
+    // Only keeps the alphanumeric characters, as required for the labels
+    static std::string SanitizeLabel(const std::string& value);
+
+    /**
+     * The description (i.e. "SeriesDescription" or "ProtocolName") is
+     * split into words, that are matched as a whole against keywords.
+     **/
+    static BidsDatatype ClassifySeries(std::string& task /* out */,
+                                       std::string& suffix /* out */,
+                                       const std::string& modality,
+                                       const std::string& description);
+
+    static const char* GetFolder(BidsDatatype datatype);
+  };
+}
@@ -182,6 +182,26 @@ namespace Neuro
   }
 
 
+  bool CSAHeader::ParseDouble(double& target,
+                              const std::string& tagName) const
+  {
+    Content::const_iterator found = content_.find(tagName);
+
+    if (found == content_.end())
+    {
+      return false;
+    }
+    else if (found->second->GetSize() != 1)
+    {
+      return false;
+    }
+    else
+    {
+      return found->second->ParseDouble(target, 0);
+    }
+  }
+
+
   CSATag& CSAHeader::AddTag(const std::string& name,
                             const std::string& vr)
   {
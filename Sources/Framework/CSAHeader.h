@@ -56,6 +56,9 @@ namespace Neuro
     bool ParseUnsignedInteger32(uint32_t& target,
                                 const std::string& tagName) const;
 
+    bool ParseDouble(double& target,
+                     const std::string& tagName) const;
+
     CSATag& AddTag(const std::string& name,
                    const std::string& vr);
 
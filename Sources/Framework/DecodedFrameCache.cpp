@@ -0,0 +1,210 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "DecodedFrameCache.h"
+
+#include <OrthancException.h>
+
+#include <cassert>
+
+
+namespace Neuro
+{
+  // Gives access to a frame that is possibly shared with the cache
+  class DecodedFrameCache::CachedFrame : public IDicomFrameDecoder::IDecodedFrame
+  {
+  private:
+    boost::shared_ptr<IDicomFrameDecoder::IDecodedFrame>  frame_;
+
+  public:
+    explicit CachedFrame(const boost::shared_ptr<IDicomFrameDecoder::IDecodedFrame>& frame) :
+      frame_(frame)
+    {
+      assert(frame_.get() != NULL);
+    }
+
+    virtual void GetRegion(Orthanc::ImageAccessor& region,
+                           unsigned int x,
+                           unsigned int y,
+                           unsigned int width,
+                           unsigned int height) ORTHANC_OVERRIDE
+    {
+      frame_->GetRegion(region, x, y, width, height);
+    }
+
+    virtual size_t GetMemorySize() const ORTHANC_OVERRIDE
+    {
+      return frame_->GetMemorySize();
+    }
+  };
+
+
+  DecodedFrameCache::FrameKey DecodedFrameCache::GetKey(const Slice& slice)
+  {
+    return std::make_pair(slice.GetInstanceIndexInCollection(), slice.GetFrameNumber());
+  }
+
+
+  void DecodedFrameCache::Evict()
+  {
+    // Belady's policy: Evict the frame that will be used again the
+    // farthest in the future (all the cached frames have a future use)
+    while (currentSize_ > maximumSize_)
+    {
+      assert(!content_.empty());
+
+      Content::iterator victim = content_.end();
+      size_t farthest = 0;
+
+      for (Content::iterator it = content_.begin(); it != content_.end(); ++it)
+      {
+        FutureAccesses::const_iterator accesses = futureAccesses_.find(it->first);
+        assert(accesses != futureAccesses_.end() &&
+               !accesses->second.empty());
+
+        if (victim == content_.end() ||
+            accesses->second.front() > farthest)
+        {
+          victim = it;
+          farthest = accesses->second.front();
+        }
+      }
+
+      assert(currentSize_ >= victim->second.size_);
+      currentSize_ -= victim->second.size_;
+      content_.erase(victim);
+    }
+  }
+
+
+  DecodedFrameCache::DecodedFrameCache(const std::vector<Slice>& accesses,
+                                       size_t maximumSize) :
+    maximumSize_(maximumSize),
+    currentSize_(0),
+    hits_(0),
+    misses_(0)
+  {
+    for (size_t i = 0; i < accesses.size(); i++)
+    {
+      futureAccesses_[GetKey(accesses[i])].push_back(i);
+    }
+  }
+
+
+  IDicomFrameDecoder::IDecodedFrame* DecodedFrameCache::DecodeFrame(IDicomFrameDecoder& decoder,
+                                                                    const Slice& slice)
+  {
+    const FrameKey key = GetKey(slice);
+    bool hasFutureAccess = false;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      FutureAccesses::iterator accesses = futureAccesses_.find(key);
+      if (accesses != futureAccesses_.end())
+      {
+        if (!accesses->second.empty())
+        {
+          accesses->second.pop_front();
+        }
+
+        if (accesses->second.empty())
+        {
+          futureAccesses_.erase(accesses);
+        }
+        else
+        {
+          hasFutureAccess = true;
+        }
+      }
+
+      Content::iterator found = content_.find(key);
+      if (found != content_.end())
+      {
+        hits_++;
+
+        std::unique_ptr<IDicomFrameDecoder::IDecodedFrame> result(new CachedFrame(found->second.frame_));
+
+        if (!hasFutureAccess)
+        {
+          // This was the last access to this frame
+          assert(currentSize_ >= found->second.size_);
+          currentSize_ -= found->second.size_;
+          content_.erase(found);
+        }
+
+        return result.release();
+      }
+      else
+      {
+        misses_++;
+      }
+    }
+
+    // Decode the frame outside of the lock, so that other threads can proceed
+    boost::shared_ptr<IDicomFrameDecoder::IDecodedFrame> frame(decoder.DecodeFrame(slice));
+    if (frame.get() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+
+    const size_t size = frame->GetMemorySize();
+
+    if (hasFutureAccess &&
+        size <= maximumSize_)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      // Another thread might have decoded the same frame in the meantime
+      if (content_.find(key) == content_.end() &&
+          futureAccesses_.find(key) != futureAccesses_.end())
+      {
+        Entry& entry = content_[key];
+        entry.frame_ = frame;
+        entry.size_ = size;
+        currentSize_ += size;
+
+        Evict();
+      }
+    }
+
+    return new CachedFrame(frame);
+  }
+
+
+  size_t DecodedFrameCache::GetCurrentSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return currentSize_;
+  }
+
+
+  unsigned int DecodedFrameCache::GetHits()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return hits_;
+  }
+
+
+  unsigned int DecodedFrameCache::GetMisses()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return misses_;
+  }
+}
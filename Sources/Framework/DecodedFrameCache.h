@@ -0,0 +1,84 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "IDicomFrameDecoder.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <deque>
+#include <map>
+
+
+namespace Neuro
+{
+  /**
+   * Cache of the decoded frames, with a bounded memory usage. The
+   * cache is given the full sequence of the frames that will be
+   * accessed, which allows to only keep the frames that will be used
+   * again, and to evict the frame whose next use is the farthest in
+   * the future once the memory budget is exceeded. This avoids
+   * decoding the same frame several times if the slices of the NIfTI
+   * volume are not in the order of the frames (e.g. 4D series).
+   **/
+  class DecodedFrameCache : public boost::noncopyable
+  {
+  private:
+    typedef std::pair<size_t, unsigned int>  FrameKey;  // Instance index in collection, frame number
+
+    class CachedFrame;
+
+    struct Entry
+    {
+      boost::shared_ptr<IDicomFrameDecoder::IDecodedFrame>  frame_;
+      size_t                                                size_;
+    };
+
+    typedef std::map<FrameKey, std::deque<size_t> >  FutureAccesses;
+    typedef std::map<FrameKey, Entry>                Content;
+
+    boost::mutex    mutex_;
+    size_t          maximumSize_;
+    size_t          currentSize_;
+    FutureAccesses  futureAccesses_;
+    Content         content_;
+    unsigned int    hits_;
+    unsigned int    misses_;
+
+    static FrameKey GetKey(const Slice& slice);
+
+    void Evict();
+
+  public:
+    // "accesses" lists the slices whose frames will be decoded, in the order of the accesses
+    DecodedFrameCache(const std::vector<Slice>& accesses,
+                      size_t maximumSize /* in bytes */);
+
+    // Thread-safe, as long as "decoder" is owned by the calling thread
+    IDicomFrameDecoder::IDecodedFrame* DecodeFrame(IDicomFrameDecoder& decoder,
+                                                   const Slice& slice);
+
+    size_t GetCurrentSize();
+
+    unsigned int GetHits();
+
+    unsigned int GetMisses();
+  };
+}
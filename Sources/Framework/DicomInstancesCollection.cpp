@@ -23,11 +23,13 @@
 
 #include <OrthancException.h>
 #include <SerializationToolbox.h>
+#include <Toolbox.h>
 
 #include <algorithm>
 #include <boost/lexical_cast.hpp>
 #include <cassert>
 
+static const std::string CSA_BANDWIDTH_PER_PIXEL_PHASE_ENCODE = "BandwidthPerPixelPhaseEncode";
 static const std::string CSA_PHASE_ENCODING_DIRECTION_POSITIVE = "PhaseEncodingDirectionPositive";
 
 
@@ -114,7 +116,17 @@ namespace Neuro
   {
     for (size_t i = 0; i < GetSize(); i++)
     {
-      GetInstance(i).ExtractSlices(slices, i);
+      const InputDicomInstance& instance = GetInstance(i);
+
+      std::list<Slice> instanceSlices;
+      instance.ExtractSlices(instanceSlices, i);
+
+      for (std::list<Slice>::iterator it = instanceSlices.begin(); it != instanceSlices.end(); ++it)
+      {
+        it->SetRescale(instance.GetRescaleSlope(), instance.GetRescaleIntercept());
+      }
+
+      slices.splice(slices.end(), instanceSlices);
     }
   }
 
@@ -226,6 +238,11 @@ namespace Neuro
     
     switch (format)
     {
+      case Orthanc::PixelFormat_Grayscale8:
+        nifti.datatype = NIFTI_TYPE_UINT8;
+        nifti.nbyper = 1;
+        break;
+
       case Orthanc::PixelFormat_Grayscale16:
         // In this situation, dcm2niix uses "NIFTI_TYPE_INT16", which is wrong
         nifti.datatype = NIFTI_TYPE_UINT16;
@@ -237,10 +254,44 @@ namespace Neuro
         nifti.nbyper = 2;
         break;
 
+      case Orthanc::PixelFormat_Grayscale32:
+        // Unsigned values, that could overflow "NIFTI_TYPE_INT32"
+        nifti.datatype = NIFTI_TYPE_UINT32;
+        nifti.nbyper = 4;
+        break;
+
+      case Orthanc::PixelFormat_Float32:
+        nifti.datatype = NIFTI_TYPE_FLOAT32;
+        nifti.nbyper = 4;
+        break;
+
+      case Orthanc::PixelFormat_RGB24:
+        nifti.datatype = NIFTI_TYPE_RGB24;
+        nifti.nbyper = 3;
+        nifti.scl_slope = 0;  // Scaling is not applicable to RGB
+        nifti.scl_inter = 0;
+        break;
+
       default:
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                        "Unsupported pixel format: " + std::string(Orthanc::EnumerationToString(format)));
     }
   }
+
+
+  static bool HasVaryingRescale(const std::vector<Slice>& slices)
+  {
+    for (size_t i = 1; i < slices.size(); i++)
+    {
+      if (!NeuroToolbox::IsNear(slices[0].GetRescaleSlope(), slices[i].GetRescaleSlope()) ||
+          !NeuroToolbox::IsNear(slices[0].GetRescaleIntercept(), slices[i].GetRescaleIntercept()))
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
   
   
   unsigned int DicomInstancesCollection::GetMultiBandFactor() const
@@ -256,6 +307,136 @@ namespace Neuro
   }
   
 
+  static void CopyStringTag(Json::Value& target,
+                            const char* key,
+                            const Orthanc::DicomMap& tags,
+                            const Orthanc::DicomTag& tag)
+  {
+    std::string value;
+    if (tags.LookupStringValue(value, tag, false))
+    {
+      value = Orthanc::Toolbox::StripSpaces(value);
+      if (!value.empty())
+      {
+        target[key] = value;
+      }
+    }
+  }
+
+
+  static void CopyNumberTag(Json::Value& target,
+                            const char* key,
+                            const Orthanc::DicomMap& tags,
+                            const Orthanc::DicomTag& tag)
+  {
+    double value;
+    if (tags.ParseDouble(value, tag))
+    {
+      target[key] = value;
+    }
+  }
+
+
+  // Same spelling as "Manufacturer" in the sidecars of dcm2niix
+  static const char* GetManufacturerName(Manufacturer manufacturer)
+  {
+    switch (manufacturer)
+    {
+      case Manufacturer_Siemens:
+        return "Siemens";
+
+      case Manufacturer_GE:
+        return "GE";
+
+      case Manufacturer_Hitachi:
+        return "Hitachi";
+
+      case Manufacturer_Mediso:
+        return "Mediso";
+
+      case Manufacturer_Philips:
+        return "Philips";
+
+      case Manufacturer_Toshiba:
+        return "Toshiba";
+
+      case Manufacturer_Canon:
+        return "Canon";
+
+      case Manufacturer_UIH:
+        return "UIH";
+
+      case Manufacturer_Bruker:
+        return "Bruker";
+
+      default:
+        return NULL;
+    }
+  }
+
+
+  bool DicomInstancesCollection::LookupSliceTiming(std::vector<double>& target,
+                                                   const nifti_image& nifti,
+                                                   const std::vector<Slice>& sortedSlices) const
+  {
+    const size_t countSlices = GetCountSlices(nifti);
+
+    const InputDicomInstance& firstInstance = GetInstance(sortedSlices[0].GetInstanceIndexInCollection());
+    const std::vector<double>& siemens = firstInstance.GetSliceTimingSiemens();
+
+    if (siemens.size() == countSlices)
+    {
+      target.resize(countSlices);
+      for (size_t i = 0; i < countSlices; i++)
+      {
+        target[i] = siemens[i] / 1000.0;
+      }
+
+      return true;
+    }
+
+    // Otherwise, use the acquisition times of the slices of the first volume
+    if (GetCountVolumes(nifti) <= 1 ||
+        sortedSlices.size() < countSlices)
+    {
+      return false;
+    }
+
+    target.resize(countSlices);
+
+    double lowest = 0;
+    for (size_t i = 0; i < countSlices; i++)
+    {
+      if (!sortedSlices[i].HasAcquisitionTime())
+      {
+        return false;
+      }
+
+      target[i] = NeuroToolbox::FixDicomTime(sortedSlices[i].GetAcquisitionTime());
+
+      if (i == 0 ||
+          target[i] < lowest)
+      {
+        lowest = target[i];
+      }
+    }
+
+    bool isSliceTiming = false;
+    for (size_t i = 0; i < countSlices; i++)
+    {
+      target[i] -= lowest;
+      
+      if (!NeuroToolbox::IsNear(target[i], 0))
+      {
+        isSliceTiming = true;
+      }
+    }
+
+    // All the slices have the same acquisition time in 3D acquisitions
+    return isSliceTiming;
+  }
+  
+
   void DicomInstancesCollection::WriteDescription(nifti_image& nifti,
                                                   const std::vector<Slice>& sortedSlices) const
   {
@@ -337,8 +518,12 @@ namespace Neuro
     }
     else
     {
-      instances_.push_back(instance);
+      // The instance is freed if an exception occurs
+      std::unique_ptr<InputDicomInstance> protection(instance);
+
+      instances_.reserve(instances_.size() + 1);  // "push_back()" cannot throw below
       orthancIds_.push_back(orthancId);
+      instances_.push_back(protection.release());
     }
   }
     
@@ -439,6 +624,23 @@ namespace Neuro
     
     InitializeNiftiHeader(nifti, firstInstance);
 
+    if ((nifti.datatype == NIFTI_TYPE_UINT16 ||
+         nifti.datatype == NIFTI_TYPE_INT16 ||
+         nifti.datatype == NIFTI_TYPE_UINT32) &&
+        HasVaryingRescale(sortedSlices))
+    {
+      /**
+       * The NIfTI header has a single slope/intercept pair, whereas
+       * each instance has its own rescaling (which is typically the
+       * case of PET). The rescaled values are stored as floats, and
+       * "NiftiWriter" applies the rescaling of each slice.
+       **/
+      nifti.datatype = NIFTI_TYPE_FLOAT32;
+      nifti.nbyper = 4;
+      nifti.scl_slope = 1;
+      nifti.scl_inter = 0;
+    }
+
     nifti.dim[1] = nifti.nx = sortedSlices[0].GetWidth();
     nifti.dim[2] = nifti.ny = sortedSlices[0].GetHeight();
 
@@ -544,4 +746,246 @@ namespace Neuro
 
     assert(slices.size() == sortedSlices.size());
   }
+
+
+  void DicomInstancesCollection::FormatSidecar(Json::Value& target,
+                                               const nifti_image& nifti,
+                                               const std::vector<Slice>& slices) const
+  {
+    if (slices.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    const InputDicomInstance& firstInstance = GetInstance(slices[0].GetInstanceIndexInCollection());
+
+    const Orthanc::DicomMap& tags = firstInstance.GetTags();
+
+    target = Json::objectValue;
+
+    switch (firstInstance.GetModality())
+    {
+      case Modality_MR:
+        target["Modality"] = "MR";
+        break;
+
+      case Modality_PET:
+        target["Modality"] = "PT";
+        break;
+
+      case Modality_CT:
+        target["Modality"] = "CT";
+        break;
+
+      default:
+        break;
+    }
+
+    const char* manufacturer = GetManufacturerName(firstInstance.GetManufacturer());
+    if (manufacturer != NULL)
+    {
+      target["Manufacturer"] = manufacturer;
+    }
+    else
+    {
+      CopyStringTag(target, "Manufacturer", tags, Orthanc::DICOM_TAG_MANUFACTURER);
+    }
+
+    CopyStringTag(target, "ManufacturersModelName", tags, DICOM_TAG_MANUFACTURER_MODEL_NAME);
+    CopyNumberTag(target, "MagneticFieldStrength", tags, DICOM_TAG_MAGNETIC_FIELD_STRENGTH);
+    CopyStringTag(target, "SeriesDescription", tags, Orthanc::DICOM_TAG_SERIES_DESCRIPTION);
+    CopyStringTag(target, "ProtocolName", tags, Orthanc::DICOM_TAG_PROTOCOL_NAME);
+    CopyNumberTag(target, "SliceThickness", tags, Orthanc::DICOM_TAG_SLICE_THICKNESS);
+    CopyNumberTag(target, "FlipAngle", tags, DICOM_TAG_FLIP_ANGLE);
+
+    int32_t seriesNumber;
+    if (tags.ParseInteger32(seriesNumber, Orthanc::DICOM_TAG_SERIES_NUMBER))
+    {
+      target["SeriesNumber"] = seriesNumber;
+    }
+
+    // DICOM expresses the times in milliseconds, and BIDS in seconds
+    if (firstInstance.HasEchoTime())
+    {
+      target["EchoTime"] = firstInstance.GetEchoTime() / 1000.0;
+    }
+
+    double repetitionTime;
+    if (firstInstance.LookupRepetitionTime(repetitionTime))
+    {
+      target["RepetitionTime"] = repetitionTime / 1000.0;
+    }
+
+    std::vector<double> sliceTiming;
+    if (LookupSliceTiming(sliceTiming, nifti, slices))
+    {
+      Json::Value timing = Json::arrayValue;
+      for (size_t i = 0; i < sliceTiming.size(); i++)
+      {
+        timing.append(sliceTiming[i]);
+      }
+
+      target["SliceTiming"] = timing;
+    }
+
+    const unsigned int multiBandFactor = GetMultiBandFactor();
+    if (multiBandFactor > 1)
+    {
+      target["MultibandAccelerationFactor"] = multiBandFactor;
+    }
+
+    std::string axis;
+    switch (firstInstance.GetPhaseEncodingDirection())
+    {
+      case PhaseEncodingDirection_Row:
+        axis = "i";
+        break;
+
+      case PhaseEncodingDirection_Column:
+        axis = "j";
+        break;
+
+      default:
+        break;
+    }
+
+    if (!axis.empty())
+    {
+      uint32_t positive;
+      if (firstInstance.GetCSAHeader().ParseUnsignedInteger32(positive, CSA_PHASE_ENCODING_DIRECTION_POSITIVE))
+      {
+        /**
+         * The polarity along "j" is reversed, as the Y axis is flipped
+         * by "ConvertDicomToNiftiOrientation()". This is the same
+         * convention as dcm2niix.
+         **/
+        const bool negative = (axis == "i" ? positive == 0 : positive != 0);
+        target["PhaseEncodingDirection"] = axis + (negative ? "-" : "");
+      }
+      else
+      {
+        // The polarity is unknown
+        target["PhaseEncodingAxis"] = axis;
+      }
+
+      /**
+       * Readout of the EPI sequences of Siemens, as computed by
+       * dcm2niix. The number of phase encoding steps of the
+       * reconstructed image is the size of the NIfTI volume along
+       * the phase encoding axis.
+       **/
+      double bandwidth;
+      if (firstInstance.GetCSAHeader().ParseDouble(bandwidth, CSA_BANDWIDTH_PER_PIXEL_PHASE_ENCODE) &&
+          bandwidth > 0)
+      {
+        const int reconMatrixPE = (axis == "i" ? nifti.nx : nifti.ny);
+
+        target["BandwidthPerPixelPhaseEncode"] = bandwidth;
+
+        if (reconMatrixPE > 1)
+        {
+          const double effectiveEchoSpacing = 1.0 / (bandwidth * static_cast<double>(reconMatrixPE));
+          target["EffectiveEchoSpacing"] = effectiveEchoSpacing;
+          target["TotalReadoutTime"] = effectiveEchoSpacing * static_cast<double>(reconMatrixPE - 1);
+        }
+      }
+    }
+  }
+
+
+  size_t DicomInstancesCollection::GetCountSlices(const nifti_image& nifti)
+  {
+    return (nifti.nz <= 0 ? 1 : static_cast<size_t>(nifti.nz));
+  }
+
+
+  size_t DicomInstancesCollection::GetCountVolumes(const nifti_image& nifti)
+  {
+    // The "nt" field is zero in 3D volumes
+    return (nifti.ndim < 4 || nifti.nt <= 0 ? 1 : static_cast<size_t>(nifti.nt));
+  }
+
+
+  void DicomInstancesCollection::ExtractSubVolume(nifti_image& nifti,
+                                                  std::vector<Slice>& slices,
+                                                  size_t firstSlice,
+                                                  size_t endSlice,
+                                                  size_t firstVolume,
+                                                  size_t endVolume)
+  {
+    const size_t countSlices = GetCountSlices(nifti);
+    const size_t countVolumes = GetCountVolumes(nifti);
+
+    if (slices.size() != countSlices * countVolumes)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    if (firstSlice >= endSlice ||
+        endSlice > countSlices ||
+        firstVolume >= endVolume ||
+        endVolume > countVolumes)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "The sub-volume is empty or outside of the NIfTI volume, which has " +
+                                      boost::lexical_cast<std::string>(countSlices) + " slice(s) and " +
+                                      boost::lexical_cast<std::string>(countVolumes) + " volume(s)");
+    }
+
+    // The slices are ordered by volume, then by slice index
+    std::vector<Slice> selected;
+    selected.reserve((endSlice - firstSlice) * (endVolume - firstVolume));
+
+    for (size_t t = firstVolume; t < endVolume; t++)
+    {
+      for (size_t z = firstSlice; z < endSlice; z++)
+      {
+        selected.push_back(slices[t * countSlices + z]);
+      }
+    }
+
+    slices.swap(selected);
+
+    nifti.dim[3] = nifti.nz = static_cast<int>(endSlice - firstSlice);
+
+    if (nifti.ndim >= 4)
+    {
+      nifti.dim[4] = nifti.nt = static_cast<int>(endVolume - firstVolume);
+    }
+
+    nifti.nvox = 1;
+    for (int i = 0; i < nifti.ndim; i++)
+    {
+      nifti.nvox *= nifti.dim[i + 1];
+    }
+
+    // The voxel "(0, 0, firstSlice)" becomes the origin
+    const double z = static_cast<double>(firstSlice);
+    for (uint8_t i = 0; i < 3; i++)
+    {
+      nifti.sto_xyz.m[i][3] += nifti.sto_xyz.m[i][2] * z;
+    }
+
+    nifti.qoffset_x = nifti.sto_xyz.m[0][3];
+    nifti.qoffset_y = nifti.sto_xyz.m[1][3];
+    nifti.qoffset_z = nifti.sto_xyz.m[2][3];
+
+    if (firstSlice != 0 ||
+        endSlice != countSlices)
+    {
+      // The slice timing pattern (e.g. interleaved acquisition) was
+      // detected for the full stack of slices, and doesn't describe a
+      // subset of this stack
+      nifti.slice_code = NIFTI_SLICE_UNKNOWN;
+      nifti.slice_start = 0;
+      nifti.slice_end = 0;
+      nifti.slice_duration = 0;
+    }
+
+    if (nifti.ndim >= 4)
+    {
+      // The first selected volume is the new origin of the time axis
+      nifti.toffset += static_cast<float>(firstVolume) * nifti.dt;
+    }
+  }
 }
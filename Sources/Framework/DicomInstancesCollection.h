@@ -21,6 +21,7 @@
 
 #include "InputDicomInstance.h"
 
+#include <json/value.h>
 #include <nifti1_io.h>
 
 
@@ -34,13 +35,17 @@ namespace Neuro
 
     unsigned int GetMultiBandFactor() const;
 
+    bool LookupSliceTiming(std::vector<double>& target,
+                           const nifti_image& nifti,
+                           const std::vector<Slice>& sortedSlices) const;
+
     void WriteDescription(nifti_image& nifti,
                           const std::vector<Slice>& sortedSlices) const;
 
   public:
     ~DicomInstancesCollection();
 
-    void AddInstance(InputDicomInstance* instance,  // Takes ownership
+    void AddInstance(InputDicomInstance* instance,  // Takes ownership, even if an exception is thrown
                      const std::string& orthancId);
     
     size_t GetSize() const
@@ -56,5 +61,37 @@ namespace Neuro
 
     void CreateNiftiHeader(nifti_image& nifti /* out */,
                            std::vector<Slice>& slices /* out */) const;
+
+    /**
+     * Fills the JSON sidecar of the NIfTI file created by
+     * "CreateNiftiHeader()", using the BIDS conventions (times are
+     * expressed in seconds) and the field names of dcm2niix. Only the
+     * DICOM tags that were parsed while loading the instances are
+     * used (cf. "InputDicomInstance::ListRequiredTags()").
+     **/
+    void FormatSidecar(Json::Value& target,
+                       const nifti_image& nifti,
+                       const std::vector<Slice>& slices) const;
+
+    /**
+     * Restricts the NIfTI volume created by "CreateNiftiHeader()" to
+     * the slices "[firstSlice, endSlice)" of the volumes (timepoints)
+     * "[firstVolume, endVolume)". The dimensions of the header are
+     * updated, its origin is shifted to the first selected slice and
+     * its time offset to the first selected volume, so that the
+     * result is a valid NIfTI file. The slice timing information is
+     * reset if the slices are restricted. Only the selected slices
+     * are kept, which avoids decoding the other frames.
+     **/
+    static void ExtractSubVolume(nifti_image& nifti /* in-out */,
+                                 std::vector<Slice>& slices /* in-out */,
+                                 size_t firstSlice,
+                                 size_t endSlice,
+                                 size_t firstVolume,
+                                 size_t endVolume);
+
+    static size_t GetCountSlices(const nifti_image& nifti);
+
+    static size_t GetCountVolumes(const nifti_image& nifti);
   };
 }
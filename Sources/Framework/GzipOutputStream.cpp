@@ -0,0 +1,142 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "GzipOutputStream.h"
+
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <string.h>
+
+
+namespace Neuro
+{
+  static const size_t OUTPUT_BUFFER_SIZE = 256 * 1024;
+
+
+  void GzipOutputStream::Deflate(int flush)
+  {
+    for (;;)
+    {
+      stream_.next_out = reinterpret_cast<Bytef*>(&buffer_[0]);
+      stream_.avail_out = static_cast<uInt>(buffer_.size());
+
+      int code = deflate(&stream_, flush);
+      if (code != Z_OK &&
+          code != Z_STREAM_END &&
+          code != Z_BUF_ERROR)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                        "Error while compressing with zlib");
+      }
+
+      const size_t produced = buffer_.size() - stream_.avail_out;
+      if (produced > 0)
+      {
+        target_.Write(buffer_.c_str(), produced);
+      }
+
+      if (flush == Z_FINISH)
+      {
+        if (code == Z_STREAM_END)
+        {
+          return;
+        }
+      }
+      else if (stream_.avail_in == 0 &&
+               stream_.avail_out != 0)
+      {
+        return;
+      }
+    }
+  }
+
+
+  GzipOutputStream::GzipOutputStream(IOutputStream& target,
+                                     uint8_t compressionLevel) :
+    target_(target),
+    buffer_(OUTPUT_BUFFER_SIZE, '\0'),
+    finished_(false)
+  {
+    if (compressionLevel > 9)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Compression level must be between 0 and 9");
+    }
+
+    memset(&stream_, 0, sizeof(stream_));
+    stream_.zalloc = Z_NULL;
+    stream_.zfree = Z_NULL;
+    stream_.opaque = Z_NULL;
+
+    // "MAX_WBITS + 16" asks zlib to generate a gzip header and trailer
+    if (deflateInit2(&stream_, compressionLevel, Z_DEFLATED, MAX_WBITS + 16,
+                     8 /* default memory level */, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+    }
+  }
+
+
+  GzipOutputStream::~GzipOutputStream()
+  {
+    deflateEnd(&stream_);
+  }
+
+
+  void GzipOutputStream::Write(const void* data,
+                               size_t size)
+  {
+    if (finished_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+
+    while (size > 0)
+    {
+      // "avail_in" is a 32-bit integer in zlib
+      const size_t chunk = std::min(size, static_cast<size_t>(1024 * 1024 * 1024));
+
+      stream_.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(p));
+      stream_.avail_in = static_cast<uInt>(chunk);
+      Deflate(Z_NO_FLUSH);
+
+      p += chunk;
+      size -= chunk;
+    }
+  }
+
+
+  void GzipOutputStream::Finish()
+  {
+    if (finished_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      stream_.next_in = NULL;
+      stream_.avail_in = 0;
+      Deflate(Z_FINISH);
+      finished_ = true;
+    }
+  }
+}
@@ -0,0 +1,60 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "IOutputStream.h"
+
+#include <Compatibility.h>  // For ORTHANC_OVERRIDE
+
+#include <stdint.h>
+#include <string>
+#include <zlib.h>
+
+
+namespace Neuro
+{
+  /**
+   * Incremental gzip compression: The data written to this stream is
+   * deflated on-the-fly, and the compressed bytes are forwarded to
+   * the target stream. The uncompressed data is never accumulated.
+   **/
+  class GzipOutputStream : public IOutputStream
+  {
+  private:
+    IOutputStream&  target_;
+    z_stream        stream_;
+    std::string     buffer_;
+    bool            finished_;
+
+    void Deflate(int flush);
+
+  public:
+    GzipOutputStream(IOutputStream& target,
+                     uint8_t compressionLevel);
+
+    virtual ~GzipOutputStream();
+
+    virtual void Write(const void* data,
+                       size_t size) ORTHANC_OVERRIDE;
+
+    // Writes the gzip trailer. No data can be written afterward.
+    void Finish();
+  };
+}
@@ -19,70 +19,737 @@
 
 #include "IDicomFrameDecoder.h"
 
+#include "DecodedFrameCache.h"
+
+#include <Logging.h>
 #include <OrthancException.h>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <set>
+
 
 namespace Neuro
 {
-  void IDicomFrameDecoder::Apply(NiftiWriter& writer,
-                                 IDicomFrameDecoder& decoder,
-                                 const std::vector<Slice>& slices)
+  namespace
   {
-    for (size_t i = 1; i < slices.size(); i++)
+    class SliceWriter : public boost::noncopyable
     {
-      if (slices[0].GetWidth() != slices[i].GetWidth() ||
-          slices[0].GetHeight() != slices[i].GetHeight())
+    private:
+      NiftiWriter&          writer_;
+      boost::mutex          mutex_;  // Protects the format, for concurrent calls to "WriteAt()"
+      bool                  first_;
+      Orthanc::PixelFormat  format_;
+
+      void GetRegion(Orthanc::ImageAccessor& region,
+                     IDicomFrameDecoder::IDecodedFrame& frame,
+                     const Slice& slice)
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
-                                        "The slices have varying dimensions");
+        frame.GetRegion(region, slice.GetX(), slice.GetY(), slice.GetWidth(), slice.GetHeight());
+
+        if (region.GetWidth() != slice.GetWidth() ||
+            region.GetHeight() != slice.GetHeight())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+
+        boost::mutex::scoped_lock lock(mutex_);
+        
+        if (first_)
+        {
+          first_ = false;
+          format_ = region.GetFormat();
+        }
+
+        if (region.GetFormat() != format_)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat,
+                                          "The slices have varying pixel formats");
+        }
+      }
+
+    public:
+      explicit SliceWriter(NiftiWriter& writer) :
+        writer_(writer),
+        first_(true),
+        format_(Orthanc::PixelFormat_Grayscale8)  // Dummy initialization
+      {
+      }
+
+      void Write(IDicomFrameDecoder::IDecodedFrame& frame,
+                 const Slice& slice)
+      {
+        Orthanc::ImageAccessor region;
+        GetRegion(region, frame, slice);
+        writer_.AddSlice(region, slice.GetRescaleSlope(), slice.GetRescaleIntercept());
+      }
+
+      void WriteAt(IDicomFrameDecoder::IDecodedFrame& frame,
+                   const Slice& slice,
+                   size_t index)
+      {
+        Orthanc::ImageAccessor region;
+        GetRegion(region, frame, slice);
+        writer_.WriteSlice(index, region, slice.GetRescaleSlope(), slice.GetRescaleIntercept());
+      }
+    };
+
+
+    // A "run" is a sequence of consecutive slices that are extracted
+    // from the same frame, which must only be decoded once
+    struct FrameRun
+    {
+      size_t  firstSlice_;
+      size_t  endSlice_;   // Excluded
+    };
+
+
+    static void CheckSlices(const std::vector<Slice>& slices)
+    {
+      for (size_t i = 1; i < slices.size(); i++)
+      {
+        if (slices[0].GetWidth() != slices[i].GetWidth() ||
+            slices[0].GetHeight() != slices[i].GetHeight())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                          "The slices have varying dimensions");
+        }
       }
     }
-      
-    size_t currentInstanceIndex;
-    unsigned int currentFrameNumber;
-    std::unique_ptr<IDecodedFrame> currentFrame;
 
-    bool first = true;
-    Orthanc::PixelFormat format;
 
-    for (size_t i = 0; i < slices.size(); i++)
+    static void ComputeFrameRuns(std::vector<FrameRun>& runs,
+                                 const std::vector<Slice>& slices)
     {
-      if (currentFrame.get() == NULL ||
-          currentInstanceIndex != slices[i].GetInstanceIndexInCollection() ||
-          currentFrameNumber != slices[i].GetFrameNumber())
+      runs.clear();
+
+      for (size_t i = 0; i < slices.size(); i++)
       {
-        currentFrame.reset(decoder.DecodeFrame(slices[i]));
-        if (currentFrame.get() == NULL)
+        if (runs.empty() ||
+            slices[i].GetInstanceIndexInCollection() != slices[runs.back().firstSlice_].GetInstanceIndexInCollection() ||
+            slices[i].GetFrameNumber() != slices[runs.back().firstSlice_].GetFrameNumber())
         {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+          FrameRun run;
+          run.firstSlice_ = i;
+          run.endSlice_ = i + 1;
+          runs.push_back(run);
+        }
+        else
+        {
+          runs.back().endSlice_ = i + 1;
         }
-          
-        currentInstanceIndex = slices[i].GetInstanceIndexInCollection();
-        currentFrameNumber = slices[i].GetFrameNumber();
       }
+    }
+
 
-      Orthanc::ImageAccessor region;
-      currentFrame->GetRegion(region, slices[i].GetX(), slices[i].GetY(), slices[i].GetWidth(), slices[i].GetHeight());
+    static IDicomFrameDecoder::IDecodedFrame* DecodeFrameWithCache(IDicomFrameDecoder& decoder,
+                                                          DecodedFrameCache* cache /* can be NULL */,
+                                                          const Slice& slice)
+    {
+      std::unique_ptr<IDicomFrameDecoder::IDecodedFrame> frame;
 
-      if (region.GetWidth() != slices[i].GetWidth() ||
-          region.GetHeight() != slices[i].GetHeight())
+      if (cache == NULL)
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        frame.reset(decoder.DecodeFrame(slice));
       }
-        
-      if (first)
+      else
+      {
+        frame.reset(cache->DecodeFrame(decoder, slice));
+      }
+
+      if (frame.get() == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      }
+      else
+      {
+        return frame.release();
+      }
+    }
+
+
+    // Creates the cache of the frames that are used by non-consecutive runs (if any)
+    static DecodedFrameCache* CreateFrameCache(const std::vector<Slice>& slices,
+                                               const std::vector<FrameRun>& runs,
+                                               size_t frameCacheSize)
+    {
+      if (frameCacheSize == 0)
+      {
+        return NULL;
+      }
+
+      std::vector<Slice> accesses;
+      accesses.reserve(runs.size());
+
+      std::set< std::pair<size_t, unsigned int> > frames;
+      for (size_t i = 0; i < runs.size(); i++)
+      {
+        const Slice& slice = slices[runs[i].firstSlice_];
+        accesses.push_back(slice);
+        frames.insert(std::make_pair(slice.GetInstanceIndexInCollection(), slice.GetFrameNumber()));
+      }
+
+      if (frames.size() == runs.size())
+      {
+        return NULL;  // Each frame is used by one single run, no cache is needed
+      }
+      else
+      {
+        return new DecodedFrameCache(accesses, frameCacheSize);
+      }
+    }
+
+
+    static void LogFrameCache(DecodedFrameCache* cache /* can be NULL */)
+    {
+      if (cache != NULL)
+      {
+        const unsigned int hits = cache->GetHits();
+        const unsigned int misses = cache->GetMisses();
+
+        LOG(INFO) << "Cache of decoded frames: " << hits << " hit(s), " << misses << " miss(es), hit rate of "
+                  << (hits + misses == 0 ? 0 : (100 * hits / (hits + misses))) << "%";
+      }
+    }
+
+
+    // All the slices that are extracted from one given frame
+    struct FrameGroup
+    {
+      size_t               firstSlice_;  // Used to decode the frame
+      std::vector<size_t>  slices_;      // Indices of the slices in the NIfTI volume
+    };
+
+
+    // The groups are sorted by instance index, then by frame number
+    static void ComputeFrameGroups(std::vector<FrameGroup>& groups,
+                                   const std::vector<Slice>& slices)
+    {
+      typedef std::map< std::pair<size_t, unsigned int>, std::vector<size_t> >  Frames;
+
+      Frames frames;
+      for (size_t i = 0; i < slices.size(); i++)
+      {
+        frames[std::make_pair(slices[i].GetInstanceIndexInCollection(), slices[i].GetFrameNumber())].push_back(i);
+      }
+
+      groups.clear();
+      groups.reserve(frames.size());
+
+      for (Frames::const_iterator it = frames.begin(); it != frames.end(); ++it)
+      {
+        assert(!it->second.empty());
+
+        groups.push_back(FrameGroup());
+        groups.back().firstSlice_ = it->second.front();
+        groups.back().slices_ = it->second;
+      }
+    }
+
+
+    static void WriteFrameGroup(SliceWriter& writer,
+                                IDicomFrameDecoder& decoder,
+                                const std::vector<Slice>& slices,
+                                const FrameGroup& group)
+    {
+      std::unique_ptr<IDicomFrameDecoder::IDecodedFrame> frame(decoder.DecodeFrame(slices[group.firstSlice_]));
+      if (frame.get() == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      }
+
+      for (size_t i = 0; i < group.slices_.size(); i++)
+      {
+        const size_t index = group.slices_[i];
+        writer.WriteAt(*frame, slices[index], index);
+      }
+    }
+
+
+    /**
+     * Pool of workers that decode the frame groups in storage order,
+     * and that write their slices directly at their final location.
+     * No reordering is needed, as the writer provides random access.
+     * Each worker processes all the frames of one instance at once,
+     * so that the instance is only fetched by one decoder.
+     **/
+    class RandomAccessPool : public boost::noncopyable
+    {
+    private:
+      SliceWriter&                    writer_;
+      const std::vector<Slice>&       slices_;
+      const std::vector<FrameGroup>&  groups_;
+      std::vector<size_t>             instancesStart_;  // Index of the first group of each instance
+
+      boost::mutex                    mutex_;
+      size_t                          nextInstance_;
+      bool                            hasFailure_;
+      Orthanc::ErrorCode              failureCode_;
+      std::string                     failureDetails_;
+
+      void SetFailure(Orthanc::ErrorCode code,
+                      const std::string& details)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (!hasFailure_)
+        {
+          hasFailure_ = true;
+          failureCode_ = code;
+          failureDetails_ = details;
+        }
+      }
+
+      static void Worker(RandomAccessPool* that,
+                         IDicomFrameDecoder* decoder /* takes ownership */)
+      {
+        assert(that != NULL);
+        std::unique_ptr<IDicomFrameDecoder> protection(decoder);
+
+        for (;;)
+        {
+          size_t instance;
+
+          {
+            boost::mutex::scoped_lock lock(that->mutex_);
+
+            if (that->hasFailure_ ||
+                that->nextInstance_ >= that->GetCountInstances())
+            {
+              return;
+            }
+
+            instance = that->nextInstance_;
+            that->nextInstance_++;
+          }
+
+          try
+          {
+            const size_t end = (instance + 1 < that->instancesStart_.size() ?
+                                that->instancesStart_[instance + 1] : that->groups_.size());
+
+            for (size_t group = that->instancesStart_[instance]; group < end; group++)
+            {
+              WriteFrameGroup(that->writer_, *decoder, that->slices_, that->groups_[group]);
+            }
+          }
+          catch (Orthanc::OrthancException& e)
+          {
+            that->SetFailure(e.GetErrorCode(), e.HasDetails() ? e.GetDetails() : "");
+            return;
+          }
+          catch (...)
+          {
+            that->SetFailure(Orthanc::ErrorCode_InternalError, "Native exception while decoding a frame");
+            return;
+          }
+        }
+      }
+
+    public:
+      RandomAccessPool(SliceWriter& writer,
+                       const std::vector<Slice>& slices,
+                       const std::vector<FrameGroup>& groups) :
+        writer_(writer),
+        slices_(slices),
+        groups_(groups),
+        nextInstance_(0),
+        hasFailure_(false),
+        failureCode_(Orthanc::ErrorCode_Success)
+      {
+        for (size_t i = 0; i < groups.size(); i++)
+        {
+          if (i == 0 ||
+              slices[groups[i].firstSlice_].GetInstanceIndexInCollection() !=
+              slices[groups[i - 1].firstSlice_].GetInstanceIndexInCollection())
+          {
+            instancesStart_.push_back(i);
+          }
+        }
+      }
+
+      size_t GetCountInstances() const
+      {
+        return instancesStart_.size();
+      }
+
+      void Run(IDicomFrameDecoder::IFactory& factory,
+               unsigned int countThreads)
+      {
+        std::vector<boost::thread*> workers;
+        workers.reserve(countThreads);
+
+        try
+        {
+          for (unsigned int i = 0; i < countThreads; i++)
+          {
+            std::unique_ptr<IDicomFrameDecoder> decoder(factory.CreateDecoder());
+            if (decoder.get() == NULL)
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+            }
+
+            workers.push_back(new boost::thread(Worker, this, decoder.get()));
+            decoder.release();
+          }
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          SetFailure(e.GetErrorCode(), e.HasDetails() ? e.GetDetails() : "");
+        }
+        catch (...)
+        {
+          SetFailure(Orthanc::ErrorCode_InternalError, "Cannot start the threads decoding the frames");
+        }
+
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+          assert(workers[i] != NULL);
+
+          if (workers[i]->joinable())
+          {
+            workers[i]->join();
+          }
+
+          delete workers[i];
+        }
+
+        if (hasFailure_)
+        {
+          throw Orthanc::OrthancException(failureCode_, failureDetails_);
+        }
+      }
+    };
+
+
+    /**
+     * Bounded producer/consumer pipeline: The workers decode the
+     * frames out of order, and store them into a reorder buffer that
+     * is indexed by the index of the run. The consumer (i.e. the
+     * caller thread) writes the slices in order. The workers cannot
+     * get ahead of the consumer by more than "windowSize" frames,
+     * which bounds the memory usage.
+     **/
+    class DecodingPipeline : public boost::noncopyable
+    {
+    private:
+      typedef std::map<size_t, IDicomFrameDecoder::IDecodedFrame*>  ReorderBuffer;
+
+      const std::vector<Slice>&     slices_;
+      const std::vector<FrameRun>&  runs_;
+      DecodedFrameCache*            cache_;
+      size_t                        windowSize_;
+      std::vector<boost::thread*>   workers_;
+
+      boost::mutex                  mutex_;
+      boost::condition_variable     frameDecoded_;
+      boost::condition_variable     windowMoved_;
+      bool                          stopping_;
+      size_t                        nextRunToDecode_;
+      size_t                        nextRunToWrite_;
+      ReorderBuffer                 reorderBuffer_;
+      bool                          hasFailure_;
+      Orthanc::ErrorCode            failureCode_;
+      std::string                   failureDetails_;
+
+      void SetFailure(Orthanc::ErrorCode code,
+                      const std::string& details)
       {
-        first = false;
-        format = region.GetFormat();
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+
+          if (!hasFailure_)
+          {
+            hasFailure_ = true;
+            failureCode_ = code;
+            failureDetails_ = details;
+          }
+        }
+
+        frameDecoded_.notify_all();
+        windowMoved_.notify_all();
       }
 
-      if (region.GetFormat() != format)
+      static void Worker(DecodingPipeline* that,
+                         IDicomFrameDecoder* decoder /* takes ownership */)
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_IncompatibleImageFormat,
-                                        "The slices have varying pixel formats");
+        assert(that != NULL);
+        std::unique_ptr<IDicomFrameDecoder> protection(decoder);
+
+        for (;;)
+        {
+          size_t run;
+
+          {
+            boost::mutex::scoped_lock lock(that->mutex_);
+
+            while (!that->stopping_ &&
+                   !that->hasFailure_ &&
+                   that->nextRunToDecode_ < that->runs_.size() &&
+                   that->nextRunToDecode_ >= that->nextRunToWrite_ + that->windowSize_)
+            {
+              that->windowMoved_.wait(lock);
+            }
+
+            if (that->stopping_ ||
+                that->hasFailure_ ||
+                that->nextRunToDecode_ >= that->runs_.size())
+            {
+              return;
+            }
+
+            run = that->nextRunToDecode_;
+            that->nextRunToDecode_++;
+          }
+
+          std::unique_ptr<IDicomFrameDecoder::IDecodedFrame> frame;
+
+          try
+          {
+            frame.reset(DecodeFrameWithCache(*decoder, that->cache_, that->slices_[that->runs_[run].firstSlice_]));
+          }
+          catch (Orthanc::OrthancException& e)
+          {
+            that->SetFailure(e.GetErrorCode(), e.HasDetails() ? e.GetDetails() : "");
+            return;
+          }
+          catch (...)
+          {
+            that->SetFailure(Orthanc::ErrorCode_InternalError, "Native exception while decoding a frame");
+            return;
+          }
+
+          {
+            boost::mutex::scoped_lock lock(that->mutex_);
+            that->reorderBuffer_[run] = frame.release();
+          }
+
+          that->frameDecoded_.notify_all();
+        }
+      }
+
+    public:
+      DecodingPipeline(const std::vector<Slice>& slices,
+                       const std::vector<FrameRun>& runs,
+                       DecodedFrameCache* cache /* can be NULL */,
+                       IDicomFrameDecoder::IFactory& factory,
+                       unsigned int countThreads) :
+        slices_(slices),
+        runs_(runs),
+        cache_(cache),
+        windowSize_(2 * countThreads),
+        stopping_(false),
+        nextRunToDecode_(0),
+        nextRunToWrite_(0),
+        hasFailure_(false),
+        failureCode_(Orthanc::ErrorCode_Success)
+      {
+        if (countThreads == 0)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+        }
+
+        workers_.reserve(countThreads);
+
+        try
+        {
+          for (unsigned int i = 0; i < countThreads; i++)
+          {
+            std::unique_ptr<IDicomFrameDecoder> decoder(factory.CreateDecoder());
+            if (decoder.get() == NULL)
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+            }
+
+            workers_.push_back(new boost::thread(Worker, this, decoder.get()));
+            decoder.release();
+          }
+        }
+        catch (...)
+        {
+          Stop();
+          throw;
+        }
       }
 
-      writer.AddSlice(region);
+      ~DecodingPipeline()
+      {
+        Stop();
+      }
+
+      void Stop()
+      {
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          stopping_ = true;
+        }
+
+        windowMoved_.notify_all();
+
+        for (size_t i = 0; i < workers_.size(); i++)
+        {
+          assert(workers_[i] != NULL);
+
+          if (workers_[i]->joinable())
+          {
+            workers_[i]->join();
+          }
+
+          delete workers_[i];
+        }
+
+        workers_.clear();
+
+        for (ReorderBuffer::iterator it = reorderBuffer_.begin(); it != reorderBuffer_.end(); ++it)
+        {
+          assert(it->second != NULL);
+          delete it->second;
+        }
+
+        reorderBuffer_.clear();
+      }
+
+      // Waits for the next frame in the order of the slices
+      IDicomFrameDecoder::IDecodedFrame* Next(size_t run)
+      {
+        std::unique_ptr<IDicomFrameDecoder::IDecodedFrame> frame;
+
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+
+          if (run != nextRunToWrite_)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+          }
+
+          for (;;)
+          {
+            if (hasFailure_)
+            {
+              throw Orthanc::OrthancException(failureCode_, failureDetails_);
+            }
+
+            ReorderBuffer::iterator found = reorderBuffer_.find(run);
+            if (found != reorderBuffer_.end())
+            {
+              frame.reset(found->second);
+              reorderBuffer_.erase(found);
+              break;
+            }
+
+            frameDecoded_.wait(lock);
+          }
+
+          nextRunToWrite_ = run + 1;
+        }
+
+        windowMoved_.notify_all();
+        return frame.release();
+      }
+    };
+  }
+
+
+  void IDicomFrameDecoder::Apply(NiftiWriter& writer,
+                                 IDicomFrameDecoder& decoder,
+                                 const std::vector<Slice>& slices,
+                                 size_t frameCacheSize)
+  {
+    CheckSlices(slices);
+
+    std::vector<FrameRun> runs;
+    ComputeFrameRuns(runs, slices);
+
+    std::unique_ptr<DecodedFrameCache> cache(CreateFrameCache(slices, runs, frameCacheSize));
+
+    SliceWriter sliceWriter(writer);
+
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+      std::unique_ptr<IDecodedFrame> frame(DecodeFrameWithCache(decoder, cache.get(), slices[runs[i].firstSlice_]));
+
+      for (size_t j = runs[i].firstSlice_; j < runs[i].endSlice_; j++)
+      {
+        sliceWriter.Write(*frame, slices[j]);
+      }
+    }
+
+    LogFrameCache(cache.get());
+  }
+
+
+  void IDicomFrameDecoder::Apply(NiftiWriter& writer,
+                                 IFactory& factory,
+                                 const std::vector<Slice>& slices,
+                                 unsigned int countThreads,
+                                 size_t frameCacheSize)
+  {
+    CheckSlices(slices);
+
+    std::vector<FrameRun> runs;
+    ComputeFrameRuns(runs, slices);
+
+    std::unique_ptr<DecodedFrameCache> cache(CreateFrameCache(slices, runs, frameCacheSize));
+
+    SliceWriter sliceWriter(writer);
+
+    DecodingPipeline pipeline(slices, runs, cache.get(), factory, countThreads);
+
+    for (size_t i = 0; i < runs.size(); i++)
+    {
+      std::unique_ptr<IDecodedFrame> frame(pipeline.Next(i));
+      assert(frame.get() != NULL);
+
+      for (size_t j = runs[i].firstSlice_; j < runs[i].endSlice_; j++)
+      {
+        sliceWriter.Write(*frame, slices[j]);
+      }
+    }
+
+    LogFrameCache(cache.get());
+  }
+
+
+  void IDicomFrameDecoder::ApplyRandomAccess(NiftiWriter& writer,
+                                             IDicomFrameDecoder& decoder,
+                                             const std::vector<Slice>& slices)
+  {
+    CheckSlices(slices);
+
+    std::vector<FrameGroup> groups;
+    ComputeFrameGroups(groups, slices);
+
+    SliceWriter sliceWriter(writer);
+
+    for (size_t i = 0; i < groups.size(); i++)
+    {
+      WriteFrameGroup(sliceWriter, decoder, slices, groups[i]);
+    }
+  }
+
+
+  void IDicomFrameDecoder::ApplyRandomAccess(NiftiWriter& writer,
+                                             IFactory& factory,
+                                             const std::vector<Slice>& slices,
+                                             unsigned int countThreads)
+  {
+    if (countThreads == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
+
+    CheckSlices(slices);
+
+    std::vector<FrameGroup> groups;
+    ComputeFrameGroups(groups, slices);
+
+    SliceWriter sliceWriter(writer);
+
+    RandomAccessPool pool(sliceWriter, slices, groups);
+    pool.Run(factory, static_cast<unsigned int>(std::min(static_cast<size_t>(countThreads), pool.GetCountInstances())));
   }
 }
@@ -41,6 +41,21 @@ namespace Neuro
                              unsigned int y,
                              unsigned int width,
                              unsigned int height) = 0;
+
+      // Memory used by the decoded frame, for the accounting of caches
+      virtual size_t GetMemorySize() const = 0;
+    };
+    
+    // Creates one decoder per worker thread, as decoders are not
+    // required to be thread-safe
+    class IFactory : public boost::noncopyable
+    {
+    public:
+      virtual ~IFactory()
+      {
+      }
+
+      virtual IDicomFrameDecoder* CreateDecoder() = 0;
     };
     
     virtual ~IDicomFrameDecoder()
@@ -49,8 +64,40 @@ namespace Neuro
 
     virtual IDecodedFrame* DecodeFrame(const Slice& slice) = 0;
 
+    /**
+     * The slices are written in the order of the NIfTI volume. The
+     * frames that are used by non-consecutive slices are kept in a
+     * cache of at most "frameCacheSize" bytes, so as to avoid decoding
+     * them again. Setting "frameCacheSize" to zero disables the cache.
+     **/
     static void Apply(NiftiWriter& writer /* output */,
                       IDicomFrameDecoder& decoder,
-                      const std::vector<Slice>& slices);
+                      const std::vector<Slice>& slices,
+                      size_t frameCacheSize);
+
+    // The frames are decoded out of order by "countThreads" workers,
+    // but the slices are written in order
+    static void Apply(NiftiWriter& writer /* output */,
+                      IFactory& factory,
+                      const std::vector<Slice>& slices,
+                      unsigned int countThreads,
+                      size_t frameCacheSize);
+
+    /**
+     * The two methods below visit the frames in the order of their
+     * storage (i.e. by instance, then by frame number), which is not
+     * necessarily the order of the slices in the NIfTI volume (e.g.
+     * for 4D series). Each frame is decoded exactly once, and its
+     * slices are placed at their final location using
+     * "NiftiWriter::WriteSlice()". The writer must write in place.
+     **/
+    static void ApplyRandomAccess(NiftiWriter& writer /* output */,
+                                  IDicomFrameDecoder& decoder,
+                                  const std::vector<Slice>& slices);
+
+    static void ApplyRandomAccess(NiftiWriter& writer /* output */,
+                                  IFactory& factory,
+                                  const std::vector<Slice>& slices,
+                                  unsigned int countThreads);
   };
 }
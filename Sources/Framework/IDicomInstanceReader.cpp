@@ -0,0 +1,210 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "IDicomInstanceReader.h"
+
+#include <OrthancException.h>
+
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <cassert>
+
+
+namespace Neuro
+{
+  namespace
+  {
+    /**
+     * Pool of threads that read the instances of a collection. Each
+     * worker repeatedly takes the next instance to be read, and stores
+     * the result at the index of this instance, which makes the final
+     * order independent of the scheduling of the threads.
+     **/
+    class ReadingPool : public boost::noncopyable
+    {
+    private:
+      IDicomInstanceReader&             reader_;
+      const std::vector<std::string>&   orthancIds_;
+      std::vector<InputDicomInstance*>  instances_;
+
+      boost::mutex                      mutex_;
+      size_t                            nextInstance_;
+      bool                              hasFailure_;
+      Orthanc::ErrorCode                failureCode_;
+      std::string                       failureDetails_;
+
+      void SetFailure(Orthanc::ErrorCode code,
+                      const std::string& details)
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (!hasFailure_)
+        {
+          hasFailure_ = true;
+          failureCode_ = code;
+          failureDetails_ = details;
+        }
+      }
+
+      static void Worker(ReadingPool* that)
+      {
+        assert(that != NULL);
+
+        for (;;)
+        {
+          size_t index;
+
+          {
+            boost::mutex::scoped_lock lock(that->mutex_);
+
+            if (that->hasFailure_ ||
+                that->nextInstance_ >= that->orthancIds_.size())
+            {
+              return;
+            }
+
+            index = that->nextInstance_;
+            that->nextInstance_++;
+          }
+
+          try
+          {
+            std::unique_ptr<InputDicomInstance> instance(that->reader_.ReadInstance(that->orthancIds_[index]));
+            if (instance.get() == NULL)
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+            }
+
+            // Each slot is only written by the worker that took its index
+            assert(that->instances_[index] == NULL);
+            that->instances_[index] = instance.release();
+          }
+          catch (Orthanc::OrthancException& e)
+          {
+            that->SetFailure(e.GetErrorCode(), e.HasDetails() ? e.GetDetails() : "");
+            return;
+          }
+          catch (...)
+          {
+            that->SetFailure(Orthanc::ErrorCode_InternalError, "Native exception while reading a DICOM instance");
+            return;
+          }
+        }
+      }
+
+    public:
+      ReadingPool(IDicomInstanceReader& reader,
+                  const std::vector<std::string>& orthancIds) :
+        reader_(reader),
+        orthancIds_(orthancIds),
+        instances_(orthancIds.size(), NULL),
+        nextInstance_(0),
+        hasFailure_(false),
+        failureCode_(Orthanc::ErrorCode_Success)
+      {
+      }
+
+      ~ReadingPool()
+      {
+        for (size_t i = 0; i < instances_.size(); i++)
+        {
+          if (instances_[i] != NULL)
+          {
+            delete instances_[i];
+          }
+        }
+      }
+
+      void Run(unsigned int countThreads)
+      {
+        std::vector<boost::thread*> workers;
+        workers.reserve(countThreads);
+
+        try
+        {
+          for (unsigned int i = 0; i < countThreads; i++)
+          {
+            workers.push_back(new boost::thread(Worker, this));
+          }
+        }
+        catch (...)
+        {
+          SetFailure(Orthanc::ErrorCode_InternalError, "Cannot start the threads reading the DICOM instances");
+        }
+
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+          assert(workers[i] != NULL);
+
+          if (workers[i]->joinable())
+          {
+            workers[i]->join();
+          }
+
+          delete workers[i];
+        }
+
+        if (hasFailure_)
+        {
+          throw Orthanc::OrthancException(failureCode_, failureDetails_);
+        }
+      }
+
+      void Transfer(DicomInstancesCollection& target)
+      {
+        assert(instances_.size() == orthancIds_.size());
+
+        for (size_t i = 0; i < instances_.size(); i++)
+        {
+          // The instances that are not transferred yet are freed by the destructor
+          std::unique_ptr<InputDicomInstance> instance(instances_[i]);
+          instances_[i] = NULL;
+          target.AddInstance(instance.release(), orthancIds_[i]);
+        }
+      }
+    };
+  }
+
+
+  void IDicomInstanceReader::Apply(DicomInstancesCollection& target,
+                                   IDicomInstanceReader& reader,
+                                   const std::vector<std::string>& orthancIds,
+                                   unsigned int countThreads)
+  {
+    if (countThreads == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else if (countThreads == 1 ||
+             orthancIds.size() <= 1)
+    {
+      for (size_t i = 0; i < orthancIds.size(); i++)
+      {
+        std::unique_ptr<InputDicomInstance> instance(reader.ReadInstance(orthancIds[i]));
+        target.AddInstance(instance.release(), orthancIds[i]);
+      }
+    }
+    else
+    {
+      ReadingPool pool(reader, orthancIds);
+      pool.Run(static_cast<unsigned int>(std::min(static_cast<size_t>(countThreads), orthancIds.size())));
+      pool.Transfer(target);
+    }
+  }
+}
@@ -0,0 +1,45 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "DicomInstancesCollection.h"
+
+#include <vector>
+
+namespace Neuro
+{
+  class IDicomInstanceReader : public boost::noncopyable
+  {
+  public:
+    virtual ~IDicomInstanceReader()
+    {
+    }
+
+    // Must be thread-safe if used with more than one thread
+    virtual InputDicomInstance* ReadInstance(const std::string& orthancId) = 0;
+
+    // The instances are read by "countThreads" workers, but they are
+    // added to the collection in the order of "orthancIds"
+    static void Apply(DicomInstancesCollection& target /* output */,
+                      IDicomInstanceReader& reader,
+                      const std::vector<std::string>& orthancIds,
+                      unsigned int countThreads);
+  };
+}
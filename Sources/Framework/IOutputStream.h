@@ -0,0 +1,44 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <stddef.h>
+
+
+namespace Neuro
+{
+  /**
+   * Sequential sink for the bytes of a NIfTI file. This is the
+   * extension point that allows "NiftiWriter" to forward the header
+   * and the slices as soon as they are available, instead of
+   * accumulating the whole volume in memory.
+   **/
+  class IOutputStream : public boost::noncopyable
+  {
+  public:
+    virtual ~IOutputStream()
+    {
+    }
+
+    virtual void Write(const void* data,
+                       size_t size) = 0;
+  };
+}
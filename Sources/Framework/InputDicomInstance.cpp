@@ -826,25 +826,51 @@ namespace Neuro
   }
 
 
-  size_t InputDicomInstance::ComputeInstanceNiftiBodySize() const
+  void InputDicomInstance::ListRequiredTags(std::set<Orthanc::DicomTag>& target)
   {
-    Orthanc::PixelFormat format;
-    if (!GetImageInformation().ExtractPixelFormat(format, true))
-    {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-    }
-
-    size_t bytesPerPixel = Orthanc::GetBytesPerPixel(format);
-
-    std::list<Neuro::Slice> slices;
-    ExtractSlices(slices, 0 /* unused */);
-
-    unsigned int niftiBodySize = 0;
-    for (std::list<Neuro::Slice>::const_iterator it = slices.begin(); it != slices.end(); ++it)
-    {
-      niftiBodySize += bytesPerPixel * it->GetWidth() * it->GetHeight();
-    }
-
-    return niftiBodySize;
+    target.clear();
+
+    // Tags used by "Orthanc::DicomImageInformation"
+    target.insert(Orthanc::DICOM_TAG_BITS_ALLOCATED);
+    target.insert(Orthanc::DICOM_TAG_BITS_STORED);
+    target.insert(Orthanc::DICOM_TAG_COLUMNS);
+    target.insert(Orthanc::DICOM_TAG_HIGH_BIT);
+    target.insert(Orthanc::DICOM_TAG_NUMBER_OF_FRAMES);
+    target.insert(Orthanc::DICOM_TAG_PHOTOMETRIC_INTERPRETATION);
+    target.insert(Orthanc::DICOM_TAG_PIXEL_REPRESENTATION);
+    target.insert(Orthanc::DICOM_TAG_PLANAR_CONFIGURATION);
+    target.insert(Orthanc::DICOM_TAG_ROWS);
+    target.insert(Orthanc::DICOM_TAG_SAMPLES_PER_PIXEL);
+
+    // Tags used by "Setup()" and by the "Parse*()" methods
+    target.insert(Orthanc::DICOM_TAG_ACQUISITION_TIME);
+    target.insert(Orthanc::DICOM_TAG_IMAGE_ORIENTATION_PATIENT);
+    target.insert(Orthanc::DICOM_TAG_IMAGE_POSITION_PATIENT);
+    target.insert(Orthanc::DICOM_TAG_INSTANCE_NUMBER);
+    target.insert(Orthanc::DICOM_TAG_MANUFACTURER);
+    target.insert(Orthanc::DICOM_TAG_MODALITY);
+    target.insert(Orthanc::DICOM_TAG_PIXEL_SPACING);
+    target.insert(Orthanc::DICOM_TAG_RESCALE_INTERCEPT);
+    target.insert(Orthanc::DICOM_TAG_RESCALE_SLOPE);
+    target.insert(Orthanc::DICOM_TAG_SLICE_THICKNESS);
+    target.insert(DICOM_TAG_ECHO_TIME);
+    target.insert(DICOM_TAG_IN_PLANE_PHASE_ENCODING_DIRECTION);
+    target.insert(DICOM_TAG_RESCALE_INTERCEPT_PHILIPS);
+    target.insert(DICOM_TAG_RESCALE_SLOPE_PHILIPS);
+    target.insert(DICOM_TAG_SLICE_SLOPE_PHILIPS);
+    target.insert(DICOM_TAG_SLICE_TIMING_SIEMENS);
+    target.insert(DICOM_TAG_SPACING_BETWEEN_SLICES);
+
+    // Tags used while extracting the slices
+    target.insert(Orthanc::DICOM_TAG_GRID_FRAME_OFFSET_VECTOR);
+    target.insert(DICOM_TAG_REPETITION_TIME);
+
+    // Tags used by "DicomInstancesCollection::FormatSidecar()"
+    target.insert(Orthanc::DICOM_TAG_PROTOCOL_NAME);
+    target.insert(Orthanc::DICOM_TAG_SERIES_DESCRIPTION);
+    target.insert(Orthanc::DICOM_TAG_SERIES_NUMBER);
+    target.insert(DICOM_TAG_FLIP_ANGLE);
+    target.insert(DICOM_TAG_MAGNETIC_FIELD_STRENGTH);
+    target.insert(DICOM_TAG_MANUFACTURER_MODEL_NAME);
   }
 }
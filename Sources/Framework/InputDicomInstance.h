@@ -215,6 +215,12 @@ namespace Neuro
     
     unsigned int GetMultiBandFactor() const;
     
+    // Times (in milliseconds) from the Siemens "MosaicRefAcqTimes" tag, or empty
+    const std::vector<double>& GetSliceTimingSiemens() const
+    {
+      return sliceTimingSiemens_;
+    }
+
     int DetectSiemensSliceCode() const;
 
     bool LookupRepetitionTime(double& value) const;
@@ -222,6 +228,11 @@ namespace Neuro
     void ExtractSlices(std::list<Slice>& slices,
                        size_t instanceIndexInCollection) const;
 
-    size_t ComputeInstanceNiftiBodySize() const;
+    /**
+     * List the DICOM tags that are read from the main dataset by this
+     * class. The other tags can be safely discarded before calling
+     * the constructor, which avoids handling the full DICOM dataset.
+     **/
+    static void ListRequiredTags(std::set<Orthanc::DicomTag>& target);
   };
 }
@@ -0,0 +1,46 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "MappedFile.h"
+
+#include <OrthancException.h>
+
+
+namespace Neuro
+{
+  MappedFile::MappedFile(const std::string& path)
+  {
+    try
+    {
+      mapping_.reset(new boost::interprocess::file_mapping(path.c_str(), boost::interprocess::read_only));
+      region_.reset(new boost::interprocess::mapped_region(*mapping_, boost::interprocess::read_only));
+    }
+    catch (boost::interprocess::interprocess_exception& e)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile,
+                                      "Cannot map file into memory: " + path + " (" + std::string(e.what()) + ")");
+    }
+
+    if (region_->get_address() == NULL ||
+        region_->get_size() == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Cannot map an empty file into memory: " + path);
+    }
+  }
+}
@@ -0,0 +1,56 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/noncopyable.hpp>
+#include <memory>
+#include <string>
+
+
+namespace Neuro
+{
+  /**
+   * Existing file that is mapped read-only into memory, which avoids
+   * loading its full content in the RAM before sending it. On POSIX
+   * systems, the mapping remains valid even if the file is removed or
+   * replaced by another thread.
+   **/
+  class MappedFile : public boost::noncopyable
+  {
+  private:
+    std::unique_ptr<boost::interprocess::file_mapping>    mapping_;
+    std::unique_ptr<boost::interprocess::mapped_region>   region_;
+
+  public:
+    explicit MappedFile(const std::string& path);
+
+    const void* GetData() const
+    {
+      return region_->get_address();
+    }
+
+    size_t GetSize() const
+    {
+      return region_->get_size();
+    }
+  };
+}
@@ -0,0 +1,74 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "MappedTemporaryFile.h"
+
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+
+#include <boost/filesystem.hpp>
+
+
+namespace Neuro
+{
+  MappedTemporaryFile::MappedTemporaryFile(const std::string& directory,
+                                           size_t size)
+  {
+    if (size == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Cannot map an empty file into memory");
+    }
+
+    if (directory.empty())
+    {
+      file_.reset(new Orthanc::TemporaryFile);
+    }
+    else
+    {
+      file_.reset(new Orthanc::TemporaryFile(directory, ".nii"));
+    }
+
+    try
+    {
+      // Create the file with its final size, which is sparse on most filesystems
+      Orthanc::SystemToolbox::WriteFile(NULL, 0, file_->GetPath());
+      boost::filesystem::resize_file(file_->GetPath(), size);
+
+      mapping_.reset(new boost::interprocess::file_mapping(file_->GetPath().c_str(), boost::interprocess::read_write));
+      region_.reset(new boost::interprocess::mapped_region(*mapping_, boost::interprocess::read_write, 0, size));
+    }
+    catch (boost::filesystem::filesystem_error& e)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                      "Cannot create temporary file: " + std::string(e.what()));
+    }
+    catch (boost::interprocess::interprocess_exception& e)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory,
+                                      "Cannot map temporary file into memory: " + std::string(e.what()));
+    }
+
+    if (region_->get_address() == NULL ||
+        region_->get_size() != size)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+}
@@ -0,0 +1,66 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <TemporaryFile.h>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/noncopyable.hpp>
+#include <memory>
+
+
+namespace Neuro
+{
+  /**
+   * Temporary file of a fixed size that is mapped into memory. The
+   * pages of the file are backed by the filesystem instead of by the
+   * RAM, which allows to handle volumes that are larger than the
+   * available memory. The file is removed by the destructor.
+   **/
+  class MappedTemporaryFile : public boost::noncopyable
+  {
+  private:
+    // The order of the members matters: The region must be unmapped before removing the file
+    std::unique_ptr<Orthanc::TemporaryFile>                file_;
+    std::unique_ptr<boost::interprocess::file_mapping>    mapping_;
+    std::unique_ptr<boost::interprocess::mapped_region>   region_;
+
+  public:
+    // If "directory" is empty, the default temporary directory of the system is used
+    MappedTemporaryFile(const std::string& directory,
+                        size_t size);
+
+    void* GetData()
+    {
+      return region_->get_address();
+    }
+
+    const void* GetData() const
+    {
+      return region_->get_address();
+    }
+
+    size_t GetSize() const
+    {
+      return region_->get_size();
+    }
+  };
+}
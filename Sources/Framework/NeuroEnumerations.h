@@ -50,4 +50,29 @@ namespace Neuro
     Manufacturer_UIH,
     Manufacturer_Bruker
   };
+
+  enum InstructionSet
+  {
+    InstructionSet_Scalar,
+    InstructionSet_SSE2,
+    InstructionSet_AVX2
+  };
+
+  // Outcome of the parsing of the "Range" header of a HTTP request
+  enum HttpRange
+  {
+    HttpRange_Ignored,        // No range, or a range that is not supported (e.g. multiple ranges)
+    HttpRange_Satisfiable,
+    HttpRange_Unsatisfiable   // Must be answered with "416 Range Not Satisfiable"
+  };
+
+  // Folders of the BIDS datasets, depending on the type of data
+  enum BidsDatatype
+  {
+    BidsDatatype_Unknown,
+    BidsDatatype_Anatomical,   // "anat"
+    BidsDatatype_Functional,   // "func"
+    BidsDatatype_Diffusion,    // "dwi"
+    BidsDatatype_PET           // "pet"
+  };
 }
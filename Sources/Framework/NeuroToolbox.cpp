@@ -23,7 +23,9 @@
 #include <SerializationToolbox.h>
 #include <Toolbox.h>
 
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/lexical_cast.hpp>
+#include <limits>
 
 
 namespace Neuro
@@ -112,4 +114,235 @@ namespace Neuro
       target[2] = u[0] * v[1] - u[1] * v[0];
     }
   }
+
+
+  bool NeuroToolbox::DecodeBinaryDicomAsJson(std::string& target,
+                                             const Json::Value& value)
+  {
+    static const char* const PREFIX = "data:application/octet-stream;base64,";
+
+    std::string mime, content;
+    if (value.type() == Json::stringValue &&
+        boost::algorithm::starts_with(value.asString(), PREFIX) &&
+        Orthanc::Toolbox::DecodeDataUriScheme(mime, content, value.asString()))
+    {
+      Orthanc::Toolbox::DecodeBase64(target, content);
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  static void ParseShortDicomAsJsonInternal(Orthanc::DicomMap& target,
+                                            const Json::Value& source,
+                                            const std::set<Orthanc::DicomTag>* tags /* can be NULL */)
+  {
+    if (source.type() != Json::objectValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+    }
+
+    target.Clear();
+
+    const Json::Value::Members members = source.getMemberNames();
+
+    for (size_t i = 0; i < members.size(); i++)
+    {
+      Orthanc::DicomTag tag(0, 0);
+      if (Orthanc::DicomTag::ParseHexadecimal(tag, members[i].c_str()) &&
+          (tags == NULL || tags->find(tag) != tags->end()))
+      {
+        const Json::Value& value = source[members[i]];
+
+        std::string binary;
+        if (NeuroToolbox::DecodeBinaryDicomAsJson(binary, value))
+        {
+          target.SetValue(tag, binary, true);
+        }
+        else if (value.type() == Json::stringValue)
+        {
+          target.SetValue(tag, value.asString(), false);
+        }
+      }
+    }
+  }
+
+
+  void NeuroToolbox::ParseShortDicomAsJson(Orthanc::DicomMap& target,
+                                           const Json::Value& source,
+                                           const std::set<Orthanc::DicomTag>& tags)
+  {
+    ParseShortDicomAsJsonInternal(target, source, &tags);
+  }
+
+
+  void NeuroToolbox::ParseShortDicomAsJson(Orthanc::DicomMap& target,
+                                           const Json::Value& source)
+  {
+    ParseShortDicomAsJsonInternal(target, source, NULL);
+  }
+
+
+  // Parses a non-negative integer in decimal notation
+  static bool ParseUnsignedInteger(uint64_t& target,
+                                   const std::string& value)
+  {
+    // At most 19 digits, which always fits in 64 bits
+    if (value.empty() ||
+        value.size() > 19)
+    {
+      return false;
+    }
+
+    for (size_t i = 0; i < value.size(); i++)
+    {
+      if (value[i] < '0' ||
+          value[i] > '9')
+      {
+        return false;
+      }
+    }
+
+    target = boost::lexical_cast<uint64_t>(value);
+    return true;
+  }
+
+
+  void NeuroToolbox::ParseIndexRange(size_t& start,
+                                     size_t& end,
+                                     const std::string& value)
+  {
+    const std::string stripped = Orthanc::Toolbox::StripSpaces(value);
+    const size_t dash = stripped.find('-');
+
+    uint64_t first, last;
+
+    if (dash == std::string::npos)
+    {
+      if (!ParseUnsignedInteger(first, stripped))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Bad index: " + value);
+      }
+
+      last = first;
+    }
+    else if (!ParseUnsignedInteger(first, Orthanc::Toolbox::StripSpaces(stripped.substr(0, dash))) ||
+             !ParseUnsignedInteger(last, Orthanc::Toolbox::StripSpaces(stripped.substr(dash + 1))) ||
+             last < first)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Bad range of indices: " + value);
+    }
+
+    if (last >= static_cast<uint64_t>(std::numeric_limits<size_t>::max()))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Index is too large: " + value);
+    }
+
+    start = static_cast<size_t>(first);
+    end = static_cast<size_t>(last) + 1;
+  }
+
+
+  HttpRange NeuroToolbox::ParseHttpRange(uint64_t& start,
+                                         uint64_t& end,
+                                         const std::string& range,
+                                         uint64_t size)
+  {
+    static const char* const PREFIX = "bytes=";
+
+    const std::string value = Orthanc::Toolbox::StripSpaces(range);
+
+    if (!boost::algorithm::starts_with(value, PREFIX) ||
+        value.find(',') != std::string::npos)
+    {
+      return HttpRange_Ignored;  // Unknown unit, or multiple ranges
+    }
+
+    const std::string spec = Orthanc::Toolbox::StripSpaces(value.substr(std::string(PREFIX).size()));
+
+    const size_t dash = spec.find('-');
+    if (dash == std::string::npos)
+    {
+      return HttpRange_Ignored;
+    }
+
+    const std::string first = Orthanc::Toolbox::StripSpaces(spec.substr(0, dash));
+    const std::string last = Orthanc::Toolbox::StripSpaces(spec.substr(dash + 1));
+
+    uint64_t a, b;
+
+    if (first.empty())
+    {
+      // Suffix range ("bytes=-500"), to get the last bytes of the resource
+      if (!ParseUnsignedInteger(b, last))
+      {
+        return HttpRange_Ignored;
+      }
+      else if (b == 0 ||
+               size == 0)
+      {
+        return HttpRange_Unsatisfiable;
+      }
+      else
+      {
+        start = (b < size ? size - b : 0);
+        end = size;
+        return HttpRange_Satisfiable;
+      }
+    }
+    else if (!ParseUnsignedInteger(a, first))
+    {
+      return HttpRange_Ignored;
+    }
+    else if (last.empty())
+    {
+      // Open range ("bytes=500-"), up to the end of the resource
+      b = size;
+    }
+    else if (!ParseUnsignedInteger(b, last) ||
+             b < a)
+    {
+      return HttpRange_Ignored;  // Syntactically invalid ranges must be ignored
+    }
+    else
+    {
+      b = (b < size ? b + 1 : size);  // The last byte position is inclusive
+    }
+
+    if (a >= size)
+    {
+      return HttpRange_Unsatisfiable;
+    }
+    else
+    {
+      start = a;
+      end = b;
+      return HttpRange_Satisfiable;
+    }
+  }
+
+
+  bool NeuroToolbox::IsPartialContentSupported(const Json::Value& configuration)
+  {
+    static const char* const HTTP_DESCRIBE_ERRORS = "HttpDescribeErrors";
+
+    if (configuration.type() != Json::objectValue ||
+        !configuration.isMember(HTTP_DESCRIBE_ERRORS))
+    {
+      return true;  // Default value in the Orthanc core
+    }
+    else if (configuration[HTTP_DESCRIBE_ERRORS].type() == Json::booleanValue)
+    {
+      return configuration[HTTP_DESCRIBE_ERRORS].asBool();
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadParameterType,
+                                      "The configuration option \"" + std::string(HTTP_DESCRIBE_ERRORS) +
+                                      "\" must be a Boolean");
+    }
+  }
 }
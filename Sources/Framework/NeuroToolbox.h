@@ -19,14 +19,24 @@
 
 #pragma once
 
+#include "NeuroEnumerations.h"
+
 #include <DicomFormat/DicomMap.h>
 
+#include <json/value.h>
+#include <set>
+
 
 namespace Neuro
 {
   static const Orthanc::DicomTag DICOM_TAG_SIEMENS_CSA_HEADER(0x0029, 0x1010);
   static const Orthanc::DicomTag DICOM_TAG_UIH_MR_VFRAME_SEQUENCE(0x0065, 0x1051); // https://github.com/rordenlab/dcm2niix/issues/225
 
+  // Tags that are only reported in the JSON sidecars
+  static const Orthanc::DicomTag DICOM_TAG_FLIP_ANGLE(0x0018, 0x1314);
+  static const Orthanc::DicomTag DICOM_TAG_MAGNETIC_FIELD_STRENGTH(0x0018, 0x0087);
+  static const Orthanc::DicomTag DICOM_TAG_MANUFACTURER_MODEL_NAME(0x0008, 0x1090);
+
   class NeuroToolbox
   {
   private:
@@ -51,5 +61,57 @@ namespace Neuro
     static void CrossProduct(std::vector<double>& target,
                              const std::vector<double>& u,
                              const std::vector<double>& v);
+
+    /**
+     * Fill "target" with the values of "tags" that are stored in
+     * "source", which must be formatted using the "Short" format of
+     * Orthanc (i.e. mapping "gggg,eeee" to a string). Null values
+     * and sequences are ignored. Binary values are stored as such.
+     **/
+    static void ParseShortDicomAsJson(Orthanc::DicomMap& target,
+                                      const Json::Value& source,
+                                      const std::set<Orthanc::DicomTag>& tags);
+
+    // Same as above, but keeps all the tags
+    static void ParseShortDicomAsJson(Orthanc::DicomMap& target,
+                                      const Json::Value& source);
+
+    /**
+     * Decode a binary value that is encoded using the data URI scheme,
+     * which is the case if "OrthancPluginDicomToJsonFlags_IncludeBinary"
+     * is provided. Returns "false" if "value" is not such a binary value.
+     **/
+    static bool DecodeBinaryDicomAsJson(std::string& target,
+                                        const Json::Value& value);
+
+    /**
+     * Parse a range of indices that is either formatted as "first" or
+     * as "first-last" (both being included). On exit, "end" is
+     * excluded. An exception is thrown if the syntax is invalid.
+     **/
+    static void ParseIndexRange(size_t& start,
+                                size_t& end,
+                                const std::string& value);
+
+    /**
+     * Parse the value of the "Range" header of a HTTP request, as
+     * specified in RFC 7233, for a resource of "size" bytes. Only
+     * single byte ranges are supported. If the range is satisfiable,
+     * "start" and "end" are set to the bounds of the requested bytes
+     * ("end" is excluded).
+     **/
+    static HttpRange ParseHttpRange(uint64_t& start,
+                                    uint64_t& end,
+                                    const std::string& range,
+                                    uint64_t size);
+
+    /**
+     * A plugin can only send a "206 Partial Content" answer through
+     * "OrthancPluginSendHttpStatus()", whose body is dropped by the
+     * Orthanc core if its "HttpDescribeErrors" option is disabled.
+     * Returns whether byte ranges can be answered, given the global
+     * "configuration" of Orthanc. If not, the full file must be sent.
+     **/
+    static bool IsPartialContentSupported(const Json::Value& configuration);
   };
 }
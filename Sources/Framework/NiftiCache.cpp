@@ -0,0 +1,327 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "NiftiCache.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <SystemToolbox.h>
+#include <Toolbox.h>
+
+#include <algorithm>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cassert>
+
+
+namespace Neuro
+{
+  static const char* const EXTENSION_UNCOMPRESSED = ".nii";
+  static const char* const EXTENSION_COMPRESSED = ".nii.gz";
+  static const char* const EXTENSION_TEMPORARY = ".tmp";
+
+  
+  std::string NiftiCache::GetPath(const std::string& key) const
+  {
+    boost::filesystem::path p(directory_);
+    p /= key;
+    return p.string();
+  }
+
+
+  void NiftiCache::AddEntry(const std::string& key,
+                            const std::string& seriesId,
+                            uint64_t size)
+  {
+    // The mutex must be locked
+    
+    assert(entries_.find(key) == entries_.end());
+
+    recency_.push_front(key);
+
+    Entry entry;
+    entry.seriesId_ = seriesId;
+    entry.size_ = size;
+    entry.recency_ = recency_.begin();
+    entries_[key] = entry;
+
+    currentSize_ += size;
+  }
+
+
+  void NiftiCache::RemoveEntry(Entries::iterator entry)
+  {
+    // The mutex must be locked
+    
+    assert(entry != entries_.end());
+    assert(currentSize_ >= entry->second.size_);
+
+    boost::system::error_code error;
+    boost::filesystem::remove(GetPath(entry->first), error);
+
+    currentSize_ -= entry->second.size_;
+    recency_.erase(entry->second.recency_);
+    entries_.erase(entry);
+  }
+
+
+  void NiftiCache::LoadDirectory()
+  {
+    // Index the files that were generated before a restart of Orthanc,
+    // ordered by their last modification time
+    typedef std::pair<std::time_t, std::string>  TimestampedFile;
+    std::vector<TimestampedFile> files;
+
+    boost::filesystem::directory_iterator end;
+    for (boost::filesystem::directory_iterator it(directory_); it != end; ++it)
+    {
+      if (boost::filesystem::is_regular_file(it->status()))
+      {
+        const std::string filename = it->path().filename().string();
+
+        if (boost::algorithm::ends_with(filename, EXTENSION_TEMPORARY))
+        {
+          // Leftover of an interrupted write
+          boost::system::error_code error;
+          boost::filesystem::remove(it->path(), error);
+        }
+        else if ((boost::algorithm::ends_with(filename, EXTENSION_UNCOMPRESSED) ||
+                  boost::algorithm::ends_with(filename, EXTENSION_COMPRESSED)) &&
+                 filename.find('_') != std::string::npos)
+        {
+          files.push_back(std::make_pair(boost::filesystem::last_write_time(it->path()), filename));
+        }
+      }
+    }
+
+    std::sort(files.begin(), files.end());
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+      const std::string& filename = files[i].second;
+      const std::string seriesId = filename.substr(0, filename.find('_'));
+      AddEntry(filename, seriesId, boost::filesystem::file_size(GetPath(filename)));
+    }
+  }
+
+
+  NiftiCache::NiftiCache(const std::string& directory,
+                         uint64_t maximumSize,
+                         uint8_t compressionLevel) :
+    directory_(directory),
+    maximumSize_(maximumSize),
+    compressionLevel_(compressionLevel),
+    currentSize_(0)
+  {
+    if (maximumSize == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    Orthanc::SystemToolbox::MakeDirectory(directory);
+
+    LoadDirectory();
+
+    // Apply the size budget, in the case it was reduced since the last execution
+    while (currentSize_ > maximumSize_)
+    {
+      assert(!recency_.empty());
+      RemoveEntry(entries_.find(recency_.back()));
+    }
+
+    LOG(WARNING) << "Cache of NIfTI files in directory \"" << directory << "\" contains "
+                 << entries_.size() << " file(s), for a total of "
+                 << (currentSize_ / (1024llu * 1024llu)) << "MB";
+  }
+
+
+  void NiftiCache::ComputeFingerprint(std::string& fingerprint,
+                                      const std::vector<std::string>& instancesIds)
+  {
+    std::vector<std::string> sorted = instancesIds;
+    std::sort(sorted.begin(), sorted.end());
+
+    std::string s;
+    for (size_t i = 0; i < sorted.size(); i++)
+    {
+      s += sorted[i] + "|";
+    }
+
+    Orthanc::Toolbox::ComputeSHA1(fingerprint, s);
+  }
+
+
+  std::string NiftiCache::GetKey(const std::string& seriesId,
+                                 const std::string& fingerprint,
+                                 bool compress,
+                                 uint8_t compressionLevel)
+  {
+    if (seriesId.empty() ||
+        seriesId.find('_') != std::string::npos ||
+        seriesId.find('/') != std::string::npos ||
+        seriesId.find('\\') != std::string::npos ||
+        seriesId.find('.') != std::string::npos)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Bad series identifier: " + seriesId);
+    }
+    else if (compress)
+    {
+      return (seriesId + "_" + fingerprint + "-" +
+              boost::lexical_cast<std::string>(static_cast<int>(compressionLevel)) + EXTENSION_COMPRESSED);
+    }
+    else
+    {
+      return seriesId + "_" + fingerprint + EXTENSION_UNCOMPRESSED;
+    }
+  }
+
+
+  bool NiftiCache::Contains(const std::string& seriesId,
+                            const std::string& fingerprint,
+                            bool compress)
+  {
+    const std::string key = GetKey(seriesId, fingerprint, compress, compressionLevel_);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    return (entries_.find(key) != entries_.end());
+  }
+
+
+  bool NiftiCache::Lookup(std::unique_ptr<MappedFile>& content,
+                          const std::string& seriesId,
+                          const std::string& fingerprint,
+                          bool compress)
+  {
+    const std::string key = GetKey(seriesId, fingerprint, compress, compressionLevel_);
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      Entries::iterator found = entries_.find(key);
+      if (found == entries_.end())
+      {
+        return false;
+      }
+
+      // Make the entry the most recently used
+      recency_.splice(recency_.begin(), recency_, found->second.recency_);
+    }
+
+    // The file is mapped outside of the mutex. It might have been
+    // removed by a concurrent thread in the meantime, which is a cache
+    // miss. Once mapped, the content stays valid even if the file is
+    // evicted while it is being sent.
+    try
+    {
+      content.reset(new MappedFile(GetPath(key)));
+      return true;
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      return false;
+    }
+  }
+
+
+  void NiftiCache::Store(const std::string& seriesId,
+                         const std::string& fingerprint,
+                         bool compress,
+                         const void* content,
+                         size_t size)
+  {
+    if (size > maximumSize_)
+    {
+      return;  // Too large to be cached
+    }
+
+    const std::string key = GetKey(seriesId, fingerprint, compress, compressionLevel_);
+    const std::string path = GetPath(key);
+
+    // Write to a temporary file, then rename it, so that concurrent
+    // readers never see a partially written file
+    const std::string temporary = path + "-" + Orthanc::Toolbox::GenerateUuid() + EXTENSION_TEMPORARY;
+    Orthanc::SystemToolbox::WriteFile(content, size, temporary);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    boost::system::error_code error;
+    boost::filesystem::rename(temporary, path, error);
+
+    if (error)
+    {
+      LOG(ERROR) << "Cannot store NIfTI file in the cache: " << path;
+      boost::filesystem::remove(temporary, error);
+      return;
+    }
+
+    // The file of the previous version of this entry (if any) was
+    // replaced by the rename, so only the index must be updated
+    Entries::iterator found = entries_.find(key);
+    if (found != entries_.end())
+    {
+      assert(currentSize_ >= found->second.size_);
+      currentSize_ -= found->second.size_;
+      recency_.erase(found->second.recency_);
+      entries_.erase(found);
+    }
+
+    AddEntry(key, seriesId, size);
+
+    while (currentSize_ > maximumSize_)
+    {
+      assert(!recency_.empty());
+      RemoveEntry(entries_.find(recency_.back()));
+    }
+  }
+
+
+  void NiftiCache::InvalidateSeries(const std::string& seriesId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    std::vector<Entries::iterator> toRemove;
+    for (Entries::iterator it = entries_.begin(); it != entries_.end(); ++it)
+    {
+      if (it->second.seriesId_ == seriesId)
+      {
+        toRemove.push_back(it);
+      }
+    }
+
+    for (size_t i = 0; i < toRemove.size(); i++)
+    {
+      RemoveEntry(toRemove[i]);
+    }
+  }
+
+
+  uint64_t NiftiCache::GetCurrentSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return currentSize_;
+  }
+
+
+  size_t NiftiCache::GetCountEntries()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return entries_.size();
+  }
+}
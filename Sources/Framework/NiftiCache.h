@@ -0,0 +1,119 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "MappedFile.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <list>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+namespace Neuro
+{
+  /**
+   * Persistent cache of the generated NIfTI files, stored as regular
+   * files in some directory. The entries are indexed by the Orthanc
+   * ID of the series, together with a fingerprint of its instances,
+   * with the compression flag and with the compression level (so that
+   * changing the level invalidates the previously compressed files).
+   * The least recently used entries
+   * are removed once the total size exceeds the size budget.
+   **/
+  class NiftiCache : public boost::noncopyable
+  {
+  private:
+    struct Entry
+    {
+      std::string                       seriesId_;
+      uint64_t                          size_;
+      std::list<std::string>::iterator  recency_;
+    };
+
+    typedef std::map<std::string, Entry>  Entries;
+
+    boost::mutex            mutex_;
+    std::string             directory_;
+    uint64_t                maximumSize_;
+    uint8_t                 compressionLevel_;
+    uint64_t                currentSize_;
+    Entries                 entries_;
+    std::list<std::string>  recency_;  // Most recently used entries at the front
+
+    std::string GetPath(const std::string& key) const;
+
+    void AddEntry(const std::string& key,
+                  const std::string& seriesId,
+                  uint64_t size);
+
+    void RemoveEntry(Entries::iterator entry);
+
+    void LoadDirectory();
+
+  public:
+    NiftiCache(const std::string& directory,
+               uint64_t maximumSize /* in bytes */,
+               uint8_t compressionLevel);
+
+    static void ComputeFingerprint(std::string& fingerprint,
+                                   const std::vector<std::string>& instancesIds);
+
+    static std::string GetKey(const std::string& seriesId,
+                              const std::string& fingerprint,
+                              bool compress,
+                              uint8_t compressionLevel);
+
+    // Same as "Lookup()", without mapping the file nor updating the recency
+    bool Contains(const std::string& seriesId,
+                  const std::string& fingerprint,
+                  bool compress);
+
+    // On a hit, the cached file is mapped read-only into memory
+    // instead of being read, and "content" is set to this mapping
+    bool Lookup(std::unique_ptr<MappedFile>& content,
+                const std::string& seriesId,
+                const std::string& fingerprint,
+                bool compress);
+
+    void Store(const std::string& seriesId,
+               const std::string& fingerprint,
+               bool compress,
+               const void* content,
+               size_t size);
+
+    void Store(const std::string& seriesId,
+               const std::string& fingerprint,
+               bool compress,
+               const std::string& content)
+    {
+      Store(seriesId, fingerprint, compress, content.empty() ? NULL : content.c_str(), content.size());
+    }
+
+    void InvalidateSeries(const std::string& seriesId);
+
+    uint64_t GetCurrentSize();
+
+    size_t GetCountEntries();
+  };
+}
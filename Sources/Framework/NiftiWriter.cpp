@@ -19,83 +19,334 @@
 
 #include "NiftiWriter.h"
 
+#include "PixelKernels.h"
+
 #include <Compression/GzipCompressor.h>
-#include <Images/Image.h>
 #include <OrthancException.h>
 
+#include <algorithm>
 #include <cassert>
 
 
 namespace Neuro
 {
-  void NiftiWriter::WriteHeader(const nifti_image& header)
+  static const size_t NIFTI_HEADER_SIZE = 348 + 4;  // Header, followed by an empty extension
+
+
+  static bool IsSameFormat(int datatype,
+                           Orthanc::PixelFormat format)
   {
-    if (hasHeader_)
+    switch (datatype)
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      case NIFTI_TYPE_UINT8:
+        return format == Orthanc::PixelFormat_Grayscale8;
+
+      case NIFTI_TYPE_UINT16:
+        return format == Orthanc::PixelFormat_Grayscale16;
+
+      case NIFTI_TYPE_INT16:
+        return format == Orthanc::PixelFormat_SignedGrayscale16;
+
+      case NIFTI_TYPE_UINT32:
+        return format == Orthanc::PixelFormat_Grayscale32;
+
+      case NIFTI_TYPE_FLOAT32:
+        return format == Orthanc::PixelFormat_Float32;
+
+      case NIFTI_TYPE_RGB24:
+        return format == Orthanc::PixelFormat_RGB24;
+
+      default:
+        return false;
+    }
+  }
+
+
+  // Converts one row of a DICOM slice to the datatype of the NIfTI file
+  static void ConvertRow(void* target,
+                         int datatype,
+                         const void* source,
+                         Orthanc::PixelFormat format,
+                         unsigned int width,
+                         float rescaleSlope,
+                         float rescaleIntercept)
+  {
+    if ((datatype == NIFTI_TYPE_UINT16 ||
+         datatype == NIFTI_TYPE_INT16) &&
+        format == Orthanc::PixelFormat_Grayscale8)
+    {
+      // The 8-bit unsigned values fit in both signed and unsigned 16-bit integers
+      PixelKernels::WidenUInt8ToUInt16(reinterpret_cast<uint16_t*>(target),
+                                       reinterpret_cast<const uint8_t*>(source), width);
+    }
+    else if (datatype == NIFTI_TYPE_INT32 &&
+             format == Orthanc::PixelFormat_Grayscale16)
+    {
+      PixelKernels::WidenUInt16ToInt32(reinterpret_cast<int32_t*>(target),
+                                       reinterpret_cast<const uint16_t*>(source), width);
+    }
+    else if (datatype == NIFTI_TYPE_INT32 &&
+             format == Orthanc::PixelFormat_SignedGrayscale16)
+    {
+      PixelKernels::WidenInt16ToInt32(reinterpret_cast<int32_t*>(target),
+                                      reinterpret_cast<const int16_t*>(source), width);
+    }
+    else if (datatype == NIFTI_TYPE_FLOAT32 &&
+             format == Orthanc::PixelFormat_Grayscale16)
+    {
+      PixelKernels::RescaleUInt16ToFloat32(reinterpret_cast<float*>(target),
+                                           reinterpret_cast<const uint16_t*>(source), width,
+                                           rescaleSlope, rescaleIntercept);
+    }
+    else if (datatype == NIFTI_TYPE_FLOAT32 &&
+             format == Orthanc::PixelFormat_SignedGrayscale16)
+    {
+      PixelKernels::RescaleInt16ToFloat32(reinterpret_cast<float*>(target),
+                                          reinterpret_cast<const int16_t*>(source), width,
+                                          rescaleSlope, rescaleIntercept);
+    }
+    else if (datatype == NIFTI_TYPE_FLOAT32 &&
+             format == Orthanc::PixelFormat_Grayscale32)
+    {
+      PixelKernels::RescaleUInt32ToFloat32(reinterpret_cast<float*>(target),
+                                           reinterpret_cast<const uint32_t*>(source), width,
+                                           rescaleSlope, rescaleIntercept);
     }
     else
     {
-      nifti_image fixed;
-      memcpy(&fixed, &header, sizeof(nifti_image));
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                      "Cannot convert pixel format " + std::string(Orthanc::EnumerationToString(format)) +
+                                      " to NIfTI datatype " + std::string(nifti_datatype_string(datatype)));
+    }
+  }
 
-      std::string empty(1, '\0');
-      fixed.fname = &empty[0];
-      fixed.iname = NULL;
-      fixed.num_ext = 0;  // no extension
-    
-      nifti_set_iname_offset(&fixed);
 
-      if (fixed.nifti_type != NIFTI_FTYPE_NIFTI1_1)
+  size_t NiftiWriter::GetSliceSize(const Orthanc::ImageAccessor& slice) const
+  {
+    // No pitch is allowed in NIfTI
+    return bytesPerVoxel_ * static_cast<size_t>(slice.GetWidth()) * static_cast<size_t>(slice.GetHeight());
+  }
+
+
+  void NiftiWriter::CopyFlippedRows(uint8_t* target,
+                                    const Orthanc::ImageAccessor& slice,
+                                    double rescaleSlope,
+                                    double rescaleIntercept) const
+  {
+    // The rows are written in reverse order, as the Y axis is flipped between DICOM and NIfTI
+    const size_t rowSize = bytesPerVoxel_ * slice.GetWidth();
+
+    if (IsSameFormat(datatype_, slice.GetFormat()))
+    {
+      assert(rowSize <= slice.GetPitch());
+
+      for (unsigned int y = slice.GetHeight(); y > 0; y--, target += rowSize)
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+        memcpy(target, slice.GetConstRow(y - 1), rowSize);
       }
+    }
+    else
+    {
+      for (unsigned int y = slice.GetHeight(); y > 0; y--, target += rowSize)
+      {
+        ConvertRow(target, datatype_, slice.GetConstRow(y - 1), slice.GetFormat(), slice.GetWidth(),
+                   static_cast<float>(rescaleSlope), static_cast<float>(rescaleIntercept));
+      }
+    }
+  }
+
+
+  void NiftiWriter::Write(const void* data,
+                          size_t size)
+  {
+    if (target_ != NULL)
+    {
+      if (position_ + size > targetSize_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "The NIfTI file doesn't fit in the preallocated memory area");
+      }
+
+      memcpy(target_ + position_, data, size);
+    }
+    else if (output_ != NULL)
+    {
+      output_->Write(data, size);
+    }
+    else
+    {
+      buffer_.AddChunk(data, size);
+    }
+
+    position_ += size;
+  }
+
+
+  NiftiWriter::NiftiWriter(void* target,
+                           size_t targetSize) :
+    hasHeader_(false),
+    datatype_(0),
+    bytesPerVoxel_(0),
+    output_(NULL),
+    target_(reinterpret_cast<uint8_t*>(target)),
+    targetSize_(targetSize),
+    position_(0),
+    randomAccess_(false),
+    listener_(NULL)
+  {
+    if (target == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+  }
+
+
+  void NiftiWriter::SerializeHeader(nifti_1_header& target,
+                                    const nifti_image& header)
+  {
+    nifti_image fixed;
+    memcpy(&fixed, &header, sizeof(nifti_image));
+
+    std::string empty(1, '\0');
+    fixed.fname = &empty[0];
+    fixed.iname = NULL;
+    fixed.num_ext = 0;  // no extension
+    
+    nifti_set_iname_offset(&fixed);
+
+    if (fixed.nifti_type != NIFTI_FTYPE_NIFTI1_1)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
     
-      nifti_1_header serialized = nifti_convert_nim2nhdr(&fixed);
-      serialized.vox_offset = (348 + 4);  // (*)
+    target = nifti_convert_nim2nhdr(&fixed);
+    target.vox_offset = NIFTI_HEADER_SIZE;  // (*)
+  }
+
+
+  void NiftiWriter::WriteHeader(const nifti_image& header)
+  {
+    if (hasHeader_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      nifti_1_header serialized;
+      SerializeHeader(serialized, header);
 
       static const uint8_t nope[4] = { 0, 0, 0, 0 };
 
       assert(sizeof(serialized) == 348);
-      buffer_.AddChunk(&serialized, sizeof(serialized));
+      Write(&serialized, sizeof(serialized));
 
       assert(sizeof(nope) == 4);
-      buffer_.AddChunk(&nope, sizeof(nope));  // because of (*)
+      Write(&nope, sizeof(nope));  // because of (*) in "SerializeHeader()"
 
       hasHeader_ = true;
+      datatype_ = header.datatype;
+      bytesPerVoxel_ = static_cast<size_t>(header.nbyper);
     }
   }
 
 
-  void NiftiWriter::AddSlice(const Orthanc::ImageAccessor& slice)
+  void NiftiWriter::AddSlice(const Orthanc::ImageAccessor& slice,
+                             double rescaleSlope,
+                             double rescaleIntercept)
   {
-    if (!hasHeader_)
+    if (!hasHeader_ ||
+        randomAccess_)
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
     }
     else if (slice.GetWidth() != 0 &&
              slice.GetHeight() != 0)
     {
-      Orthanc::Image image(slice.GetFormat(), slice.GetWidth(), slice.GetHeight(),
-                           true /* force minimal pitch, as no pitch is allowed in NIfTI */);
+      const size_t sliceSize = GetSliceSize(slice);
+
+      /**
+       * If writing in place, the rows are directly copied to their
+       * final location. Otherwise, they are gathered in a buffer that
+       * is reused from one slice to the next, so as to issue a single
+       * write per slice.
+       **/
+      uint8_t* target;
+
+      if (target_ != NULL)
+      {
+        if (position_ + sliceSize > targetSize_)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                          "The NIfTI file doesn't fit in the preallocated memory area");
+        }
 
-      const size_t rowSize = GetBytesPerPixel(image.GetFormat()) * image.GetWidth();
-      if (rowSize != image.GetPitch())
+        target = target_ + position_;
+      }
+      else
       {
-        // Should never happen because of minimal pitch
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        sliceBuffer_.resize(sliceSize);
+        target = reinterpret_cast<uint8_t*>(&sliceBuffer_[0]);
       }
 
-      assert(image.GetPitch() <= slice.GetPitch());
+      CopyFlippedRows(target, slice, rescaleSlope, rescaleIntercept);
 
-      for (unsigned int y = 0; y < slice.GetHeight(); y++)
+      if (target_ != NULL)
       {
-        const uint8_t *source = reinterpret_cast<const uint8_t*>(slice.GetConstRow(y));
-        uint8_t *target = reinterpret_cast<uint8_t*>(image.GetRow(image.GetHeight() - 1 - y));
-        memcpy(target, source, rowSize);
+        position_ += sliceSize;
+      }
+      else
+      {
+        Write(sliceBuffer_.c_str(), sliceSize);
       }
 
-      buffer_.AddChunk(image.GetConstBuffer(), rowSize * image.GetHeight());
+      if (listener_ != NULL)
+      {
+        listener_->SignalProgress(position_);
+      }
+    }
+  }
+
+
+  void NiftiWriter::WriteSlice(size_t index,
+                               const Orthanc::ImageAccessor& slice,
+                               double rescaleSlope,
+                               double rescaleIntercept)
+  {
+    if (!hasHeader_ ||
+        target_ == NULL ||
+        position_ < NIFTI_HEADER_SIZE)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                      "Random access to the slices is only available if writing in place");
+    }
+
+    const size_t sliceSize = GetSliceSize(slice);
+    if (sliceSize == 0)
+    {
+      return;
+    }
+
+    assert(targetSize_ >= NIFTI_HEADER_SIZE);
+    if (index >= (targetSize_ - NIFTI_HEADER_SIZE) / sliceSize)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "The slice is outside of the preallocated memory area");
+    }
+
+    CopyFlippedRows(target_ + NIFTI_HEADER_SIZE + index * sliceSize, slice, rescaleSlope, rescaleIntercept);
+
+    size_t position;
+
+    {
+      boost::mutex::scoped_lock lock(positionMutex_);
+      randomAccess_ = true;
+      position_ += sliceSize;
+      position = position_;
+    }
+
+    if (listener_ != NULL)
+    {
+      listener_->SignalProgress(position);
     }
   }
 
@@ -103,7 +354,13 @@ namespace Neuro
   void NiftiWriter::Flatten(std::string& target,
                             bool compress)
   {
-    if (compress)
+    if (output_ != NULL ||
+        target_ != NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                      "The NIfTI file was not written to the internal buffer");
+    }
+    else if (compress)
     {
       std::string uncompressed;
       buffer_.Flatten(uncompressed);
@@ -116,4 +373,142 @@ namespace Neuro
       buffer_.Flatten(target);
     }
   }
+
+
+  size_t NiftiWriter::ComputeFileSize(const nifti_image& header)
+  {
+    if (header.nbyper <= 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      return NIFTI_HEADER_SIZE + static_cast<size_t>(header.nvox) * static_cast<size_t>(header.nbyper);
+    }
+  }
+
+
+  size_t NiftiWriter::GetHeaderSize()
+  {
+    return NIFTI_HEADER_SIZE;
+  }
+
+
+  size_t NiftiWriter::ComputeSliceSize(const nifti_image& header)
+  {
+    if (header.nbyper <= 0 ||
+        header.nx <= 0 ||
+        header.ny <= 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      return static_cast<size_t>(header.nx) * static_cast<size_t>(header.ny) * static_cast<size_t>(header.nbyper);
+    }
+  }
+
+
+  void NiftiWriter::LocateSlices(size_t& firstSlice,
+                                 size_t& endSlice,
+                                 const nifti_image& header,
+                                 uint64_t start,
+                                 uint64_t end)
+  {
+    const uint64_t sliceSize = ComputeSliceSize(header);
+    const uint64_t countSlices = (ComputeFileSize(header) - NIFTI_HEADER_SIZE) / sliceSize;
+
+    if (start > end)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else if (end <= NIFTI_HEADER_SIZE)
+    {
+      firstSlice = 0;
+      endSlice = 0;
+    }
+    else
+    {
+      const uint64_t first = (start <= NIFTI_HEADER_SIZE ? 0 : (start - NIFTI_HEADER_SIZE) / sliceSize);
+      const uint64_t last = (end - NIFTI_HEADER_SIZE + sliceSize - 1) / sliceSize;  // Rounded up
+
+      firstSlice = static_cast<size_t>(std::min(first, countSlices));
+      endSlice = static_cast<size_t>(std::min(last, countSlices));
+    }
+  }
+
+
+  // The character arrays of the NIfTI header are not necessarily null-terminated
+  template <size_t Size>
+  static std::string FormatCharacters(const char (&value)[Size])
+  {
+    size_t length = 0;
+    while (length < Size &&
+           value[length] != '\0')
+    {
+      length++;
+    }
+
+    return std::string(value, length);
+  }
+
+
+  template <typename T, size_t Size>
+  static Json::Value FormatArray(const T (&values)[Size])
+  {
+    Json::Value result = Json::arrayValue;
+    for (size_t i = 0; i < Size; i++)
+    {
+      result.append(values[i]);
+    }
+
+    return result;
+  }
+
+
+  void NiftiWriter::FormatHeader(Json::Value& target,
+                                 const nifti_image& header)
+  {
+    nifti_1_header h;
+    SerializeHeader(h, header);
+
+    target = Json::objectValue;
+    target["sizeof_hdr"] = h.sizeof_hdr;
+    target["dim_info"] = h.dim_info;
+    target["dim"] = FormatArray(h.dim);
+    target["intent_p1"] = h.intent_p1;
+    target["intent_p2"] = h.intent_p2;
+    target["intent_p3"] = h.intent_p3;
+    target["intent_code"] = h.intent_code;
+    target["datatype"] = h.datatype;
+    target["datatype_name"] = nifti_datatype_string(h.datatype);
+    target["bitpix"] = h.bitpix;
+    target["slice_start"] = h.slice_start;
+    target["pixdim"] = FormatArray(h.pixdim);
+    target["vox_offset"] = h.vox_offset;
+    target["scl_slope"] = h.scl_slope;
+    target["scl_inter"] = h.scl_inter;
+    target["slice_end"] = h.slice_end;
+    target["slice_code"] = h.slice_code;
+    target["xyzt_units"] = h.xyzt_units;
+    target["cal_max"] = h.cal_max;
+    target["cal_min"] = h.cal_min;
+    target["slice_duration"] = h.slice_duration;
+    target["toffset"] = h.toffset;
+    target["descrip"] = FormatCharacters(h.descrip);
+    target["aux_file"] = FormatCharacters(h.aux_file);
+    target["qform_code"] = h.qform_code;
+    target["sform_code"] = h.sform_code;
+    target["quatern_b"] = h.quatern_b;
+    target["quatern_c"] = h.quatern_c;
+    target["quatern_d"] = h.quatern_d;
+    target["qoffset_x"] = h.qoffset_x;
+    target["qoffset_y"] = h.qoffset_y;
+    target["qoffset_z"] = h.qoffset_z;
+    target["srow_x"] = FormatArray(h.srow_x);
+    target["srow_y"] = FormatArray(h.srow_y);
+    target["srow_z"] = FormatArray(h.srow_z);
+    target["intent_name"] = FormatCharacters(h.intent_name);
+    target["magic"] = FormatCharacters(h.magic);
+  }
 }
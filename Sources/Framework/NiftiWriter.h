@@ -19,9 +19,14 @@
 
 #pragma once
 
+#include "IOutputStream.h"
+
 #include <ChunkedBuffer.h>
 #include <Images/ImageAccessor.h>
 
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+
 #include <nifti1_io.h>
 
 
@@ -29,21 +34,169 @@ namespace Neuro
 {
   class NiftiWriter : public boost::noncopyable
   {
+  public:
+    class IProgressListener : public boost::noncopyable
+    {
+    public:
+      virtual ~IProgressListener()
+      {
+      }
+
+      /**
+       * Called each time a slice has been written, with the number of
+       * bytes of the NIfTI file that were written so far. Must be
+       * thread-safe, as "WriteSlice()" can be called from several
+       * threads. Throwing an exception aborts the writing.
+       **/
+      virtual void SignalProgress(size_t position) = 0;
+    };
+
   private:
     bool                    hasHeader_;
+    int                     datatype_;       // NIfTI datatype of the voxels, from the header
+    size_t                  bytesPerVoxel_;
     Orthanc::ChunkedBuffer  buffer_;
+    IOutputStream*          output_;  // If not NULL, the file is forwarded to this stream
+    uint8_t*                target_;  // If not NULL, the file is written in place into this memory area
+    size_t                  targetSize_;
+    size_t                  position_;
+    std::string             sliceBuffer_;
+    bool                    randomAccess_;
+    boost::mutex            positionMutex_;  // Protects "position_" in "WriteSlice()"
+    IProgressListener*      listener_;       // Can be NULL
+
+    void Write(const void* data,
+               size_t size);
+
+    size_t GetSliceSize(const Orthanc::ImageAccessor& slice) const;
+
+    void CopyFlippedRows(uint8_t* target,
+                         const Orthanc::ImageAccessor& slice,
+                         double rescaleSlope,
+                         double rescaleIntercept) const;
 
   public:
     NiftiWriter() :
-      hasHeader_(false)
+      hasHeader_(false),
+      datatype_(0),
+      bytesPerVoxel_(0),
+      output_(NULL),
+      target_(NULL),
+      targetSize_(0),
+      position_(0),
+      randomAccess_(false),
+      listener_(NULL)
+    {
+    }
+
+    // The bytes of the file are forwarded to "output" as soon as they
+    // are available, which avoids keeping the full volume in memory
+    explicit NiftiWriter(IOutputStream& output) :
+      hasHeader_(false),
+      datatype_(0),
+      bytesPerVoxel_(0),
+      output_(&output),
+      target_(NULL),
+      targetSize_(0),
+      position_(0),
+      randomAccess_(false),
+      listener_(NULL)
     {
     }
+
+    /**
+     * The file is written in place into a memory area that has been
+     * preallocated by the caller, whose size must be given by
+     * "ComputeFileSize()". The rows of the slices are copied directly
+     * to their final offset, without any intermediate buffer.
+     **/
+    NiftiWriter(void* target,
+                size_t targetSize);
   
+    // The listener must stay alive as long as the writer is used
+    void SetProgressListener(IProgressListener& listener)
+    {
+      listener_ = &listener;
+    }
+
     void WriteHeader(const nifti_image& header);
 
-    void AddSlice(const Orthanc::ImageAccessor& slice);
+    /**
+     * The pixels of the slice are converted to the datatype of the
+     * NIfTI header if needed (e.g. 16-bit integers are widened if the
+     * header specifies 32-bit integers or floating-point values). The
+     * rescale slope and intercept are only applied if converting
+     * integers to floating-point values. In all the other cases, the
+     * rescaling is described by the "scl_slope" and "scl_inter"
+     * fields of the NIfTI header.
+     **/
+    void AddSlice(const Orthanc::ImageAccessor& slice,
+                  double rescaleSlope,
+                  double rescaleIntercept);
 
+    void AddSlice(const Orthanc::ImageAccessor& slice)
+    {
+      AddSlice(slice, 1, 0);
+    }
+
+    /**
+     * Places the slice at its final offset, given its index in the
+     * NIfTI volume, which allows to write the slices in any order.
+     * Only available if writing in place, and if all the slices have
+     * the same size. Can be called concurrently from several threads,
+     * as long as they write distinct slices. Cannot be combined with
+     * "AddSlice()".
+     **/
+    void WriteSlice(size_t index,
+                    const Orthanc::ImageAccessor& slice,
+                    double rescaleSlope,
+                    double rescaleIntercept);
+
+    void WriteSlice(size_t index,
+                    const Orthanc::ImageAccessor& slice)
+    {
+      WriteSlice(index, slice, 1, 0);
+    }
+
+    // Only available if no output stream was provided to the constructor
     void Flatten(std::string& target,
                  bool compress);
+
+    // Number of bytes of the NIfTI file that were written so far
+    size_t GetPosition() const
+    {
+      return position_;
+    }
+
+    static size_t ComputeFileSize(const nifti_image& header);
+
+    // Offset of the first voxel in the NIfTI file
+    static size_t GetHeaderSize();
+
+    // Serialized NIfTI-1 header, as written at the beginning of the file
+    static void SerializeHeader(nifti_1_header& target,
+                                const nifti_image& header);
+
+    /**
+     * JSON rendering of the serialized NIfTI-1 header, whose keys are
+     * the names of the fields of the "nifti_1_header" structure.
+     **/
+    static void FormatHeader(Json::Value& target,
+                             const nifti_image& header);
+
+    // Size of one 2D slice of the NIfTI volume (i.e. "nx * ny" voxels)
+    static size_t ComputeSliceSize(const nifti_image& header);
+
+    /**
+     * Locates the slices of the NIfTI volume that overlap the bytes
+     * between "start" (included) and "end" (excluded) of the file.
+     * The range "[firstSlice, endSlice)" is empty if only the header
+     * is concerned.
+     **/
+    static void LocateSlices(size_t& firstSlice,
+                             size_t& endSlice,
+                             const nifti_image& header,
+                             uint64_t start,
+                             uint64_t end);
   };
 }
@@ -0,0 +1,443 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "ParallelGzipOutputStream.h"
+
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <cassert>
+#include <string.h>
+#include <zlib.h>
+
+
+namespace Neuro
+{
+  static const size_t BLOCK_SIZE = 1024 * 1024;
+  static const size_t DICTIONARY_SIZE = 32 * 1024;  // Size of the deflate window
+
+
+  class ParallelGzipOutputStream::Block : public boost::noncopyable
+  {
+  private:
+    std::string  input_;
+    std::string  dictionary_;
+    bool         isLast_;
+    size_t       inputSize_;
+    bool         isDone_;
+    bool         success_;
+    std::string  output_;
+    uint32_t     crc32_;
+
+    void CompressInternal(uint8_t compressionLevel)
+    {
+      z_stream stream;
+      memset(&stream, 0, sizeof(stream));
+
+      // Negative window bits: Raw deflate data, without zlib/gzip header
+      if (deflateInit2(&stream, compressionLevel, Z_DEFLATED, -MAX_WBITS,
+                       8 /* default memory level */, Z_DEFAULT_STRATEGY) != Z_OK)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+      }
+
+      try
+      {
+        if (!dictionary_.empty() &&
+            deflateSetDictionary(&stream, reinterpret_cast<const Bytef*>(dictionary_.c_str()),
+                                 static_cast<uInt>(dictionary_.size())) != Z_OK)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+
+        // Non-last blocks are terminated by a sync flush, so that they
+        // end on a byte boundary and can be concatenated
+        const int flush = (isLast_ ? Z_FINISH : Z_SYNC_FLUSH);
+
+        output_.resize(deflateBound(&stream, static_cast<uLong>(input_.size())) + 64);
+
+        stream.next_in = const_cast<Bytef*>(reinterpret_cast<const Bytef*>(input_.c_str()));
+        stream.avail_in = static_cast<uInt>(input_.size());
+
+        size_t produced = 0;
+
+        for (;;)
+        {
+          if (produced == output_.size())
+          {
+            output_.resize(output_.size() + 64 * 1024);
+          }
+
+          stream.next_out = reinterpret_cast<Bytef*>(&output_[produced]);
+          stream.avail_out = static_cast<uInt>(output_.size() - produced);
+
+          const int code = deflate(&stream, flush);
+          produced = output_.size() - stream.avail_out;
+
+          if (code == Z_STREAM_END ||
+              (code == Z_OK && !isLast_ && stream.avail_in == 0 && stream.avail_out != 0))
+          {
+            break;
+          }
+          else if (code != Z_OK &&
+                   code != Z_BUF_ERROR)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                            "Error while compressing with zlib");
+          }
+        }
+
+        output_.resize(produced);
+      }
+      catch (...)
+      {
+        deflateEnd(&stream);
+        throw;
+      }
+
+      deflateEnd(&stream);
+
+      crc32_ = crc32(0L, Z_NULL, 0);
+      crc32_ = crc32(crc32_, reinterpret_cast<const Bytef*>(input_.c_str()), static_cast<uInt>(input_.size()));
+
+      // Release the memory as soon as possible
+      std::string empty;
+      input_.swap(empty);
+      dictionary_.clear();
+    }
+
+  public:
+    Block(std::string& input /* will be swapped */,
+          const std::string& dictionary,
+          bool isLast) :
+      dictionary_(dictionary),
+      isLast_(isLast),
+      inputSize_(input.size()),
+      isDone_(false),
+      success_(false),
+      crc32_(0)
+    {
+      input_.swap(input);
+    }
+
+    // Invoked from a worker thread, without the mutex
+    void Compress(uint8_t compressionLevel)
+    {
+      try
+      {
+        CompressInternal(compressionLevel);
+        success_ = true;
+      }
+      catch (...)
+      {
+        success_ = false;
+      }
+    }
+
+    // The two following methods must be invoked with the mutex locked
+    void SetDone()
+    {
+      isDone_ = true;
+    }
+
+    bool IsDone() const
+    {
+      return isDone_;
+    }
+
+    bool IsSuccess() const
+    {
+      return success_;
+    }
+
+    size_t GetInputSize() const
+    {
+      return inputSize_;
+    }
+
+    const std::string& GetOutput() const
+    {
+      return output_;
+    }
+
+    uint32_t GetCrc32() const
+    {
+      return crc32_;
+    }
+  };
+
+
+  void ParallelGzipOutputStream::Worker(ParallelGzipOutputStream* that)
+  {
+    assert(that != NULL);
+
+    for (;;)
+    {
+      Block* block = NULL;
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        while (!that->stopping_ &&
+               that->pendingBlocks_.empty())
+        {
+          that->blockAvailable_.wait(lock);
+        }
+
+        if (that->stopping_)
+        {
+          return;
+        }
+
+        block = that->pendingBlocks_.front();
+        that->pendingBlocks_.pop_front();
+      }
+
+      assert(block != NULL);
+      block->Compress(that->compressionLevel_);
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+        block->SetDone();
+      }
+
+      that->blockCompressed_.notify_all();
+    }
+  }
+
+
+  void ParallelGzipOutputStream::SubmitBlock(bool isLast)
+  {
+    std::string nextDictionary;
+    if (current_.size() >= DICTIONARY_SIZE)
+    {
+      nextDictionary = current_.substr(current_.size() - DICTIONARY_SIZE);
+    }
+    else
+    {
+      nextDictionary = dictionary_ + current_;
+      if (nextDictionary.size() > DICTIONARY_SIZE)
+      {
+        nextDictionary = nextDictionary.substr(nextDictionary.size() - DICTIONARY_SIZE);
+      }
+    }
+
+    std::unique_ptr<Block> block(new Block(current_, dictionary_, isLast));
+    dictionary_.swap(nextDictionary);
+
+    current_.clear();
+    current_.reserve(blockSize_);
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      blocksInFlight_.push_back(block.get());
+      pendingBlocks_.push_back(block.release());
+    }
+
+    blockAvailable_.notify_one();
+
+    // Bound the memory usage if the workers are slower than the producer
+    while (blocksInFlight_.size() > maxBlocksInFlight_)
+    {
+      WriteFirstBlockInFlight();
+    }
+  }
+
+
+  void ParallelGzipOutputStream::WriteFirstBlockInFlight()
+  {
+    Block* block = NULL;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (blocksInFlight_.empty())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+
+      block = blocksInFlight_.front();
+
+      while (!block->IsDone())
+      {
+        blockCompressed_.wait(lock);
+      }
+
+      blocksInFlight_.pop_front();
+    }
+
+    std::unique_ptr<Block> protection(block);
+
+    if (!block->IsSuccess())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                      "Error while compressing a block of the gzip stream");
+    }
+
+    if (!block->GetOutput().empty())
+    {
+      target_.Write(block->GetOutput().c_str(), block->GetOutput().size());
+    }
+
+    crc32_ = crc32_combine(crc32_, block->GetCrc32(), static_cast<z_off_t>(block->GetInputSize()));
+  }
+
+
+  ParallelGzipOutputStream::ParallelGzipOutputStream(IOutputStream& target,
+                                                     uint8_t compressionLevel,
+                                                     unsigned int countThreads) :
+    target_(target),
+    compressionLevel_(compressionLevel),
+    blockSize_(BLOCK_SIZE),
+    maxBlocksInFlight_(2 * countThreads),
+    stopping_(false),
+    crc32_(crc32(0L, Z_NULL, 0)),
+    uncompressedSize_(0),
+    finished_(false)
+  {
+    if (compressionLevel > 9)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Compression level must be between 0 and 9");
+    }
+
+    if (countThreads == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    current_.reserve(blockSize_);
+
+    // Gzip header (RFC 1952): No file name, no modification time, unknown OS
+    static const uint8_t header[10] = { 0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff };
+    target_.Write(header, sizeof(header));
+
+    workers_.reserve(countThreads);  // "push_back()" must not throw below
+
+    try
+    {
+      for (unsigned int i = 0; i < countThreads; i++)
+      {
+        workers_.push_back(new boost::thread(Worker, this));
+      }
+    }
+    catch (...)
+    {
+      // The destructor is not called if the constructor throws: The
+      // workers that are already running must be stopped here
+      StopWorkers();
+      throw;
+    }
+  }
+
+
+  void ParallelGzipOutputStream::StopWorkers()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stopping_ = true;
+    }
+
+    blockAvailable_.notify_all();
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      assert(workers_[i] != NULL);
+
+      if (workers_[i]->joinable())
+      {
+        workers_[i]->join();
+      }
+
+      delete workers_[i];
+    }
+
+    workers_.clear();
+  }
+
+
+  ParallelGzipOutputStream::~ParallelGzipOutputStream()
+  {
+    StopWorkers();
+
+    // "pendingBlocks_" is a subset of "blocksInFlight_"
+    for (std::deque<Block*>::iterator it = blocksInFlight_.begin(); it != blocksInFlight_.end(); ++it)
+    {
+      assert(*it != NULL);
+      delete *it;
+    }
+  }
+
+
+  void ParallelGzipOutputStream::Write(const void* data,
+                                       size_t size)
+  {
+    if (finished_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    uncompressedSize_ += size;
+
+    const char* p = reinterpret_cast<const char*>(data);
+
+    while (size > 0)
+    {
+      assert(current_.size() < blockSize_);
+
+      const size_t chunk = std::min(size, blockSize_ - current_.size());
+      current_.append(p, chunk);
+      p += chunk;
+      size -= chunk;
+
+      if (current_.size() == blockSize_)
+      {
+        SubmitBlock(false);
+      }
+    }
+  }
+
+
+  void ParallelGzipOutputStream::Finish()
+  {
+    if (finished_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    SubmitBlock(true);
+
+    while (!blocksInFlight_.empty())
+    {
+      WriteFirstBlockInFlight();
+    }
+
+    // Gzip trailer: CRC32 and size modulo 2^32, in little endian
+    uint8_t trailer[8];
+    for (unsigned int i = 0; i < 4; i++)
+    {
+      trailer[i] = static_cast<uint8_t>((crc32_ >> (8 * i)) & 0xff);
+      trailer[4 + i] = static_cast<uint8_t>((uncompressedSize_ >> (8 * i)) & 0xff);
+    }
+
+    target_.Write(trailer, sizeof(trailer));
+
+    finished_ = true;
+  }
+}
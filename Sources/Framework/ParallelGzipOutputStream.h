@@ -0,0 +1,91 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "IOutputStream.h"
+
+#include <Compatibility.h>  // For ORTHANC_OVERRIDE
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <deque>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+namespace Neuro
+{
+  /**
+   * Block-parallel gzip compression, in the spirit of "pigz". The
+   * input is split into blocks that are deflated independently by a
+   * pool of threads, using the tail of the previous block as the
+   * dictionary. The compressed blocks are concatenated in order into
+   * one single gzip member, whose CRC32 is obtained by combining the
+   * CRC32 of the individual blocks.
+   **/
+  class ParallelGzipOutputStream : public IOutputStream
+  {
+  private:
+    class Block;
+
+    IOutputStream&              target_;
+    uint8_t                     compressionLevel_;
+    size_t                      blockSize_;
+    size_t                      maxBlocksInFlight_;
+    std::vector<boost::thread*> workers_;
+
+    boost::mutex                mutex_;
+    boost::condition_variable   blockAvailable_;
+    boost::condition_variable   blockCompressed_;
+    bool                        stopping_;
+    std::deque<Block*>          pendingBlocks_;   // Blocks that are not processed by a worker yet
+    std::deque<Block*>          blocksInFlight_;  // Blocks that are not written yet, in the stream order
+
+    std::string                 current_;
+    std::string                 dictionary_;
+    uint32_t                    crc32_;
+    uint64_t                    uncompressedSize_;
+    bool                        finished_;
+
+    static void Worker(ParallelGzipOutputStream* that);
+
+    void StopWorkers();
+
+    void SubmitBlock(bool isLast);
+
+    void WriteFirstBlockInFlight();
+
+  public:
+    ParallelGzipOutputStream(IOutputStream& target,
+                             uint8_t compressionLevel,
+                             unsigned int countThreads);
+
+    virtual ~ParallelGzipOutputStream();
+
+    virtual void Write(const void* data,
+                       size_t size) ORTHANC_OVERRIDE;
+
+    // Waits for all the blocks and writes the gzip trailer. No data
+    // can be written afterward.
+    void Finish();
+  };
+}
@@ -0,0 +1,713 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PixelKernels.h"
+
+#include <OrthancException.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define NEURO_HAS_X86_KERNELS 1
+#  include <immintrin.h>
+#else
+#  define NEURO_HAS_X86_KERNELS 0
+#endif
+
+
+namespace Neuro
+{
+  /**
+   * Portable implementations, that are also used to process the
+   * values at the end of the rows that don't fill a full SIMD
+   * register.
+   **/
+
+  static void SwapBytes16Scalar(uint16_t* target,
+                                const uint16_t* source,
+                                size_t count)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      target[i] = static_cast<uint16_t>((source[i] >> 8) | (source[i] << 8));
+    }
+  }
+
+
+  static void SwapBytes32Scalar(uint32_t* target,
+                                const uint32_t* source,
+                                size_t count)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      const uint32_t v = source[i];
+      target[i] = ((v >> 24) |
+                   ((v >> 8) & 0x0000ff00u) |
+                   ((v << 8) & 0x00ff0000u) |
+                   (v << 24));
+    }
+  }
+
+
+  static void WidenUInt8ToUInt16Scalar(uint16_t* target,
+                                       const uint8_t* source,
+                                       size_t count)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      target[i] = source[i];
+    }
+  }
+
+
+  static void WidenUInt16ToInt32Scalar(int32_t* target,
+                                       const uint16_t* source,
+                                       size_t count)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      target[i] = source[i];
+    }
+  }
+
+
+  static void WidenInt16ToInt32Scalar(int32_t* target,
+                                      const int16_t* source,
+                                      size_t count)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      target[i] = source[i];
+    }
+  }
+
+
+  static void RescaleUInt16ToFloat32Scalar(float* target,
+                                           const uint16_t* source,
+                                           size_t count,
+                                           float slope,
+                                           float intercept)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      target[i] = static_cast<float>(source[i]) * slope + intercept;
+    }
+  }
+
+
+  static void RescaleInt16ToFloat32Scalar(float* target,
+                                          const int16_t* source,
+                                          size_t count,
+                                          float slope,
+                                          float intercept)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      target[i] = static_cast<float>(source[i]) * slope + intercept;
+    }
+  }
+
+
+  static void RescaleUInt32ToFloat32Scalar(float* target,
+                                           const uint32_t* source,
+                                           size_t count,
+                                           float slope,
+                                           float intercept)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      target[i] = static_cast<float>(source[i]) * slope + intercept;
+    }
+  }
+
+
+#if NEURO_HAS_X86_KERNELS == 1
+  /**
+   * The SIMD implementations are compiled using the "target" function
+   * attribute of GCC and clang, which doesn't require the full
+   * translation unit to be built with "-msse2" or "-mavx2". They must
+   * only be called once the CPU is known to support them.
+   **/
+
+  __attribute__((target("sse2")))
+  static void SwapBytes16SSE2(uint16_t* target,
+                              const uint16_t* source,
+                              size_t count)
+  {
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i),
+                       _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+    }
+
+    SwapBytes16Scalar(target + i, source + i, count - i);
+  }
+
+
+  __attribute__((target("sse2")))
+  static void SwapBytes32SSE2(uint32_t* target,
+                              const uint32_t* source,
+                              size_t count)
+  {
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+
+      // Swap the bytes within the 16-bit words, then swap the 16-bit words within the 32-bit values
+      __m128i w = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+      w = _mm_shufflelo_epi16(w, _MM_SHUFFLE(2, 3, 0, 1));
+      w = _mm_shufflehi_epi16(w, _MM_SHUFFLE(2, 3, 0, 1));
+
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), w);
+    }
+
+    SwapBytes32Scalar(target + i, source + i, count - i);
+  }
+
+
+  __attribute__((target("sse2")))
+  static void WidenUInt8ToUInt16SSE2(uint16_t* target,
+                                     const uint8_t* source,
+                                     size_t count)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), _mm_unpacklo_epi8(v, zero));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i + 8), _mm_unpackhi_epi8(v, zero));
+    }
+
+    WidenUInt8ToUInt16Scalar(target + i, source + i, count - i);
+  }
+
+
+  __attribute__((target("sse2")))
+  static void WidenUInt16ToInt32SSE2(int32_t* target,
+                                     const uint16_t* source,
+                                     size_t count)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), _mm_unpacklo_epi16(v, zero));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i + 4), _mm_unpackhi_epi16(v, zero));
+    }
+
+    WidenUInt16ToInt32Scalar(target + i, source + i, count - i);
+  }
+
+
+  __attribute__((target("sse2")))
+  static void WidenInt16ToInt32SSE2(int32_t* target,
+                                    const int16_t* source,
+                                    size_t count)
+  {
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+      const __m128i sign = _mm_srai_epi16(v, 15);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), _mm_unpacklo_epi16(v, sign));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i + 4), _mm_unpackhi_epi16(v, sign));
+    }
+
+    WidenInt16ToInt32Scalar(target + i, source + i, count - i);
+  }
+
+
+  __attribute__((target("sse2")))
+  static void RescaleUInt16ToFloat32SSE2(float* target,
+                                         const uint16_t* source,
+                                         size_t count,
+                                         float slope,
+                                         float intercept)
+  {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 s = _mm_set1_ps(slope);
+    const __m128 t = _mm_set1_ps(intercept);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+      const __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+      const __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero));
+      _mm_storeu_ps(target + i, _mm_add_ps(_mm_mul_ps(lo, s), t));
+      _mm_storeu_ps(target + i + 4, _mm_add_ps(_mm_mul_ps(hi, s), t));
+    }
+
+    RescaleUInt16ToFloat32Scalar(target + i, source + i, count - i, slope, intercept);
+  }
+
+
+  __attribute__((target("sse2")))
+  static void RescaleInt16ToFloat32SSE2(float* target,
+                                        const int16_t* source,
+                                        size_t count,
+                                        float slope,
+                                        float intercept)
+  {
+    const __m128 s = _mm_set1_ps(slope);
+    const __m128 t = _mm_set1_ps(intercept);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+      const __m128i sign = _mm_srai_epi16(v, 15);
+      const __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, sign));
+      const __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(v, sign));
+      _mm_storeu_ps(target + i, _mm_add_ps(_mm_mul_ps(lo, s), t));
+      _mm_storeu_ps(target + i + 4, _mm_add_ps(_mm_mul_ps(hi, s), t));
+    }
+
+    RescaleInt16ToFloat32Scalar(target + i, source + i, count - i, slope, intercept);
+  }
+
+
+  /**
+   * There is no SSE2/AVX2 instruction to convert unsigned 32-bit
+   * integers to floats. The two 16-bit halves are converted separately
+   * (which is exact), then "high * 65536 + low" is computed with a
+   * single rounding, which gives the same result as the scalar cast.
+   **/
+  __attribute__((target("sse2")))
+  static void RescaleUInt32ToFloat32SSE2(float* target,
+                                         const uint32_t* source,
+                                         size_t count,
+                                         float slope,
+                                         float intercept)
+  {
+    const __m128i mask = _mm_set1_epi32(0xffff);
+    const __m128 shift = _mm_set1_ps(65536.0f);
+    const __m128 s = _mm_set1_ps(slope);
+    const __m128 t = _mm_set1_ps(intercept);
+    size_t i = 0;
+
+    for (; i + 4 <= count; i += 4)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+      const __m128 hi = _mm_cvtepi32_ps(_mm_srli_epi32(v, 16));
+      const __m128 lo = _mm_cvtepi32_ps(_mm_and_si128(v, mask));
+      const __m128 f = _mm_add_ps(_mm_mul_ps(hi, shift), lo);
+      _mm_storeu_ps(target + i, _mm_add_ps(_mm_mul_ps(f, s), t));
+    }
+
+    RescaleUInt32ToFloat32Scalar(target + i, source + i, count - i, slope, intercept);
+  }
+
+
+  __attribute__((target("avx2")))
+  static void SwapBytes16AVX2(uint16_t* target,
+                              const uint16_t* source,
+                              size_t count)
+  {
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + i),
+                          _mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8)));
+    }
+
+    SwapBytes16Scalar(target + i, source + i, count - i);
+  }
+
+
+  __attribute__((target("avx2")))
+  static void SwapBytes32AVX2(uint32_t* target,
+                              const uint32_t* source,
+                              size_t count)
+  {
+    // The shuffle operates within each of the two 128-bit lanes
+    const __m256i mask = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+                                         12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + i), _mm256_shuffle_epi8(v, mask));
+    }
+
+    SwapBytes32Scalar(target + i, source + i, count - i);
+  }
+
+
+  __attribute__((target("avx2")))
+  static void WidenUInt8ToUInt16AVX2(uint16_t* target,
+                                     const uint8_t* source,
+                                     size_t count)
+  {
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + i), _mm256_cvtepu8_epi16(v));
+    }
+
+    WidenUInt8ToUInt16Scalar(target + i, source + i, count - i);
+  }
+
+
+  __attribute__((target("avx2")))
+  static void WidenUInt16ToInt32AVX2(int32_t* target,
+                                     const uint16_t* source,
+                                     size_t count)
+  {
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + i), _mm256_cvtepu16_epi32(v));
+    }
+
+    WidenUInt16ToInt32Scalar(target + i, source + i, count - i);
+  }
+
+
+  __attribute__((target("avx2")))
+  static void WidenInt16ToInt32AVX2(int32_t* target,
+                                    const int16_t* source,
+                                    size_t count)
+  {
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + i), _mm256_cvtepi16_epi32(v));
+    }
+
+    WidenInt16ToInt32Scalar(target + i, source + i, count - i);
+  }
+
+
+  __attribute__((target("avx2")))
+  static void RescaleUInt16ToFloat32AVX2(float* target,
+                                         const uint16_t* source,
+                                         size_t count,
+                                         float slope,
+                                         float intercept)
+  {
+    // No fused multiply-add, so that the results are the same as with the scalar implementation
+    const __m256 s = _mm256_set1_ps(slope);
+    const __m256 t = _mm256_set1_ps(intercept);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+      const __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(v));
+      _mm256_storeu_ps(target + i, _mm256_add_ps(_mm256_mul_ps(f, s), t));
+    }
+
+    RescaleUInt16ToFloat32Scalar(target + i, source + i, count - i, slope, intercept);
+  }
+
+
+  __attribute__((target("avx2")))
+  static void RescaleInt16ToFloat32AVX2(float* target,
+                                        const int16_t* source,
+                                        size_t count,
+                                        float slope,
+                                        float intercept)
+  {
+    const __m256 s = _mm256_set1_ps(slope);
+    const __m256 t = _mm256_set1_ps(intercept);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+      const __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v));
+      _mm256_storeu_ps(target + i, _mm256_add_ps(_mm256_mul_ps(f, s), t));
+    }
+
+    RescaleInt16ToFloat32Scalar(target + i, source + i, count - i, slope, intercept);
+  }
+
+
+  __attribute__((target("avx2")))
+  static void RescaleUInt32ToFloat32AVX2(float* target,
+                                         const uint32_t* source,
+                                         size_t count,
+                                         float slope,
+                                         float intercept)
+  {
+    const __m256i mask = _mm256_set1_epi32(0xffff);
+    const __m256 shift = _mm256_set1_ps(65536.0f);
+    const __m256 s = _mm256_set1_ps(slope);
+    const __m256 t = _mm256_set1_ps(intercept);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8)
+    {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+      const __m256 hi = _mm256_cvtepi32_ps(_mm256_srli_epi32(v, 16));
+      const __m256 lo = _mm256_cvtepi32_ps(_mm256_and_si256(v, mask));
+      const __m256 f = _mm256_add_ps(_mm256_mul_ps(hi, shift), lo);
+      _mm256_storeu_ps(target + i, _mm256_add_ps(_mm256_mul_ps(f, s), t));
+    }
+
+    RescaleUInt32ToFloat32Scalar(target + i, source + i, count - i, slope, intercept);
+  }
+#endif
+
+
+  namespace
+  {
+    struct KernelsTable
+    {
+      void (*swapBytes16_) (uint16_t*, const uint16_t*, size_t);
+      void (*swapBytes32_) (uint32_t*, const uint32_t*, size_t);
+      void (*widenUInt8ToUInt16_) (uint16_t*, const uint8_t*, size_t);
+      void (*widenUInt16ToInt32_) (int32_t*, const uint16_t*, size_t);
+      void (*widenInt16ToInt32_) (int32_t*, const int16_t*, size_t);
+      void (*rescaleUInt16ToFloat32_) (float*, const uint16_t*, size_t, float, float);
+      void (*rescaleInt16ToFloat32_) (float*, const int16_t*, size_t, float, float);
+      void (*rescaleUInt32ToFloat32_) (float*, const uint32_t*, size_t, float, float);
+    };
+  }
+
+
+  static const KernelsTable SCALAR_KERNELS = {
+    SwapBytes16Scalar,
+    SwapBytes32Scalar,
+    WidenUInt8ToUInt16Scalar,
+    WidenUInt16ToInt32Scalar,
+    WidenInt16ToInt32Scalar,
+    RescaleUInt16ToFloat32Scalar,
+    RescaleInt16ToFloat32Scalar,
+    RescaleUInt32ToFloat32Scalar
+  };
+
+#if NEURO_HAS_X86_KERNELS == 1
+  static const KernelsTable SSE2_KERNELS = {
+    SwapBytes16SSE2,
+    SwapBytes32SSE2,
+    WidenUInt8ToUInt16SSE2,
+    WidenUInt16ToInt32SSE2,
+    WidenInt16ToInt32SSE2,
+    RescaleUInt16ToFloat32SSE2,
+    RescaleInt16ToFloat32SSE2,
+    RescaleUInt32ToFloat32SSE2
+  };
+
+  static const KernelsTable AVX2_KERNELS = {
+    SwapBytes16AVX2,
+    SwapBytes32AVX2,
+    WidenUInt8ToUInt16AVX2,
+    WidenUInt16ToInt32AVX2,
+    WidenInt16ToInt32AVX2,
+    RescaleUInt16ToFloat32AVX2,
+    RescaleInt16ToFloat32AVX2,
+    RescaleUInt32ToFloat32AVX2
+  };
+#endif
+
+
+  static const KernelsTable& GetKernelsTable(InstructionSet instructionSet)
+  {
+    switch (instructionSet)
+    {
+      case InstructionSet_Scalar:
+        return SCALAR_KERNELS;
+
+#if NEURO_HAS_X86_KERNELS == 1
+      case InstructionSet_SSE2:
+        return SSE2_KERNELS;
+
+      case InstructionSet_AVX2:
+        return AVX2_KERNELS;
+#endif
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+    }
+  }
+
+
+  static InstructionSet DetectInstructionSet()
+  {
+    if (PixelKernels::IsSupported(InstructionSet_AVX2))
+    {
+      return InstructionSet_AVX2;
+    }
+    else if (PixelKernels::IsSupported(InstructionSet_SSE2))
+    {
+      return InstructionSet_SSE2;
+    }
+    else
+    {
+      return InstructionSet_Scalar;
+    }
+  }
+
+
+  static InstructionSet       instructionSet_ = DetectInstructionSet();
+  static const KernelsTable*  kernels_ = &GetKernelsTable(instructionSet_);
+
+
+  bool PixelKernels::IsSupported(InstructionSet instructionSet)
+  {
+    switch (instructionSet)
+    {
+      case InstructionSet_Scalar:
+        return true;
+
+#if NEURO_HAS_X86_KERNELS == 1
+      case InstructionSet_SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+
+      case InstructionSet_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+
+      default:
+        return false;
+    }
+  }
+
+
+  InstructionSet PixelKernels::GetInstructionSet()
+  {
+    return instructionSet_;
+  }
+
+
+  void PixelKernels::SetInstructionSet(InstructionSet instructionSet)
+  {
+    if (IsSupported(instructionSet))
+    {
+      kernels_ = &GetKernelsTable(instructionSet);
+      instructionSet_ = instructionSet;
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                      "Instruction set not supported by this CPU: " +
+                                      std::string(EnumerationToString(instructionSet)));
+    }
+  }
+
+
+  const char* PixelKernels::EnumerationToString(InstructionSet instructionSet)
+  {
+    switch (instructionSet)
+    {
+      case InstructionSet_Scalar:
+        return "Scalar";
+
+      case InstructionSet_SSE2:
+        return "SSE2";
+
+      case InstructionSet_AVX2:
+        return "AVX2";
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  void PixelKernels::SwapBytes16(uint16_t* target,
+                                 const uint16_t* source,
+                                 size_t count)
+  {
+    kernels_->swapBytes16_(target, source, count);
+  }
+
+
+  void PixelKernels::SwapBytes32(uint32_t* target,
+                                 const uint32_t* source,
+                                 size_t count)
+  {
+    kernels_->swapBytes32_(target, source, count);
+  }
+
+
+  void PixelKernels::WidenUInt8ToUInt16(uint16_t* target,
+                                        const uint8_t* source,
+                                        size_t count)
+  {
+    kernels_->widenUInt8ToUInt16_(target, source, count);
+  }
+
+
+  void PixelKernels::WidenUInt16ToInt32(int32_t* target,
+                                        const uint16_t* source,
+                                        size_t count)
+  {
+    kernels_->widenUInt16ToInt32_(target, source, count);
+  }
+
+
+  void PixelKernels::WidenInt16ToInt32(int32_t* target,
+                                       const int16_t* source,
+                                       size_t count)
+  {
+    kernels_->widenInt16ToInt32_(target, source, count);
+  }
+
+
+  void PixelKernels::RescaleUInt16ToFloat32(float* target,
+                                            const uint16_t* source,
+                                            size_t count,
+                                            float slope,
+                                            float intercept)
+  {
+    kernels_->rescaleUInt16ToFloat32_(target, source, count, slope, intercept);
+  }
+
+
+  void PixelKernels::RescaleInt16ToFloat32(float* target,
+                                           const int16_t* source,
+                                           size_t count,
+                                           float slope,
+                                           float intercept)
+  {
+    kernels_->rescaleInt16ToFloat32_(target, source, count, slope, intercept);
+  }
+
+
+  void PixelKernels::RescaleUInt32ToFloat32(float* target,
+                                            const uint32_t* source,
+                                            size_t count,
+                                            float slope,
+                                            float intercept)
+  {
+    kernels_->rescaleUInt32ToFloat32_(target, source, count, slope, intercept);
+  }
+}
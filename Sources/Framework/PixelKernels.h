@@ -0,0 +1,104 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "NeuroEnumerations.h"
+
+#include <boost/noncopyable.hpp>
+#include <stddef.h>
+#include <stdint.h>
+
+
+namespace Neuro
+{
+  /**
+   * Conversion kernels that are applied to the rows of the slices
+   * while writing NIfTI files. Each kernel has a portable scalar
+   * implementation, together with SSE2 and AVX2 implementations on
+   * x86 processors. The best instruction set that is supported by the
+   * CPU is selected at runtime, so that the plugin doesn't need to be
+   * compiled with specific compiler flags. The source and target
+   * buffers must not overlap (except for the in-place byte swapping,
+   * where "target == source" is allowed), but they need not be
+   * aligned.
+   **/
+  class PixelKernels : public boost::noncopyable
+  {
+  private:
+    PixelKernels()  // This is a pure static class
+    {
+    }
+
+  public:
+    static bool IsSupported(InstructionSet instructionSet);
+
+    static InstructionSet GetInstructionSet();
+
+    /**
+     * Forces the use of a given instruction set, which must be
+     * supported by the CPU. This is only intended for the unit tests
+     * and the benchmarks, and is not thread-safe.
+     **/
+    static void SetInstructionSet(InstructionSet instructionSet);
+
+    static const char* EnumerationToString(InstructionSet instructionSet);
+
+    // Conversion between little-endian and big-endian values
+    static void SwapBytes16(uint16_t* target,
+                            const uint16_t* source,
+                            size_t count);
+
+    static void SwapBytes32(uint32_t* target,
+                            const uint32_t* source,
+                            size_t count);
+
+    // Widening of integer values
+    static void WidenUInt8ToUInt16(uint16_t* target,
+                                   const uint8_t* source,
+                                   size_t count);
+
+    static void WidenUInt16ToInt32(int32_t* target,
+                                   const uint16_t* source,
+                                   size_t count);
+
+    static void WidenInt16ToInt32(int32_t* target,
+                                  const int16_t* source,
+                                  size_t count);
+
+    // Computes "slope * source + intercept", as for the "Rescale Slope" and "Rescale Intercept" DICOM tags
+    static void RescaleUInt16ToFloat32(float* target,
+                                       const uint16_t* source,
+                                       size_t count,
+                                       float slope,
+                                       float intercept);
+
+    static void RescaleInt16ToFloat32(float* target,
+                                      const int16_t* source,
+                                      size_t count,
+                                      float slope,
+                                      float intercept);
+
+    static void RescaleUInt32ToFloat32(float* target,
+                                       const uint32_t* source,
+                                       size_t count,
+                                       float slope,
+                                       float intercept);
+  };
+}
@@ -51,7 +51,9 @@ namespace Neuro
     normalY_(normalY),
     normalZ_(normalZ),
     hasAcquisitionTime_(false),
-    acquisitionTime_(0)  // dummy value
+    acquisitionTime_(0),  // dummy value
+    rescaleSlope_(1),
+    rescaleIntercept_(0)
   {
     projectionAlongNormal_ = (originX * normalX + originY * normalY + originZ * normalZ);
   }
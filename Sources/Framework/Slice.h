@@ -44,6 +44,8 @@ namespace Neuro
     bool          hasAcquisitionTime_;
     double        acquisitionTime_;
     double        projectionAlongNormal_;
+    double        rescaleSlope_;
+    double        rescaleIntercept_;
 
   public:
     Slice(size_t instanceIndexInCollection,
@@ -112,5 +114,23 @@ namespace Neuro
     }
 
     double GetAcquisitionTime() const;
+
+    // Rescaling of the pixel values, as found in the source DICOM instance
+    void SetRescale(double slope,
+                    double intercept)
+    {
+      rescaleSlope_ = slope;
+      rescaleIntercept_ = intercept;
+    }
+
+    double GetRescaleSlope() const
+    {
+      return rescaleSlope_;
+    }
+
+    double GetRescaleIntercept() const
+    {
+      return rescaleIntercept_;
+    }
   };
 }
@@ -0,0 +1,58 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "IOutputStream.h"
+
+#include <Compatibility.h>  // For ORTHANC_OVERRIDE
+
+#include <string>
+
+
+namespace Neuro
+{
+  class StringOutputStream : public IOutputStream
+  {
+  private:
+    std::string&  target_;
+
+  public:
+    explicit StringOutputStream(std::string& target) :
+      target_(target)
+    {
+      target_.clear();
+    }
+
+    // Avoids reallocations if the final size is known in advance
+    void Reserve(size_t size)
+    {
+      target_.reserve(size);
+    }
+
+    virtual void Write(const void* data,
+                       size_t size) ORTHANC_OVERRIDE
+    {
+      if (size > 0)
+      {
+        target_.append(reinterpret_cast<const char*>(data), size);
+      }
+    }
+  };
+}
@@ -0,0 +1,256 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "BatchConverter.h"
+
+#include "PluginToolbox.h"
+
+#include "../../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <cassert>
+
+
+namespace Neuro
+{
+  static std::string FormatException(const Orthanc::OrthancException& e)
+  {
+    if (e.HasDetails())
+    {
+      return std::string(e.What()) + ": " + e.GetDetails();
+    }
+    else
+    {
+      return e.What();
+    }
+  }
+
+
+  void BatchConverter::SetFailure(Orthanc::ErrorCode code,
+                                  const std::string& details)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!hasFailure_)
+    {
+      hasFailure_ = true;
+      failureCode_ = code;
+      failureDetails_ = details;
+    }
+  }
+
+
+  void BatchConverter::AddError(size_t index,
+                                const std::string& details)
+  {
+    LOG(ERROR) << "Series " << series_[index] << " is skipped from the NIfTI archive, "
+               << "as it cannot be converted: " << details;
+
+    Json::Value error = Json::objectValue;
+    error["ID"] = series_[index];
+    error["Path"] = paths_[index];
+    error["Error"] = details;
+
+    boost::mutex::scoped_lock lock(mutex_);
+    errors_.append(error);
+  }
+
+
+  void BatchConverter::Worker(BatchConverter* that)
+  {
+    assert(that != NULL);
+
+    for (;;)
+    {
+      size_t index;
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        if (that->hasFailure_ ||
+            that->nextSeries_ >= that->series_.size())
+        {
+          return;
+        }
+
+        index = that->nextSeries_;
+        that->nextSeries_++;
+      }
+
+      const std::string& seriesId = that->series_[index];
+      const std::string& path = that->paths_[index];
+
+      NiftiFile nifti;
+      std::string json;
+
+      try
+      {
+        Json::Value sidecar;
+        that->converter_.ConvertSeries(nifti, (that->sidecars_ ? &sidecar : NULL), seriesId, that->compress_, NULL /* no listener */);
+
+        if (that->sidecars_)
+        {
+          OrthancPlugins::WriteStyledJson(json, sidecar);
+        }
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        that->AddError(index, FormatException(e));
+        continue;
+      }
+      catch (...)
+      {
+        that->AddError(index, "Native exception");
+        continue;
+      }
+
+      try
+      {
+        boost::mutex::scoped_lock lock(that->zipMutex_);
+        AddFileToArchive(that->zip_, path + (that->compress_ ? ".nii.gz" : ".nii"), nifti.GetData(), nifti.GetSize());
+
+        if (that->sidecars_)
+        {
+          AddFileToArchive(that->zip_, path + ".json", json.c_str(), json.size());
+        }
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        that->SetFailure(e.GetErrorCode(), "Cannot add series " + seriesId + " to the archive: " + FormatException(e));
+        return;
+      }
+      catch (...)
+      {
+        that->SetFailure(Orthanc::ErrorCode_InternalError, "Native exception while writing the archive");
+        return;
+      }
+
+      LOG(INFO) << "Series " << seriesId << " added to the NIfTI archive ("
+                << (index + 1) << "/" << that->series_.size() << ")";
+    }
+  }
+
+
+  BatchConverter::BatchConverter(const SeriesConverter& converter,
+                                 const std::vector<std::string>& series,
+                                 const std::vector<std::string>& paths,
+                                 bool compress,
+                                 bool sidecars,
+                                 Orthanc::ZipWriter& zip) :
+    converter_(converter),
+    series_(series),
+    paths_(paths),
+    compress_(compress),
+    sidecars_(sidecars),
+    zip_(zip),
+    nextSeries_(0),
+    hasFailure_(false),
+    failureCode_(Orthanc::ErrorCode_Success),
+    errors_(Json::arrayValue)
+  {
+    if (series.size() != paths.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  void BatchConverter::Run(unsigned int countThreads)
+  {
+    const size_t count = std::min(static_cast<size_t>(countThreads), series_.size());
+
+    if (count <= 1)
+    {
+      Worker(this);
+    }
+    else
+    {
+      std::vector<boost::thread*> workers;
+      workers.reserve(count);
+
+      for (size_t i = 0; i < count; i++)
+      {
+        workers.push_back(new boost::thread(Worker, this));
+      }
+
+      for (size_t i = 0; i < workers.size(); i++)
+      {
+        workers[i]->join();
+        delete workers[i];
+      }
+    }
+
+    if (hasFailure_)
+    {
+      throw Orthanc::OrthancException(failureCode_, failureDetails_);
+    }
+  }
+
+
+  void BatchConverter::OpenArchive(Orthanc::ZipWriter& zip,
+                                   std::string& archive)
+  {
+    zip.SetCompressionLevel(0);
+    zip.SetMemoryOutput(archive, false /* no ZIP64 */);
+    zip.Open();
+  }
+
+
+  void BatchConverter::AddFileToArchive(Orthanc::ZipWriter& zip,
+                                        const std::string& path,
+                                        const void* data,
+                                        size_t size)
+  {
+    PluginToolbox::CheckAnswerSize(zip.GetArchiveSize() + static_cast<uint64_t>(size));
+
+    zip.OpenFile(path.c_str());
+    zip.Write(data, size);
+  }
+
+
+  void BatchConverter::AddSeriesToArchive(Orthanc::ZipWriter& zip,
+                                          const SeriesConverter& converter,
+                                          const std::vector<std::string>& series,
+                                          const std::vector<std::string>& paths,
+                                          bool compress,
+                                          bool sidecars,
+                                          unsigned int countThreads)
+  {
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    BatchConverter batch(converter, series, paths, compress, sidecars, zip);
+    batch.Run(countThreads);
+
+    if (batch.GetErrors().size() > 0)
+    {
+      std::string json;
+      OrthancPlugins::WriteStyledJson(json, batch.GetErrors());
+      AddFileToArchive(zip, "errors.json", json.c_str(), json.size());
+    }
+
+    const boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+    LOG(INFO) << "Archive of " << (series.size() - batch.GetErrors().size()) << " NIfTI file(s) created in "
+              << elapsed.total_milliseconds() << "ms with " << countThreads << " thread(s), "
+              << batch.GetErrors().size() << " series skipped";
+  }
+}
@@ -0,0 +1,115 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "SeriesConverter.h"
+
+#include <Compression/ZipWriter.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+#include <string>
+#include <vector>
+
+
+namespace Neuro
+{
+  /**
+   * Pool of workers that convert a list of series concurrently. Each
+   * NIfTI file is added to the ZIP archive as soon as it is available,
+   * then released, so the memory only holds the archive and the files
+   * that are being converted. The "paths" give the location of each
+   * series in the archive, without the file extension. The series that
+   * cannot be converted are skipped and reported by "GetErrors()".
+   **/
+  class BatchConverter : public boost::noncopyable
+  {
+  private:
+    const SeriesConverter&           converter_;
+    const std::vector<std::string>&  series_;
+    const std::vector<std::string>&  paths_;
+    bool                             compress_;
+    bool                             sidecars_;
+    Orthanc::ZipWriter&              zip_;
+
+    boost::mutex                     zipMutex_;
+    boost::mutex                     mutex_;
+    size_t                           nextSeries_;
+    bool                             hasFailure_;
+    Orthanc::ErrorCode               failureCode_;
+    std::string                      failureDetails_;
+    Json::Value                      errors_;
+
+    // Failure of the archive as a whole, which stops all the workers
+    void SetFailure(Orthanc::ErrorCode code,
+                    const std::string& details);
+
+    // Failure of one series, which is skipped
+    void AddError(size_t index,
+                  const std::string& details);
+
+    static void Worker(BatchConverter* that);
+
+  public:
+    BatchConverter(const SeriesConverter& converter,
+                   const std::vector<std::string>& series,
+                   const std::vector<std::string>& paths,
+                   bool compress,
+                   bool sidecars,
+                   Orthanc::ZipWriter& zip);
+
+    void Run(unsigned int countThreads);
+
+    // The series that were skipped, once "Run()" has completed
+    const Json::Value& GetErrors() const
+    {
+      return errors_;
+    }
+
+    /**
+     * The entries are stored without compression ("SetCompressionLevel(0)"),
+     * which is the relevant choice for ".nii.gz" files that are already
+     * compressed, and that avoids a costly deflate of the uncompressed
+     * files. ZIP64 is not needed, as answers are limited to 4GB.
+     **/
+    static void OpenArchive(Orthanc::ZipWriter& zip,
+                            std::string& archive);
+
+    // Checks that the archive will not exceed the size of an answer, before adding each of its entries
+    static void AddFileToArchive(Orthanc::ZipWriter& zip,
+                                 const std::string& path,
+                                 const void* data,
+                                 size_t size);
+
+    /**
+     * Converts the series with "countThreads" workers. The series that
+     * cannot be converted are skipped, and are listed in an
+     * "errors.json" entry at the root of the archive, if any.
+     **/
+    static void AddSeriesToArchive(Orthanc::ZipWriter& zip,
+                                   const SeriesConverter& converter,
+                                   const std::vector<std::string>& series,
+                                   const std::vector<std::string>& paths,
+                                   bool compress,
+                                   bool sidecars,
+                                   unsigned int countThreads);
+  };
+}
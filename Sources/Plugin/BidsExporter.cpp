@@ -0,0 +1,174 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "BidsExporter.h"
+
+#include "BatchConverter.h"
+#include "PluginToolbox.h"
+
+#include "../Framework/BidsDataset.h"
+
+#include "../../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+
+
+namespace Neuro
+{
+  void BidsExporter::CreateArchive(std::string& archive,
+                                   const SeriesConverter& converter,
+                                   const std::vector<std::string>& studies,
+                                   unsigned int countThreads)
+  {
+    if (studies.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem, "No study to be exported");
+    }
+
+    std::vector<Json::Value> studiesContent(studies.size());
+    std::vector< std::pair<std::string, size_t> > dates(studies.size());
+
+    for (size_t i = 0; i < studies.size(); i++)
+    {
+      PluginToolbox::GetResource(studiesContent[i], "/studies/" + studies[i]);
+      dates[i] = std::make_pair(BidsDataset::SanitizeLabel(PluginToolbox::GetMainDicomTag(studiesContent[i], "MainDicomTags", "StudyDate")), i);
+    }
+
+    std::sort(dates.begin(), dates.end());
+
+    bool useDates = true;
+    for (size_t i = 0; i < dates.size(); i++)
+    {
+      if (dates[i].first.empty() ||
+          (i > 0 && dates[i].first == dates[i - 1].first))
+      {
+        useDates = false;
+      }
+    }
+
+    std::vector<std::string> sessions(studies.size());
+
+    if (studies.size() > 1)
+    {
+      // Sessions are labeled by their date, or numbered in chronological order
+      for (size_t i = 0; i < dates.size(); i++)
+      {
+        if (useDates)
+        {
+          sessions[dates[i].second] = dates[i].first;
+        }
+        else
+        {
+          std::string session = boost::lexical_cast<std::string>(i + 1);
+          if (session.size() < 2)
+          {
+            session = "0" + session;  // Zero-padding
+          }
+
+          sessions[dates[i].second] = session;
+        }
+      }
+    }
+
+    std::string subject = BidsDataset::SanitizeLabel(PluginToolbox::GetMainDicomTag(studiesContent[0], "PatientMainDicomTags", "PatientID"));
+    if (subject.empty())
+    {
+      subject = "01";
+    }
+
+    BidsDataset dataset(subject);
+
+    for (size_t i = 0; i < studies.size(); i++)
+    {
+      std::vector<std::string> series;
+      PluginToolbox::GetChildResources(series, "/studies/" + studies[i], "Series");
+
+      for (size_t j = 0; j < series.size(); j++)
+      {
+        Json::Value content;
+
+        try
+        {
+          PluginToolbox::GetResource(content, "/series/" + series[j]);
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          // The series might have been deleted in the meantime
+          LOG(ERROR) << "Series " << series[j] << " is skipped from the BIDS dataset: " << e.What();
+          continue;
+        }
+
+        std::string description = PluginToolbox::GetMainDicomTag(content, "MainDicomTags", "SeriesDescription");
+        if (description.empty())
+        {
+          description = PluginToolbox::GetMainDicomTag(content, "MainDicomTags", "ProtocolName");
+        }
+
+        int32_t seriesNumber = 0;
+        try
+        {
+          seriesNumber = boost::lexical_cast<int32_t>(PluginToolbox::GetMainDicomTag(content, "MainDicomTags", "SeriesNumber"));
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+        }
+
+        if (!dataset.AddSeries(series[j], sessions[i], PluginToolbox::GetMainDicomTag(content, "MainDicomTags", "Modality"),
+                               description, seriesNumber))
+        {
+          LOG(WARNING) << "Series " << series[j] << " is not part of the BIDS dataset, as its type is "
+                       << "unknown or not supported (diffusion): " << description;
+        }
+      }
+    }
+
+    std::vector<std::string> series(dataset.GetCountSeries());
+    std::vector<std::string> paths(dataset.GetCountSeries());
+
+    for (size_t i = 0; i < dataset.GetCountSeries(); i++)
+    {
+      series[i] = dataset.GetOrthancId(i);
+      paths[i] = dataset.GetPath(i);
+    }
+
+    Json::Value generatedBy = Json::objectValue;
+    generatedBy["Name"] = "Orthanc neuroimaging plugin";
+    generatedBy["Version"] = ORTHANC_PLUGIN_VERSION;
+
+    Json::Value description = Json::objectValue;
+    description["Name"] = "Orthanc export of subject " + subject;
+    description["BIDSVersion"] = "1.8.0";
+    description["DatasetType"] = "raw";
+    description["GeneratedBy"] = Json::arrayValue;
+    description["GeneratedBy"].append(generatedBy);
+
+    std::string json;
+    OrthancPlugins::WriteStyledJson(json, description);
+
+    Orthanc::ZipWriter zip;
+    BatchConverter::OpenArchive(zip, archive);
+    BatchConverter::AddFileToArchive(zip, "dataset_description.json", json.c_str(), json.size());
+    BatchConverter::AddSeriesToArchive(zip, converter, series, paths, true /* BIDS recommends ".nii.gz" */,
+                                       true /* sidecars */, countThreads);
+    zip.Close();
+  }
+}
@@ -0,0 +1,46 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "SeriesConverter.h"
+
+#include <string>
+#include <vector>
+
+
+namespace Neuro
+{
+  // Export of the series that are stored in Orthanc as a BIDS dataset
+  class BidsExporter
+  {
+  public:
+    /**
+     * Writes the series of the given studies, that must belong to the
+     * same patient, as a BIDS dataset into a ZIP "archive". Each study
+     * is a session, labeled by its date if possible. The session level
+     * is omitted if there is a single study. The series are converted
+     * by "countThreads" workers.
+     **/
+    static void CreateArchive(std::string& archive,
+                              const SeriesConverter& converter,
+                              const std::vector<std::string>& studies,
+                              unsigned int countThreads);
+  };
+}
@@ -0,0 +1,176 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "JobOutputs.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <cassert>
+
+
+namespace Neuro
+{
+  void JobOutputs::RemoveOldest()
+  {
+    // The mutex must be locked
+    assert(!order_.empty());
+
+    Content::iterator found = content_.find(order_.front());
+    assert(found != content_.end());
+    assert(currentSize_ >= found->second.file_->GetSize());
+
+    currentSize_ -= found->second.file_->GetSize();
+    content_.erase(found);
+    order_.pop_front();
+  }
+
+
+  void JobOutputs::RemoveExpired()
+  {
+    // The mutex must be locked. The outputs are sorted by expiration
+    // time, as they all share the same timeout.
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    while (!order_.empty() &&
+           content_.find(order_.front())->second.expiration_ <= now)
+    {
+      LOG(WARNING) << "Discarding the NIfTI file that was generated by a job, "
+                   << "as it was not downloaded before its timeout: " << order_.front();
+      RemoveOldest();
+    }
+  }
+
+
+  JobOutputs::JobOutputs() :
+    maxCount_(16),
+    maxSize_(4096llu * 1024llu * 1024llu),
+    currentSize_(0),
+    timeout_(boost::posix_time::hours(1))
+  {
+  }
+
+
+  void JobOutputs::SetLimits(size_t maxCount,
+                             uint64_t maxSize,
+                             unsigned int timeout)
+  {
+    if (maxCount == 0 ||
+        maxSize == 0 ||
+        timeout == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "The limits of the NIfTI files generated by jobs cannot be zero");
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    maxCount_ = maxCount;
+    maxSize_ = maxSize;
+    timeout_ = boost::posix_time::seconds(timeout);
+  }
+
+
+  std::string JobOutputs::Store(NiftiFile* file,
+                                const std::string& resourceId,
+                                bool compress)
+  {
+    Output output;
+    output.file_.reset(file);
+    output.resourceId_ = resourceId;
+    output.compress_ = compress;
+
+    const uint64_t size = output.file_->GetSize();
+    const std::string id = Orthanc::Toolbox::GenerateUuid();
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    RemoveExpired();
+
+    while (!order_.empty() &&
+           (content_.size() >= maxCount_ ||
+            currentSize_ + size > maxSize_))
+    {
+      LOG(WARNING) << "Discarding the NIfTI file that was generated by a job, "
+                   << "as it was not downloaded: " << order_.front();
+      RemoveOldest();
+    }
+
+    output.expiration_ = boost::posix_time::microsec_clock::universal_time() + timeout_;
+
+    content_[id] = output;
+    order_.push_back(id);
+    currentSize_ += size;
+
+    return id;
+  }
+
+
+  bool JobOutputs::Lookup(boost::shared_ptr<NiftiFile>& file,
+                          std::string& resourceId,
+                          bool& compress,
+                          const std::string& id)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    RemoveExpired();
+
+    Content::const_iterator found = content_.find(id);
+    if (found == content_.end())
+    {
+      return false;
+    }
+    else
+    {
+      file = found->second.file_;
+      resourceId = found->second.resourceId_;
+      compress = found->second.compress_;
+      return true;
+    }
+  }
+
+
+  bool JobOutputs::Remove(const std::string& id)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Content::iterator found = content_.find(id);
+    if (found == content_.end())
+    {
+      return false;
+    }
+    else
+    {
+      assert(currentSize_ >= found->second.file_->GetSize());
+      currentSize_ -= found->second.file_->GetSize();
+      content_.erase(found);
+      order_.remove(id);
+      return true;
+    }
+  }
+
+
+  void JobOutputs::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    content_.clear();
+    order_.clear();
+    currentSize_ = 0;
+  }
+}
@@ -0,0 +1,88 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "NiftiFile.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <list>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+
+namespace Neuro
+{
+  /**
+   * NIfTI files that were generated by jobs, until they are downloaded
+   * by the clients. Once the maximum number of files or their maximum
+   * total size is reached, the oldest files are discarded (the newest
+   * file is always kept). The files that are not downloaded within
+   * some timeout are discarded as well.
+   **/
+  class JobOutputs : public boost::noncopyable
+  {
+  private:
+    struct Output
+    {
+      boost::shared_ptr<NiftiFile>  file_;
+      std::string                   resourceId_;
+      bool                          compress_;
+      boost::posix_time::ptime      expiration_;
+    };
+
+    typedef std::map<std::string, Output>  Content;
+
+    boost::mutex                       mutex_;
+    Content                            content_;
+    std::list<std::string>             order_;  // From the oldest to the newest output
+    size_t                             maxCount_;
+    uint64_t                           maxSize_;
+    uint64_t                           currentSize_;
+    boost::posix_time::time_duration   timeout_;
+
+    void RemoveOldest();
+
+    void RemoveExpired();
+
+  public:
+    JobOutputs();
+
+    void SetLimits(size_t maxCount,
+                   uint64_t maxSize /* in bytes */,
+                   unsigned int timeout /* in seconds */);
+
+    std::string Store(NiftiFile* file,  // Takes ownership
+                      const std::string& resourceId,
+                      bool compress);
+
+    bool Lookup(boost::shared_ptr<NiftiFile>& file,
+                std::string& resourceId,
+                bool& compress,
+                const std::string& id);
+
+    bool Remove(const std::string& id);
+
+    void Clear();
+  };
+}
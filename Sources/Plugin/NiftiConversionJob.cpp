@@ -0,0 +1,275 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "NiftiConversionJob.h"
+
+#include "PluginToolbox.h"
+
+#include <Logging.h>
+
+#include <algorithm>
+#include <cassert>
+#include <string.h>
+
+
+namespace Neuro
+{
+  void NiftiConversionJob::SignalProgress(size_t position)
+  {
+    // The last percent corresponds to the finalization of the file
+    const float progress = (fileSize_ == 0 ? 0.0f : static_cast<float>(position) / static_cast<float>(fileSize_));
+    UpdateProgress(std::min(0.99f, progress));
+  }
+
+
+  void NiftiConversionJob::Release()
+  {
+    // The writer and the streams must be destroyed before the file they write to
+    decoder_.reset();
+    writer_.reset();
+    parallelGzip_.reset();
+    gzip_.reset();
+    stream_.reset();
+    file_.reset();
+    slices_.clear();
+    collection_.reset();
+  }
+
+
+  void NiftiConversionJob::UpdateContent(const std::string& output,
+                                         const std::string& errorDescription)
+  {
+    Json::Value content = Json::objectValue;
+    content["Series"] = seriesId_;
+    content["Compress"] = compress_;
+
+    if (collection_.get() != NULL)
+    {
+      content["CountSlices"] = static_cast<Json::UInt64>(slices_.size());
+      content["DecodedSlices"] = static_cast<Json::UInt64>(nextSlice_);
+      content["UncompressedSize"] = static_cast<Json::UInt64>(fileSize_);
+    }
+
+    if (!output.empty())
+    {
+      content["Output"] = output;
+      content["OutputPath"] = "/neuro/outputs/" + output;
+    }
+
+    if (!errorDescription.empty())
+    {
+      content["ErrorDescription"] = errorDescription;
+    }
+
+    OrthancJob::UpdateContent(content);
+  }
+
+
+  void NiftiConversionJob::Initialize()
+  {
+    std::vector<std::string> instances;
+    PluginToolbox::GetSeriesInstances(instances, seriesId_);
+
+    collection_.reset(new DicomInstancesCollection);
+    converter_.LoadSeries(*collection_, seriesId_, instances);
+
+    SeriesConverter::CreateNiftiHeader(header_, slices_, *collection_, slicesRange_, volumesRange_);
+
+    fileSize_ = NiftiWriter::ComputeFileSize(header_);
+    nextSlice_ = 0;
+    file_.reset(new NiftiFile);
+
+    if (compress_)
+    {
+      stream_.reset(new StringOutputStream(file_->GetMemory()));
+
+      if (converter_.GetCompressionThreads() > 1)
+      {
+        parallelGzip_.reset(new ParallelGzipOutputStream(*stream_, converter_.GetCompressionLevel(),
+                                                         converter_.GetCompressionThreads()));
+        writer_.reset(new NiftiWriter(*parallelGzip_));
+      }
+      else
+      {
+        gzip_.reset(new GzipOutputStream(*stream_, converter_.GetCompressionLevel()));
+        writer_.reset(new NiftiWriter(*gzip_));
+      }
+    }
+    else
+    {
+      PluginToolbox::CheckAnswerSize(fileSize_);
+      writer_.reset(new NiftiWriter(converter_.AllocateNifti(*file_, fileSize_), fileSize_));
+    }
+
+    writer_->SetProgressListener(*this);
+    writer_->WriteHeader(header_);
+  }
+
+
+  void NiftiConversionJob::DecodeNextSlices()
+  {
+    assert(nextSlice_ < slices_.size());
+
+    // The slices that are extracted from the same frame (e.g. mosaics) are decoded by the same step
+    size_t end = std::min(nextSlice_ + STEP_SLICES, slices_.size());
+    while (end < slices_.size() &&
+           slices_[end].GetInstanceIndexInCollection() == slices_[end - 1].GetInstanceIndexInCollection() &&
+           slices_[end].GetFrameNumber() == slices_[end - 1].GetFrameNumber())
+    {
+      end++;
+    }
+
+    const std::vector<Slice> batch(slices_.begin() + nextSlice_, slices_.begin() + end);
+
+    if (converter_.GetDecodingThreads() > 1)
+    {
+      PluginFrameDecoder::Factory factory(*collection_, converter_.IsRawFrames(), converter_.GetInstanceCacheSize());
+      IDicomFrameDecoder::Apply(*writer_, factory, batch, converter_.GetDecodingThreads(), converter_.GetFrameCacheSize());
+    }
+    else
+    {
+      // The decoder is kept between the steps, as it caches the current instance
+      if (decoder_.get() == NULL)
+      {
+        decoder_.reset(new PluginFrameDecoder(*collection_, converter_.IsRawFrames(), converter_.GetInstanceCacheSize()));
+      }
+
+      IDicomFrameDecoder::Apply(*writer_, *decoder_, batch, converter_.GetFrameCacheSize());
+    }
+
+    nextSlice_ = end;
+  }
+
+
+  std::string NiftiConversionJob::Finalize()
+  {
+    if (parallelGzip_.get() != NULL)
+    {
+      parallelGzip_->Finish();
+    }
+    else if (gzip_.get() != NULL)
+    {
+      gzip_->Finish();
+    }
+    else if (writer_->GetPosition() != fileSize_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                      "The NIfTI file is smaller than expected");
+    }
+
+    decoder_.reset();
+    writer_.reset();
+    parallelGzip_.reset();
+    gzip_.reset();
+    stream_.reset();
+
+    return outputs_.Store(file_.release(), seriesId_, compress_);
+  }
+
+
+  NiftiConversionJob::NiftiConversionJob(const SeriesConverter& converter,
+                                         JobOutputs& outputs,
+                                         const std::string& seriesId,
+                                         bool compress,
+                                         const std::string& slicesRange,
+                                         const std::string& volumesRange) :
+    OrthancJob("NiftiConversion"),
+    converter_(converter),
+    outputs_(outputs),
+    seriesId_(seriesId),
+    compress_(compress),
+    slicesRange_(slicesRange),
+    volumesRange_(volumesRange),
+    fileSize_(0),
+    nextSlice_(0)
+  {
+    memset(&header_, 0, sizeof(header_));
+    UpdateContent("", "");
+  }
+
+
+  OrthancPluginJobStepStatus NiftiConversionJob::Step()
+  {
+    try
+    {
+      if (collection_.get() == NULL)
+      {
+        Initialize();
+        UpdateContent("", "");
+        return OrthancPluginJobStepStatus_Continue;
+      }
+      else if (nextSlice_ < slices_.size())
+      {
+        DecodeNextSlices();
+        UpdateContent("", "");
+        return OrthancPluginJobStepStatus_Continue;
+      }
+      else
+      {
+        const std::string output = Finalize();
+        UpdateContent(output, "");
+        Release();
+        UpdateProgress(1);
+        return OrthancPluginJobStepStatus_Success;
+      }
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Cannot convert series " << seriesId_ << " to NIfTI: " << e.What();
+      UpdateContent("", e.What());
+      Release();
+      return OrthancPluginJobStepStatus_Failure;
+    }
+    catch (std::exception& e)
+    {
+      // For instance, "std::bad_alloc" for very large volumes
+      LOG(ERROR) << "Cannot convert series " << seriesId_ << " to NIfTI: " << e.what();
+      UpdateContent("", e.what());
+      Release();
+      return OrthancPluginJobStepStatus_Failure;
+    }
+    catch (...)
+    {
+      LOG(ERROR) << "Native exception while converting series " << seriesId_ << " to NIfTI";
+      UpdateContent("", "Native exception");
+      Release();
+      return OrthancPluginJobStepStatus_Failure;
+    }
+  }
+
+
+  void NiftiConversionJob::Stop(OrthancPluginJobStopReason reason)
+  {
+    if (reason != OrthancPluginJobStopReason_Paused)
+    {
+      // The partial file is only kept if the job will be resumed
+      Release();
+    }
+  }
+
+
+  void NiftiConversionJob::Reset()
+  {
+    Release();
+    fileSize_ = 0;
+    nextSlice_ = 0;
+    UpdateProgress(0);
+    UpdateContent("", "");
+  }
+}
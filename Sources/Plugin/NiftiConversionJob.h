@@ -0,0 +1,99 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "JobOutputs.h"
+#include "PluginFrameDecoder.h"
+#include "SeriesConverter.h"
+
+#include "../Framework/GzipOutputStream.h"
+#include "../Framework/ParallelGzipOutputStream.h"
+#include "../Framework/StringOutputStream.h"
+
+#include "../../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+
+namespace Neuro
+{
+  /**
+   * Job that converts a series to NIfTI in the background, so that the
+   * HTTP threads of Orthanc are not blocked by large series. Each step
+   * decodes a batch of slices, which allows the job engine to pause or
+   * to cancel the conversion between two batches. The progress is
+   * updated after each slice. The resulting file is stored into
+   * "outputs" once the job has succeeded.
+   **/
+  class NiftiConversionJob :
+    public OrthancPlugins::OrthancJob,
+    private NiftiWriter::IProgressListener
+  {
+  private:
+    // Minimum number of slices that are decoded by one step
+    static const size_t STEP_SLICES = 32;
+
+    const SeriesConverter&  converter_;
+    JobOutputs&             outputs_;
+    std::string             seriesId_;
+    bool                    compress_;
+    std::string             slicesRange_;
+    std::string             volumesRange_;
+
+    // State of the conversion, which is kept from one step to the next
+    std::unique_ptr<DicomInstancesCollection>   collection_;
+    nifti_image                                 header_;
+    std::vector<Slice>                          slices_;
+    size_t                                      fileSize_;
+    size_t                                      nextSlice_;
+    std::unique_ptr<NiftiFile>                  file_;
+    std::unique_ptr<StringOutputStream>         stream_;
+    std::unique_ptr<GzipOutputStream>           gzip_;
+    std::unique_ptr<ParallelGzipOutputStream>   parallelGzip_;
+    std::unique_ptr<NiftiWriter>                writer_;
+    std::unique_ptr<PluginFrameDecoder>         decoder_;
+
+    virtual void SignalProgress(size_t position) ORTHANC_OVERRIDE;
+
+    void Release();
+
+    void UpdateContent(const std::string& output,
+                       const std::string& errorDescription);
+
+    void Initialize();
+
+    void DecodeNextSlices();
+
+    std::string Finalize();
+
+  public:
+    // The "converter" and the "outputs" must outlive the job
+    NiftiConversionJob(const SeriesConverter& converter,
+                       JobOutputs& outputs,
+                       const std::string& seriesId,
+                       bool compress,
+                       const std::string& slicesRange,
+                       const std::string& volumesRange);
+
+    virtual OrthancPluginJobStepStatus Step() ORTHANC_OVERRIDE;
+
+    virtual void Stop(OrthancPluginJobStopReason reason) ORTHANC_OVERRIDE;
+
+    virtual void Reset() ORTHANC_OVERRIDE;
+  };
+}
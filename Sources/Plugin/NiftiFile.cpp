@@ -0,0 +1,83 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "NiftiFile.h"
+
+
+namespace Neuro
+{
+  std::string& NiftiFile::GetMemory()
+  {
+    mapped_.reset();
+    cached_.reset();
+    return memory_;
+  }
+
+
+  void* NiftiFile::CreateMappedFile(const std::string& directory,
+                                    size_t size)
+  {
+    memory_.clear();
+    cached_.reset();
+    mapped_.reset(new MappedTemporaryFile(directory, size));
+    return mapped_->GetData();
+  }
+
+
+  std::unique_ptr<MappedFile>& NiftiFile::GetCachedFile()
+  {
+    memory_.clear();
+    mapped_.reset();
+    return cached_;
+  }
+
+
+  const void* NiftiFile::GetData() const
+  {
+    if (cached_.get() != NULL)
+    {
+      return cached_->GetData();
+    }
+    else if (mapped_.get() != NULL)
+    {
+      return mapped_->GetData();
+    }
+    else
+    {
+      return memory_.empty() ? NULL : memory_.c_str();
+    }
+  }
+
+
+  size_t NiftiFile::GetSize() const
+  {
+    if (cached_.get() != NULL)
+    {
+      return cached_->GetSize();
+    }
+    else if (mapped_.get() != NULL)
+    {
+      return mapped_->GetSize();
+    }
+    else
+    {
+      return memory_.size();
+    }
+  }
+}
@@ -0,0 +1,58 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../Framework/MappedFile.h"
+#include "../Framework/MappedTemporaryFile.h"
+
+#include <boost/noncopyable.hpp>
+#include <memory>
+#include <string>
+
+
+namespace Neuro
+{
+  /**
+   * Content of a NIfTI file that is sent to the client. It is either
+   * stored in memory, in a temporary file that is mapped into memory
+   * (which bounds the memory usage of the plugin for very large
+   * volumes), or in a file of the cache that is mapped read-only.
+   **/
+  class NiftiFile : public boost::noncopyable
+  {
+  private:
+    std::string                           memory_;
+    std::unique_ptr<MappedTemporaryFile>  mapped_;
+    std::unique_ptr<MappedFile>           cached_;
+
+  public:
+    std::string& GetMemory();
+
+    // If "directory" is empty, the default temporary directory of the system is used
+    void* CreateMappedFile(const std::string& directory,
+                           size_t size);
+
+    std::unique_ptr<MappedFile>& GetCachedFile();
+
+    const void* GetData() const;
+
+    size_t GetSize() const;
+  };
+}
@@ -17,164 +17,463 @@
  **/
 
 
+#include "BatchConverter.h"
+#include "BidsExporter.h"
+#include "JobOutputs.h"
+#include "NiftiConversionJob.h"
 #include "PluginFrameDecoder.h"
+#include "PluginToolbox.h"
+#include "SeriesConverter.h"
+#include "SeriesPrecomputer.h"
 
 #include "../Framework/NeuroToolbox.h"
-#include "../Framework/NiftiWriter.h"
 
 #include <EmbeddedResources.h>
 
+#include <Compression/ZipWriter.h>
 #include <Logging.h>
 #include <SystemToolbox.h>
 
+#include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+#include <cassert>
+
 #define ORTHANC_PLUGIN_NAME  "neuro"
 
+// Whether the "206 Partial Content" answers can be sent (depends on "HttpDescribeErrors")
+static bool  partialContent_ = true;
+
+// Number of series that are converted concurrently by the batch routes
+static unsigned int  batchThreads_ = 1;
+
+// Number of threads converting the stable series in the background (if enabled)
+static unsigned int  precomputeThreads_ = 1;
+
+// Conversion of the series, with the parameters of the "Neuro" configuration section
+static std::unique_ptr<Neuro::SeriesConverter>  converter_;
+
+// NIfTI files generated by jobs, until they are downloaded
+static Neuro::JobOutputs  jobOutputs_;
+
+// Optional background conversion of the stable series
+static std::unique_ptr<Neuro::SeriesPrecomputer>  precomputer_;
+
+
+static bool HasBooleanFlag(const OrthancPluginHttpRequest* request,
+                           const std::string& flag)
+{
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    if (std::string(request->getKeys[i]) == flag)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+static bool LookupHttpHeader(std::string& value,
+                             const OrthancPluginHttpRequest* request,
+                             const std::string& key /* lower case */)
+{
+  for (uint32_t i = 0; i < request->headersCount; i++)
+  {
+    if (std::string(request->headersKeys[i]) == key)
+    {
+      value = request->headersValues[i];
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+static bool LookupGetArgument(std::string& value,
+                              const OrthancPluginHttpRequest* request,
+                              const std::string& key)
+{
+  for (uint32_t i = 0; i < request->getCount; i++)
+  {
+    if (std::string(request->getKeys[i]) == key)
+    {
+      value = request->getValues[i];
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+static bool HasSubVolume(const OrthancPluginHttpRequest* request)
+{
+  std::string value;
+  return (LookupGetArgument(value, request, "slices") ||
+          LookupGetArgument(value, request, "volumes"));
+}
+
+
+// Sub-volume given by the "slices" and "volumes" GET arguments (if any)
+static void CreateNiftiHeader(nifti_image& nifti,
+                              std::vector<Neuro::Slice>& slices,
+                              const Neuro::DicomInstancesCollection& collection,
+                              const OrthancPluginHttpRequest* request)
+{
+  std::string slicesRange, volumesRange;
+  LookupGetArgument(slicesRange, request, "slices");
+  LookupGetArgument(volumesRange, request, "volumes");
+
+  Neuro::SeriesConverter::CreateNiftiHeader(nifti, slices, collection, slicesRange, volumesRange);
+}
+
 
-static void CreateNifti(std::string& target,
-                        const Neuro::DicomInstancesCollection& collection,
+static void AnswerNifti(OrthancPluginRestOutput* output,
+                        const std::string& resourceId,
+                        const Neuro::NiftiFile& nifti,
                         bool compress)
 {
-  nifti_image nifti;
-  std::vector<Neuro::Slice> slices;
-  collection.CreateNiftiHeader(nifti, slices);
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  Neuro::PluginToolbox::CheckAnswerSize(nifti.GetSize());
 
-  Neuro::NiftiWriter writer;
-  writer.WriteHeader(nifti);
+  std::string filename = resourceId + ".nii";
+  if (compress)
+  {
+    filename += ".gz";
+  }
+    
+  const std::string contentDisposition = "filename=\"" + filename + "\"";
+  OrthancPluginSetHttpHeader(context, output, "Content-Disposition", contentDisposition.c_str());
 
-  Neuro::PluginFrameDecoder decoder(collection);
-  Neuro::IDicomFrameDecoder::Apply(writer, decoder, slices);
+  if (!compress &&
+      partialContent_)
+  {
+    OrthancPluginSetHttpHeader(context, output, "Accept-Ranges", "bytes");
+  }
   
-  writer.Flatten(target, compress);
+  OrthancPluginAnswerBuffer(context, output, nifti.GetData(), static_cast<uint32_t>(nifti.GetSize()), "application/octet-stream");
+}
+
+
+/**
+ * Sends the bytes "[start, end)" of an uncompressed NIfTI file of
+ * "fileSize" bytes, whose content is available in "data". The plugin
+ * SDK has no dedicated primitive for partial content, so the "206"
+ * status is sent together with its body. The Orthanc core only sends
+ * this body if "HttpDescribeErrors" is enabled: This function must
+ * not be called otherwise (cf. "partialContent_").
+ **/
+static void AnswerPartialNifti(OrthancPluginRestOutput* output,
+                               const std::string& resourceId,
+                               const char* data,
+                               uint64_t start,
+                               uint64_t end,
+                               uint64_t fileSize)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  assert(partialContent_);
+  Neuro::PluginToolbox::CheckAnswerSize(static_cast<size_t>(end - start));
+
+  const std::string contentDisposition = "filename=\"" + resourceId + ".nii\"";
+  const std::string contentRange = ("bytes " + boost::lexical_cast<std::string>(start) + "-" +
+                                    boost::lexical_cast<std::string>(end - 1) + "/" +
+                                    boost::lexical_cast<std::string>(fileSize));
+
+  OrthancPluginSetHttpHeader(context, output, "Content-Disposition", contentDisposition.c_str());
+  OrthancPluginSetHttpHeader(context, output, "Content-Range", contentRange.c_str());
+  OrthancPluginSetHttpHeader(context, output, "Content-Type", "application/octet-stream");
+  OrthancPluginSetHttpHeader(context, output, "Accept-Ranges", "bytes");
+
+  OrthancPluginSendHttpStatus(context, output, 206 /* Partial Content */, data, static_cast<uint32_t>(end - start));
 }
 
 
-static Neuro::InputDicomInstance* AcquireInstance(const std::string& instanceId)
+static void AnswerUnsatisfiableRange(OrthancPluginRestOutput* output,
+                                     uint64_t fileSize)
 {
-#if 0
-  /**
-   * This version uses DCMTK. It should be avoided for performance, as
-   * it requires reading the entire DICOM files from the disk, whereas
-   * "OrthancPluginDicomInstanceToJson()" will only read the DICOM
-   * files up to pixel data, and will take advantage of the caching
-   * mechanisms implemented inside the Orthanc core.
-   **/
-  OrthancPlugins::MemoryBuffer dicom;
-  dicom.GetDicomInstance(instanceId);
-
-  Orthanc::ParsedDicomFile parsed(dicom.GetData(), dicom.GetSize());
-  return new Neuro::InputDicomInstance(parsed);
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  const std::string contentRange = "bytes */" + boost::lexical_cast<std::string>(fileSize);
+  OrthancPluginSetHttpHeader(context, output, "Content-Range", contentRange.c_str());
+  OrthancPluginSendHttpStatusCode(context, output, 416 /* Range Not Satisfiable */);
+}
+
+
+static void AnswerArchive(OrthancPluginRestOutput* output,
+                          const std::string& filename,
+                          const std::string& archive)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  Neuro::PluginToolbox::CheckAnswerSize(archive.size());
+
+  const std::string contentDisposition = "filename=\"" + filename + "\"";
+  OrthancPluginSetHttpHeader(context, output, "Content-Disposition", contentDisposition.c_str());
   
-#else
-  Orthanc::DicomMap tags;
+  OrthancPluginAnswerBuffer(context, output, archive.c_str(), static_cast<uint32_t>(archive.size()), "application/zip");
+}
+
+
+// The NIfTI files are named after the Orthanc identifiers of the series
+static void AnswerNiftiArchive(OrthancPluginRestOutput* output,
+                               const std::string& filename,
+                               const std::vector<std::string>& series,
+                               bool compress)
+{
+  std::string archive;
+
+  {
+    Orthanc::ZipWriter zip;
+    Neuro::BatchConverter::OpenArchive(zip, archive);
+    Neuro::BatchConverter::AddSeriesToArchive(zip, *converter_, series, series, compress,
+                                              false /* no sidecar */, batchThreads_);
+    zip.Close();
+  }
+
+  AnswerArchive(output, filename, archive);
+}
+
+
+// The studies must belong to the same patient (cf. "Neuro::BidsExporter")
+static void AnswerBidsArchive(OrthancPluginRestOutput* output,
+                              const std::string& filename,
+                              const std::vector<std::string>& studies)
+{
+  std::string archive;
+  Neuro::BidsExporter::CreateArchive(archive, *converter_, studies, batchThreads_);
+
+  AnswerArchive(output, filename, archive);
+}
+
 
+static void SubmitNiftiConversionJob(OrthancPluginRestOutput* output,
+                                     const std::string& seriesId,
+                                     const OrthancPluginHttpRequest* request)
+{
+  static const char* const KEY_COMPRESS = "Compress";
+  static const char* const KEY_SLICES = "Slices";
+  static const char* const KEY_VOLUMES = "Volumes";
+
+  Json::Value body;
+  if (request->bodySize == 0)
+  {
+    body = Json::objectValue;
+  }
+  else if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+           body.type() != Json::objectValue)
   {
-    OrthancPlugins::OrthancString s;
-    s.Assign(OrthancPluginDicomInstanceToJson(
-               OrthancPlugins::GetGlobalContext(), instanceId.c_str(), OrthancPluginDicomToJsonFormat_Full,
-               static_cast<OrthancPluginDicomToJsonFlags>(OrthancPluginDicomToJsonFlags_IncludePrivateTags |
-                                                          OrthancPluginDicomToJsonFlags_IncludeUnknownTags |
-                                                          OrthancPluginDicomToJsonFlags_StopAfterPixelData |
-                                                          OrthancPluginDicomToJsonFlags_SkipGroupLengths), 0));
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat, "Expected a JSON object in the body");
+  }
 
-    Json::Value json;
-    if (s.GetContent() == NULL ||
-        !OrthancPlugins::ReadJson(json, s.GetContent()))
+  bool compress = false;
+  if (body.isMember(KEY_COMPRESS))
+  {
+    if (body[KEY_COMPRESS].type() != Json::booleanValue)
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem, "Missing instance: " + instanceId);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Option \"" + std::string(KEY_COMPRESS) + "\" must be Boolean");
+    }
+
+    compress = body[KEY_COMPRESS].asBool();
+  }
+
+  std::string ranges[2];
+  const char* const keys[2] = { KEY_SLICES, KEY_VOLUMES };
+
+  for (size_t i = 0; i < 2; i++)
+  {
+    if (body.isMember(keys[i]))
+    {
+      if (body[keys[i]].type() != Json::stringValue)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "Option \"" + std::string(keys[i]) + "\" must be a string");
+      }
+
+      ranges[i] = body[keys[i]].asString();
     }
-    
-    tags.FromDicomAsJson(json);
   }
 
-  std::unique_ptr<Neuro::InputDicomInstance> instance(new Neuro::InputDicomInstance(tags));
+  // Follows the "Synchronous", "Asynchronous" and "Priority" conventions of the Orthanc core
+  OrthancPlugins::OrthancJob::SubmitFromRestApiPost(
+    output, body, new Neuro::NiftiConversionJob(*converter_, jobOutputs_, seriesId, compress, ranges[0], ranges[1]));
+}
+
+
+void SeriesToNifti(OrthancPluginRestOutput* output,
+                   const char* url,
+                   const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
   
-  switch (instance->GetManufacturer())
+  if (request->method == OrthancPluginHttpMethod_Post)
+  {
+    SubmitNiftiConversionJob(output, request->groups[0], request);
+  }
+  else if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET,POST");
+  }
+  else
   {
-    case Neuro::Manufacturer_Siemens:
+    const std::string seriesId(request->groups[0]);
+    const bool compress = HasBooleanFlag(request, "compress");
+
+    std::vector<std::string> instances;
+    Neuro::PluginToolbox::GetSeriesInstances(instances, seriesId);
+
+    // Byte ranges are only available for uncompressed files, whose size is known in advance.
+    // If partial content cannot be sent, the "Range" header is ignored, and the full file is sent.
+    std::string range;
+    const bool hasRange = (!compress && partialContent_ && LookupHttpHeader(range, request, "range"));
+
+    // Only the full series are cached
+    const bool useCache = (converter_->HasCache() && !HasSubVolume(request));
+
+    std::string fingerprint;
+    Neuro::NiftiFile nifti;
+
+    if (useCache)
     {
-      std::string csa;
-      if (OrthancPlugins::RestApiGetString(csa, "/instances/" + instanceId + "/content/" +
-                                           Neuro::DICOM_TAG_SIEMENS_CSA_HEADER.Format(), false))
+      Neuro::NiftiCache::ComputeFingerprint(fingerprint, instances);
+
+      if (converter_->GetCache().Lookup(nifti.GetCachedFile(), seriesId, fingerprint, compress))
       {
-        instance->GetCSAHeader().Load(csa);
+        uint64_t start, end;
+
+        switch (hasRange ? Neuro::NeuroToolbox::ParseHttpRange(start, end, range, nifti.GetSize()) :
+                Neuro::HttpRange_Ignored)
+        {
+          case Neuro::HttpRange_Satisfiable:
+            AnswerPartialNifti(output, seriesId, reinterpret_cast<const char*>(nifti.GetData()) + start,
+                               start, end, nifti.GetSize());
+            break;
+
+          case Neuro::HttpRange_Unsatisfiable:
+            AnswerUnsatisfiableRange(output, nifti.GetSize());
+            break;
+
+          default:
+            AnswerNifti(output, seriesId, nifti, compress);
+            break;
+        }
+
+        return;
       }
-      break;
     }
 
-    case Neuro::Manufacturer_UIH:
+    Neuro::DicomInstancesCollection collection;
+    converter_->LoadSeries(collection, seriesId, instances);
+
+    nifti_image header;
+    std::vector<Neuro::Slice> slices;
+    CreateNiftiHeader(header, slices, collection, request);
+
+    if (!compress)
     {
-      const std::string uri = "/instances/" + instanceId + "/content/" + Neuro::DICOM_TAG_UIH_MR_VFRAME_SEQUENCE.Format();
-      
-      Json::Value uih;
-      if (OrthancPlugins::RestApiGet(uih, uri, false) &&
-          uih.type() == Json::arrayValue)
+      const size_t size = Neuro::NiftiWriter::ComputeFileSize(header);
+
+      uint64_t start, end;
+
+      switch (hasRange ? Neuro::NeuroToolbox::ParseHttpRange(start, end, range, size) :
+              Neuro::HttpRange_Ignored)
       {
-        for (Json::Value::ArrayIndex i = 0; i < uih.size(); i++)
+        case Neuro::HttpRange_Satisfiable:
         {
-          Json::Value tags2;
+          // Only the slices that overlap the range are decoded, and the result is not cached
+          std::string partial;
+          size_t offset;
+          converter_->CreatePartialNifti(partial, offset, header, slices, collection, start, end);
 
-          if (uih[i].type() != Json::stringValue ||
-              !OrthancPlugins::RestApiGet(tags2, uri + "/" + uih[i].asString(), false) ||
-              tags2.type() != Json::arrayValue)
+          if (offset + (end - start) > partial.size())
           {
             throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
           }
 
-          Orthanc::DicomMap m;
+          AnswerPartialNifti(output, seriesId, partial.c_str() + offset, start, end, size);
+          return;
+        }
 
-          for (Json::Value::ArrayIndex j = 0; j < tags2.size(); j++)
-          {
-            Orthanc::DicomTag tag(0, 0);
-            std::string value;
-            
-            if (tags2[j].type() != Json::stringValue ||
-                !Orthanc::DicomTag::ParseHexadecimal(tag, tags2[j].asCString()) ||
-                !OrthancPlugins::RestApiGetString(value, uri + "/" + uih[i].asString() + "/" + tags2[j].asString(), false))
-            {
-              throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-            }
-            else
-            {
-              m.SetValue(tag, value, false);
-            }
-          }
+        case Neuro::HttpRange_Unsatisfiable:
+          AnswerUnsatisfiableRange(output, size);
+          return;
 
-          instance->AddUIHFrameSequenceItem(m);
-        }
+        default:
+          // Fail before decoding the frames if the answer cannot be sent
+          Neuro::PluginToolbox::CheckAnswerSize(size);
+          break;
       }
-      break;
     }
 
-    default:
-      break;
-  }
+    converter_->CreateNifti(nifti, header, slices, collection, compress, NULL /* no listener */);
+
+    if (useCache)
+    {
+      converter_->StoreInCache(seriesId, fingerprint, compress, nifti);
+    }
 
-  return instance.release();
-#endif
+    AnswerNifti(output, seriesId, nifti, compress);
+  }
 }
 
 
-static bool HasBooleanFlag(const OrthancPluginHttpRequest* request,
-                           const std::string& flag)
+/**
+ * The Orthanc core doesn't forward HTTP HEAD requests to the plugins,
+ * so the size of the uncompressed NIfTI file is published by a
+ * separate route. This size is computed from the DICOM tags only,
+ * without decoding any frame.
+ **/
+void SeriesToNiftiSize(OrthancPluginRestOutput* output,
+                       const char* url,
+                       const OrthancPluginHttpRequest* request)
 {
-  for (uint32_t i = 0; i < request->getCount; i++)
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+  
+  if (request->method != OrthancPluginHttpMethod_Get)
   {
-    if (std::string(request->getKeys[i]) == flag)
-    {
-      return true;
-    }
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
   }
+  else
+  {
+    const std::string seriesId(request->groups[0]);
 
-  return false;
+    std::vector<std::string> instances;
+    Neuro::PluginToolbox::GetSeriesInstances(instances, seriesId);
+
+    Neuro::DicomInstancesCollection collection;
+    converter_->LoadSeries(collection, seriesId, instances);
+
+    nifti_image header;
+    std::vector<Neuro::Slice> slices;
+    CreateNiftiHeader(header, slices, collection, request);
+
+    const size_t size = Neuro::NiftiWriter::ComputeFileSize(header);
+
+    Json::Value answer = Json::objectValue;
+    answer["Size"] = static_cast<Json::UInt64>(size);
+    answer["HeaderSize"] = static_cast<Json::UInt64>(Neuro::NiftiWriter::GetHeaderSize());
+    answer["Filename"] = seriesId + ".nii";
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
 }
 
 
-void SeriesToNifti(OrthancPluginRestOutput* output,
-                   const char* url,
-                   const OrthancPluginHttpRequest* request)
+/**
+ * JSON sidecar of the NIfTI file, with the same fields as dcm2niix
+ * (e.g. echo time, repetition time, slice timing, multiband factor
+ * and phase encoding direction), computed from the DICOM tags that
+ * are read to create the NIfTI header.
+ **/
+void SeriesToNiftiJson(OrthancPluginRestOutput* output,
+                       const char* url,
+                       const OrthancPluginHttpRequest* request)
 {
-  static const char* const KEY_INSTANCES = "Instances";
-
   OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
   
   if (request->method != OrthancPluginHttpMethod_Get)
@@ -185,49 +484,74 @@ void SeriesToNifti(OrthancPluginRestOutput* output,
   {
     const std::string seriesId(request->groups[0]);
 
-    Json::Value series;
-    if (!OrthancPlugins::RestApiGet(series, "/series/" + seriesId, false))
-    {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem, "Missing series: " + seriesId);
-    }
+    std::vector<std::string> instances;
+    Neuro::PluginToolbox::GetSeriesInstances(instances, seriesId);
+
+    Neuro::DicomInstancesCollection collection;
+    converter_->LoadSeries(collection, seriesId, instances);
+
+    nifti_image header;
+    std::vector<Neuro::Slice> slices;
+    CreateNiftiHeader(header, slices, collection, request);
+
+    Json::Value answer;
+    Neuro::SeriesConverter::FormatSidecar(answer, collection, header, slices);
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+}
 
-    if (series.type() != Json::objectValue ||
-        !series.isMember(KEY_INSTANCES) ||
-        series[KEY_INSTANCES].type() != Json::arrayValue)
-    {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-    }
+
+/**
+ * Only the DICOM tags are read to create the NIfTI header, which is
+ * returned as the first 352 bytes of the NIfTI file, or as JSON if
+ * the "json" flag is provided.
+ **/
+void SeriesToNiftiHeader(OrthancPluginRestOutput* output,
+                         const char* url,
+                         const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+  
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+  }
+  else
+  {
+    const std::string seriesId(request->groups[0]);
+
+    std::vector<std::string> instances;
+    Neuro::PluginToolbox::GetSeriesInstances(instances, seriesId);
 
     Neuro::DicomInstancesCollection collection;
+    converter_->LoadSeries(collection, seriesId, instances);
+
+    nifti_image header;
+    std::vector<Neuro::Slice> slices;
+    CreateNiftiHeader(header, slices, collection, request);
 
-    for (Json::Value::ArrayIndex i = 0; i < series[KEY_INSTANCES].size(); i++)
+    if (HasBooleanFlag(request, "json"))
     {
-      if (series[KEY_INSTANCES][i].type() != Json::stringValue)
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-      }
-      else
-      {
-        const std::string id = series[KEY_INSTANCES][i].asString();
-        collection.AddInstance(AcquireInstance(id), id);
-      }
+      Json::Value answer;
+      Neuro::NiftiWriter::FormatHeader(answer, header);
+      OrthancPlugins::AnswerJson(answer, output);
     }
+    else
+    {
+      std::string serialized;
 
-    const bool compress = HasBooleanFlag(request, "compress");
+      {
+        Neuro::NiftiWriter writer;
+        writer.WriteHeader(header);
+        writer.Flatten(serialized, false);
+      }
 
-    std::string nifti;
-    CreateNifti(nifti, collection, compress);
+      const std::string contentDisposition = "filename=\"" + seriesId + ".nii\"";
+      OrthancPluginSetHttpHeader(context, output, "Content-Disposition", contentDisposition.c_str());
 
-    std::string filename = seriesId + ".nii";
-    if (compress)
-    {
-      filename += ".gz";
+      OrthancPluginAnswerBuffer(context, output, serialized.c_str(), static_cast<uint32_t>(serialized.size()),
+                                "application/octet-stream");
     }
-    
-    const std::string contentDisposition = "filename=\"" + filename + "\"";
-    OrthancPluginSetHttpHeader(context, output, "Content-Disposition", contentDisposition.c_str());
-  
-    OrthancPluginAnswerBuffer(context, output, nifti.c_str(), nifti.size(), "application/octet-stream");
   }
 }
 
@@ -247,23 +571,275 @@ void InstanceToNifti(OrthancPluginRestOutput* output,
     const std::string instanceId(request->groups[0]);
 
     Neuro::DicomInstancesCollection collection;
-    collection.AddInstance(AcquireInstance(instanceId), instanceId);
+    collection.AddInstance(converter_->AcquireInstance(instanceId), instanceId);
+
+    nifti_image header;
+    std::vector<Neuro::Slice> slices;
+    CreateNiftiHeader(header, slices, collection, request);
 
     const bool compress = HasBooleanFlag(request, "compress");
+    if (!compress)
+    {
+      Neuro::PluginToolbox::CheckAnswerSize(Neuro::NiftiWriter::ComputeFileSize(header));
+    }
+
+    Neuro::NiftiFile nifti;
+    converter_->CreateNifti(nifti, header, slices, collection, compress, NULL /* no listener */);
+
+    AnswerNifti(output, instanceId, nifti, compress);
+  }
+}
+
+
+void StudyToNifti(OrthancPluginRestOutput* output,
+                  const char* url,
+                  const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+  
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+  }
+  else
+  {
+    const std::string studyId(request->groups[0]);
+
+    std::vector<std::string> series;
+    Neuro::PluginToolbox::GetChildResources(series, "/studies/" + studyId, "Series");
+
+    AnswerNiftiArchive(output, studyId + ".zip", series, HasBooleanFlag(request, "compress"));
+  }
+}
 
-    std::string nifti;
-    CreateNifti(nifti, collection, compress);
 
-    std::string filename = instanceId + ".nii";
-    if (compress)
+void StudyToBids(OrthancPluginRestOutput* output,
+                 const char* url,
+                 const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+  
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+  }
+  else
+  {
+    const std::string studyId(request->groups[0]);
+
+    std::vector<std::string> studies;
+    studies.push_back(studyId);
+
+    AnswerBidsArchive(output, studyId + "-bids.zip", studies);
+  }
+}
+
+
+void PatientToBids(OrthancPluginRestOutput* output,
+                   const char* url,
+                   const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+  
+  if (request->method != OrthancPluginHttpMethod_Get)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET");
+  }
+  else
+  {
+    const std::string patientId(request->groups[0]);
+
+    std::vector<std::string> studies;
+    Neuro::PluginToolbox::GetChildResources(studies, "/patients/" + patientId, "Studies");
+
+    AnswerBidsArchive(output, patientId + "-bids.zip", studies);
+  }
+}
+
+
+/**
+ * The body is a JSON object whose "Series" field lists the Orthanc
+ * identifiers of the series to be converted. The optional "Compress"
+ * field indicates whether the NIfTI files are compressed.
+ **/
+void BatchToNifti(OrthancPluginRestOutput* output,
+                  const char* url,
+                  const OrthancPluginHttpRequest* request)
+{
+  static const char* const KEY_SERIES = "Series";
+  static const char* const KEY_COMPRESS = "Compress";
+
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+  
+  if (request->method != OrthancPluginHttpMethod_Post)
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "POST");
+    return;
+  }
+
+  Json::Value body;
+  if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+      body.type() != Json::objectValue ||
+      !body.isMember(KEY_SERIES) ||
+      body[KEY_SERIES].type() != Json::arrayValue)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                    "Expected a JSON object with a \"" + std::string(KEY_SERIES) + "\" array");
+  }
+
+  bool compress = false;
+  if (body.isMember(KEY_COMPRESS))
+  {
+    if (body[KEY_COMPRESS].type() != Json::booleanValue)
     {
-      filename += ".gz";
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Option \"" + std::string(KEY_COMPRESS) + "\" must be Boolean");
     }
 
-    const std::string contentDisposition = "filename=\"" + filename + "\"";
-    OrthancPluginSetHttpHeader(context, output, "Content-Disposition", contentDisposition.c_str());
+    compress = body[KEY_COMPRESS].asBool();
+  }
+
+  std::vector<std::string> series;
+  series.reserve(body[KEY_SERIES].size());
+
+  std::set<std::string> distinct;
+
+  for (Json::Value::ArrayIndex i = 0; i < body[KEY_SERIES].size(); i++)
+  {
+    if (body[KEY_SERIES][i].type() != Json::stringValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "The \"" + std::string(KEY_SERIES) + "\" array must contain strings");
+    }
+
+    // The ZIP archive cannot contain the same file twice
+    const std::string id = body[KEY_SERIES][i].asString();
+    if (distinct.insert(id).second)
+    {
+      series.push_back(id);
+    }
+  }
+
+  AnswerNiftiArchive(output, "nifti.zip", series, compress);
+}
+
+
+void JobOutput(OrthancPluginRestOutput* output,
+               const char* url,
+               const OrthancPluginHttpRequest* request)
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  const std::string id(request->groups[0]);
   
-    OrthancPluginAnswerBuffer(context, output, nifti.c_str(), nifti.size(), "application/octet-stream");
+  if (request->method == OrthancPluginHttpMethod_Get)
+  {
+    boost::shared_ptr<Neuro::NiftiFile> file;
+    std::string resourceId;
+    bool compress;
+
+    if (!jobOutputs_.Lookup(file, resourceId, compress, id))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown NIfTI output: " + id);
+    }
+
+    AnswerNifti(output, resourceId, *file, compress);
+  }
+  else if (request->method == OrthancPluginHttpMethod_Delete)
+  {
+    if (!jobOutputs_.Remove(id))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown NIfTI output: " + id);
+    }
+
+    OrthancPluginAnswerBuffer(context, output, "{}", 2, "application/json");
+  }
+  else
+  {
+    OrthancPluginSendMethodNotAllowed(context, output, "GET,DELETE");
+  }
+}
+
+
+static void RefreshMetricsCallback()
+{
+  OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+  {
+    // Allows to compare the raw frames against the full DICOM files
+    // (cf. "Resources/BenchmarkRawFrames.py")
+    Neuro::PluginFrameDecoder::Statistics statistics;
+    Neuro::PluginFrameDecoder::GetTotalStatistics(statistics);
+
+    OrthancPluginSetMetricsValue(context, "orthanc_neuro_decoder_raw_frames_count",
+                                 static_cast<float>(statistics.countRawFrames_), OrthancPluginMetricsType_Default);
+    OrthancPluginSetMetricsValue(context, "orthanc_neuro_decoder_full_instances_count",
+                                 static_cast<float>(statistics.countFullInstances_), OrthancPluginMetricsType_Default);
+    OrthancPluginSetMetricsValue(context, "orthanc_neuro_decoder_metadata_requests_count",
+                                 static_cast<float>(statistics.countMetadataRequests_), OrthancPluginMetricsType_Default);
+    OrthancPluginSetMetricsValue(context, "orthanc_neuro_decoder_read_mb",
+                                 static_cast<float>(statistics.countBytes_) / (1024.0f * 1024.0f), OrthancPluginMetricsType_Default);
+    OrthancPluginSetMetricsValue(context, "orthanc_neuro_decoder_duration_ms",
+                                 static_cast<float>(statistics.elapsedMicroseconds_ / 1000), OrthancPluginMetricsType_Default);
+  }
+
+  if (precomputer_.get() != NULL)
+  {
+    precomputer_->PublishMetrics();
+  }
+}
+
+
+static OrthancPluginErrorCode OnChangeCallback(OrthancPluginChangeType changeType,
+                                               OrthancPluginResourceType resourceType,
+                                               const char* resourceId)
+{
+  try
+  {
+    if (converter_.get() != NULL &&
+        converter_->HasCache() &&
+        resourceType == OrthancPluginResourceType_Series &&
+        resourceId != NULL &&
+        (changeType == OrthancPluginChangeType_NewChildInstance ||
+         changeType == OrthancPluginChangeType_Deleted))
+    {
+      converter_->GetCache().InvalidateSeries(resourceId);
+    }
+
+    if (precomputer_.get() != NULL)
+    {
+      switch (changeType)
+      {
+        case OrthancPluginChangeType_OrthancStarted:
+          // The workers use the REST API, which is only available once Orthanc is started
+          precomputer_->Start(precomputeThreads_);
+          break;
+
+        case OrthancPluginChangeType_OrthancStopped:
+          // The workers are joined by "OrthancPluginFinalize()", in
+          // order not to block the thread of the change callbacks
+          // while a worker is reading the DICOM tags of a series
+          precomputer_->SignalStop();
+          break;
+
+        case OrthancPluginChangeType_StableSeries:
+          if (resourceId != NULL)
+          {
+            precomputer_->Enqueue(resourceId);
+          }
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    return OrthancPluginErrorCode_Success;
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    LOG(ERROR) << "Exception in the change callback of the neuroimaging plugin: " << e.What();
+    return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
   }
 }
 
@@ -287,8 +863,112 @@ extern "C"
 
     OrthancPlugins::SetDescription(ORTHANC_PLUGIN_NAME, "Add support for NIfTI in Orthanc.");
 
+    try
+    {
+      OrthancPlugins::OrthancConfiguration configuration;
+
+      partialContent_ = Neuro::NeuroToolbox::IsPartialContentSupported(configuration.GetJson());
+      if (!partialContent_)
+      {
+        LOG(WARNING) << "HTTP byte ranges on NIfTI files are disabled, as \"HttpDescribeErrors\" is false";
+      }
+
+      OrthancPlugins::OrthancConfiguration neuro;
+      configuration.GetSection(neuro, "Neuro");
+
+      std::unique_ptr<Neuro::SeriesConverter> converter(new Neuro::SeriesConverter);
+
+      const unsigned int level = neuro.GetUnsignedIntegerValue("CompressionLevel", converter->GetCompressionLevel());
+      converter->SetCompression(level,
+                                neuro.GetUnsignedIntegerValue("CompressionThreads", converter->GetCompressionThreads()));
+
+      converter->SetDecodingThreads(neuro.GetUnsignedIntegerValue("DecodingThreads", converter->GetDecodingThreads()));
+      converter->SetLoadingThreads(neuro.GetUnsignedIntegerValue("LoadingThreads", converter->GetLoadingThreads()));
+      converter->SetRawFrames(neuro.GetBooleanValue("RawFrames", converter->IsRawFrames()));
+      batchThreads_ = std::max(1u, neuro.GetUnsignedIntegerValue("BatchThreads", batchThreads_));
+
+      LOG(WARNING) << "Compression of NIfTI files with level " << level
+                   << " and " << converter->GetCompressionThreads() << " thread(s)";
+      LOG(WARNING) << "Decoding of DICOM frames with " << converter->GetDecodingThreads() << " thread(s)";
+      LOG(WARNING) << "Reading of DICOM tags with " << converter->GetLoadingThreads() << " thread(s)";
+      LOG(WARNING) << "Conversion of batches of series with " << batchThreads_ << " thread(s)";
+
+      const unsigned int frameCacheSize = neuro.GetUnsignedIntegerValue("FrameCacheSize", 256);  // In MB
+      converter->SetFrameCacheSize(static_cast<size_t>(frameCacheSize) * 1024 * 1024);
+      LOG(WARNING) << "Cache of the decoded DICOM frames limited to " << frameCacheSize << "MB";
+
+      const unsigned int instanceCacheSize = neuro.GetUnsignedIntegerValue("InstanceCacheSize", 64);  // In MB
+      converter->SetInstanceCacheSize(static_cast<size_t>(instanceCacheSize) * 1024 * 1024);
+      LOG(WARNING) << "Cache of the parsed DICOM instances limited to " << instanceCacheSize << "MB per decoder";
+
+      const unsigned int mappedThreshold = neuro.GetUnsignedIntegerValue("MemoryMappedThreshold", 0);  // In MB
+      converter->SetMemoryMapping(static_cast<uint64_t>(mappedThreshold) * 1024llu * 1024llu,
+                                  neuro.GetStringValue("TemporaryDirectory", ""));
+
+      if (mappedThreshold != 0)
+      {
+        LOG(WARNING) << "Uncompressed NIfTI files above " << mappedThreshold
+                     << "MB are written to memory-mapped temporary files";
+      }
+
+      jobOutputs_.SetLimits(neuro.GetUnsignedIntegerValue("MaxJobOutputs", 16),
+                            static_cast<uint64_t>(neuro.GetUnsignedIntegerValue("MaxJobOutputsSize", 4096)) * 1024llu * 1024llu,  // In MB
+                            neuro.GetUnsignedIntegerValue("JobOutputsTimeout", 3600));  // In seconds
+
+      const std::string cacheDirectory = neuro.GetStringValue("CacheDirectory", "");
+      if (!cacheDirectory.empty())
+      {
+        const unsigned int cacheSize = neuro.GetUnsignedIntegerValue("CacheSize", 1024);  // In MB
+        if (cacheSize == 0)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                          "The size of the cache of NIfTI files cannot be zero");
+        }
+
+        converter->SetCache(new Neuro::NiftiCache(cacheDirectory, static_cast<uint64_t>(cacheSize) * 1024llu * 1024llu,
+                                                  converter->GetCompressionLevel()));
+      }
+
+      converter_.reset(converter.release());
+
+      if (neuro.GetBooleanValue("Precompute", false))
+      {
+        if (!converter_->HasCache())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                          "Option \"Neuro.Precompute\" requires \"Neuro.CacheDirectory\"");
+        }
+
+        const unsigned int queueSize = neuro.GetUnsignedIntegerValue("PrecomputeQueueSize", 256);
+        precomputeThreads_ = std::max(1u, neuro.GetUnsignedIntegerValue("PrecomputeThreads", precomputeThreads_));
+        const bool compress = neuro.GetBooleanValue("PrecomputeCompress", false);
+
+        precomputer_.reset(new Neuro::SeriesPrecomputer(*converter_, queueSize, compress));
+
+        LOG(WARNING) << "The stable MR and PET series are converted to "
+                     << (compress ? "compressed" : "uncompressed") << " NIfTI files with "
+                     << precomputeThreads_ << " thread(s), and a queue of " << queueSize << " series";
+      }
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Error while reading the configuration of the neuroimaging plugin: " << e.What();
+      return -1;
+    }
+
     OrthancPlugins::RegisterRestCallback<SeriesToNifti>("/series/(.*)/nifti", true /* thread safe */);
+    OrthancPlugins::RegisterRestCallback<SeriesToNiftiSize>("/series/(.*)/nifti-size", true /* thread safe */);
+    OrthancPlugins::RegisterRestCallback<SeriesToNiftiHeader>("/series/(.*)/nifti-header", true /* thread safe */);
+    OrthancPlugins::RegisterRestCallback<SeriesToNiftiJson>("/series/(.*)/nifti-json", true /* thread safe */);
     OrthancPlugins::RegisterRestCallback<InstanceToNifti>("/instances/(.*)/nifti", true /* thread safe */);
+    OrthancPlugins::RegisterRestCallback<StudyToNifti>("/studies/(.*)/nifti", true /* thread safe */);
+    OrthancPlugins::RegisterRestCallback<BatchToNifti>("/tools/nifti-batch", true /* thread safe */);
+    OrthancPlugins::RegisterRestCallback<StudyToBids>("/studies/(.*)/bids", true /* thread safe */);
+    OrthancPlugins::RegisterRestCallback<PatientToBids>("/patients/(.*)/bids", true /* thread safe */);
+    OrthancPlugins::RegisterRestCallback<JobOutput>("/neuro/outputs/(.*)", true /* thread safe */);
+
+    OrthancPluginRegisterOnChangeCallback(context, OnChangeCallback);
+    OrthancPluginRegisterRefreshMetricsCallback(context, RefreshMetricsCallback);
 
     {
       std::string explorer;
@@ -303,6 +983,9 @@ extern "C"
 
   ORTHANC_PLUGINS_API void OrthancPluginFinalize()
   {
+    precomputer_.reset();  // Must be stopped before the converter is released
+    jobOutputs_.Clear();
+    converter_.reset();
   }
 
 
@@ -19,19 +19,46 @@
 
 #include "PluginFrameDecoder.h"
 
+#include <Logging.h>
+#include <Toolbox.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+
+
+static const char* const TRANSFER_SYNTAX_IMPLICIT_LITTLE_ENDIAN = "1.2.840.10008.1.2";
+static const char* const TRANSFER_SYNTAX_EXPLICIT_LITTLE_ENDIAN = "1.2.840.10008.1.2.1";
+
 
 namespace Neuro
 {
+  static boost::mutex                   totalStatisticsMutex_;
+  static PluginFrameDecoder::Statistics  totalStatistics_;
+
+
   static Orthanc::PixelFormat Convert(OrthancPluginPixelFormat format)
   {
     switch (format)
     {
+      case OrthancPluginPixelFormat_Grayscale8:
+        return Orthanc::PixelFormat_Grayscale8;
+
       case OrthancPluginPixelFormat_Grayscale16:
         return Orthanc::PixelFormat_Grayscale16;
 
       case OrthancPluginPixelFormat_SignedGrayscale16:
         return Orthanc::PixelFormat_SignedGrayscale16;
 
+      case OrthancPluginPixelFormat_Grayscale32:
+        return Orthanc::PixelFormat_Grayscale32;
+
+      case OrthancPluginPixelFormat_Float32:
+        return Orthanc::PixelFormat_Float32;
+
+      case OrthancPluginPixelFormat_RGB24:
+        return Orthanc::PixelFormat_RGB24;
+
       default:
         throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
@@ -57,7 +84,7 @@ namespace Neuro
                            unsigned int x,
                            unsigned int y,
                            unsigned int width,
-                           unsigned int height)
+                           unsigned int height) ORTHANC_OVERRIDE
     {
       Orthanc::ImageAccessor f;
       f.AssignReadOnly(Convert(frame_->GetPixelFormat()), frame_->GetWidth(),
@@ -65,23 +92,263 @@ namespace Neuro
 
       f.GetRegion(region, x, y, width, height);
     }
+
+    virtual size_t GetMemorySize() const ORTHANC_OVERRIDE
+    {
+      return static_cast<size_t>(frame_->GetPitch()) * static_cast<size_t>(frame_->GetHeight());
+    }
   };
 
-    
-  PluginFrameDecoder::IDecodedFrame* PluginFrameDecoder::DecodeFrame(const Slice& slice)
+
+  // Frame whose pixel data was read as such from an uncompressed transfer syntax
+  class PluginFrameDecoder::RawFrame : public IDecodedFrame
+  {
+  private:
+    OrthancPlugins::MemoryBuffer  buffer_;
+    Orthanc::ImageAccessor        accessor_;
+
+  public:
+    RawFrame(OrthancPlugins::MemoryBuffer& buffer /* will be swapped */,
+             Orthanc::PixelFormat format,
+             unsigned int width,
+             unsigned int height)
+    {
+      const size_t pitch = static_cast<size_t>(width) * static_cast<size_t>(Orthanc::GetBytesPerPixel(format));
+
+      if (buffer.GetSize() != pitch * static_cast<size_t>(height))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "The size of a raw frame doesn't match the size of the image");
+      }
+
+      buffer_.Swap(buffer);
+      accessor_.AssignReadOnly(format, width, height, static_cast<unsigned int>(pitch), buffer_.GetData());
+    }
+
+    virtual void GetRegion(Orthanc::ImageAccessor& region,
+                           unsigned int x,
+                           unsigned int y,
+                           unsigned int width,
+                           unsigned int height) ORTHANC_OVERRIDE
+    {
+      accessor_.GetRegion(region, x, y, width, height);
+    }
+
+    virtual size_t GetMemorySize() const ORTHANC_OVERRIDE
+    {
+      return buffer_.GetSize();
+    }
+  };
+
+
+  PluginFrameDecoder::Statistics::Statistics() :
+    countRawFrames_(0),
+    countFullInstances_(0),
+    countInstanceHits_(0),
+    countMetadataRequests_(0),
+    countBytes_(0),
+    elapsedMicroseconds_(0)
+  {
+  }
+
+
+  void PluginFrameDecoder::Statistics::Add(const Statistics& other)
+  {
+    countRawFrames_ += other.countRawFrames_;
+    countFullInstances_ += other.countFullInstances_;
+    countInstanceHits_ += other.countInstanceHits_;
+    countMetadataRequests_ += other.countMetadataRequests_;
+    countBytes_ += other.countBytes_;
+    elapsedMicroseconds_ += other.elapsedMicroseconds_;
+  }
+
+
+  bool PluginFrameDecoder::IsRawFrameCompatible(Orthanc::PixelFormat& format,
+                                                const std::string& instanceId,
+                                                const InputDicomInstance& instance)
+  {
+    const Orthanc::DicomImageInformation& info = instance.GetImageInformation();
+
+    /**
+     * The raw pixel data can only be used if no bit must be masked
+     * or sign-extended (i.e. "BitsStored == BitsAllocated"), and if
+     * the color channels are interleaved.
+     **/
+    if (!useRawFrames_ ||
+        Orthanc::Toolbox::DetectEndianness() != Orthanc::Endianness_Little ||
+        info.GetBitsStored() != info.GetBitsAllocated() ||
+        !info.ExtractPixelFormat(format, false))
+    {
+      return false;
+    }
+
+    switch (format)
+    {
+      case Orthanc::PixelFormat_Grayscale8:
+      case Orthanc::PixelFormat_Grayscale16:
+      case Orthanc::PixelFormat_SignedGrayscale16:
+      case Orthanc::PixelFormat_Grayscale32:
+        break;
+
+      case Orthanc::PixelFormat_RGB24:
+        if (info.IsPlanar())
+        {
+          return false;
+        }
+        break;
+
+      default:
+        return false;
+    }
+
+    // This is one additional request to the Orthanc core per instance
+    statistics_.countMetadataRequests_++;
+
+    std::string transferSyntax;
+    if (OrthancPlugins::RestApiGetString(transferSyntax, "/instances/" + instanceId + "/metadata/TransferSyntax", false))
+    {
+      transferSyntax = Orthanc::Toolbox::StripSpaces(transferSyntax);
+      return (transferSyntax == TRANSFER_SYNTAX_IMPLICIT_LITTLE_ENDIAN ||
+              transferSyntax == TRANSFER_SYNTAX_EXPLICIT_LITTLE_ENDIAN);
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  const PluginFrameDecoder::RawFrameInfo& PluginFrameDecoder::GetRawFrameInfo(size_t index,
+                                                                              const std::string& instanceId)
   {
-    const std::string id = collection_.GetOrthancId(slice.GetInstanceIndexInCollection());
+    RawFrameInfos::const_iterator found = rawFrameInfos_.find(instanceId);
+
+    if (found == rawFrameInfos_.end())
+    {
+      RawFrameInfo info;
+      info.format_ = Orthanc::PixelFormat_Grayscale16;
+      info.isRaw_ = IsRawFrameCompatible(info.format_, instanceId, collection_.GetInstance(index));
 
-    if (id != currentInstanceId_)
+      found = rawFrameInfos_.insert(std::make_pair(instanceId, info)).first;
+    }
+
+    return found->second;
+  }
+
+
+  OrthancPlugins::DicomInstance& PluginFrameDecoder::GetInstance(const std::string& instanceId)
+  {
+    for (Instances::iterator it = instances_.begin(); it != instances_.end(); ++it)
     {
-      OrthancPlugins::MemoryBuffer dicom;
-      dicom.GetDicomInstance(id);
-        
-      currentInstance_.reset(new OrthancPlugins::DicomInstance(dicom.GetData(), dicom.GetSize()));
-      currentInstanceId_ = id;
+      if (it->id_ == instanceId)
+      {
+        // Make the instance the most recently used
+        instances_.splice(instances_.begin(), instances_, it);
+        statistics_.countInstanceHits_++;
+        return *instances_.front().instance_;
+      }
     }
 
-    assert(currentInstance_.get() != NULL);
-    return new DecodedFrame(currentInstance_->GetDecodedFrame(slice.GetFrameNumber()));
+    OrthancPlugins::MemoryBuffer dicom;
+    dicom.GetDicomInstance(instanceId);
+
+    statistics_.countFullInstances_++;
+    statistics_.countBytes_ += dicom.GetSize();
+
+    CachedInstance item;
+    item.id_ = instanceId;
+    item.size_ = dicom.GetSize();
+    item.instance_.reset(new OrthancPlugins::DicomInstance(dicom.GetData(), dicom.GetSize()));
+
+    instances_.push_front(item);
+    instancesSize_ += item.size_;
+
+    while (instances_.size() > 1 &&
+           instancesSize_ > maximumInstancesSize_)
+    {
+      assert(instancesSize_ >= instances_.back().size_);
+      instancesSize_ -= instances_.back().size_;
+      instances_.pop_back();
+    }
+
+    return *instances_.front().instance_;
+  }
+
+
+  PluginFrameDecoder::IDecodedFrame* PluginFrameDecoder::DecodeFrameInternal(const Slice& slice)
+  {
+    const size_t index = slice.GetInstanceIndexInCollection();
+    const std::string id = collection_.GetOrthancId(index);
+
+    const RawFrameInfo& info = GetRawFrameInfo(index, id);
+
+    if (info.isRaw_)
+    {
+      const std::string uri = ("/instances/" + id + "/frames/" +
+                               boost::lexical_cast<std::string>(slice.GetFrameNumber()) + "/raw");
+
+      OrthancPlugins::MemoryBuffer raw;
+      if (!raw.RestApiGet(uri, false))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem, "Cannot read raw frame: " + uri);
+      }
+
+      statistics_.countRawFrames_++;
+      statistics_.countBytes_ += raw.GetSize();
+
+      const Orthanc::DicomImageInformation& image = collection_.GetInstance(index).GetImageInformation();
+      return new RawFrame(raw, info.format_, image.GetWidth(), image.GetHeight());
+    }
+    else
+    {
+      return new DecodedFrame(GetInstance(id).GetDecodedFrame(slice.GetFrameNumber()));
+    }
+  }
+
+
+  PluginFrameDecoder::PluginFrameDecoder(const DicomInstancesCollection& collection,
+                                         bool useRawFrames,
+                                         size_t maximumInstancesSize) :
+    collection_(collection),
+    useRawFrames_(useRawFrames),
+    instancesSize_(0),
+    maximumInstancesSize_(maximumInstancesSize)
+  {
+  }
+
+
+  PluginFrameDecoder::~PluginFrameDecoder()
+  {
+    if (statistics_.countRawFrames_ > 0 ||
+        statistics_.countFullInstances_ > 0)
+    {
+      LOG(INFO) << "Frame decoder: " << statistics_.countRawFrames_ << " raw frame(s) and "
+                << statistics_.countFullInstances_ << " full DICOM instance(s) read from Orthanc, totalling "
+                << statistics_.countBytes_ << " bytes, in " << (statistics_.elapsedMicroseconds_ / 1000) << "ms ("
+                << statistics_.countMetadataRequests_ << " request(s) for the transfer syntax, "
+                << statistics_.countInstanceHits_ << " hit(s) in the cache of the instances)";
+    }
+
+    boost::mutex::scoped_lock lock(totalStatisticsMutex_);
+    totalStatistics_.Add(statistics_);
+  }
+
+    
+  PluginFrameDecoder::IDecodedFrame* PluginFrameDecoder::DecodeFrame(const Slice& slice)
+  {
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    std::unique_ptr<IDecodedFrame> frame(DecodeFrameInternal(slice));
+
+    statistics_.elapsedMicroseconds_ += (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds();
+
+    return frame.release();
+  }
+
+
+  void PluginFrameDecoder::GetTotalStatistics(Statistics& target)
+  {
+    boost::mutex::scoped_lock lock(totalStatisticsMutex_);
+    target = totalStatistics_;
   }
 }
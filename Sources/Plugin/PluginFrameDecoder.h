@@ -24,24 +24,124 @@
 
 #include "../../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
+#include <boost/shared_ptr.hpp>
+#include <list>
+#include <map>
+
 
 namespace Neuro
 {
   class PluginFrameDecoder : public IDicomFrameDecoder
   {
+  public:
+    // Statistics about the requests to the Orthanc core and the decoding
+    struct Statistics
+    {
+      uint64_t  countRawFrames_;
+      uint64_t  countFullInstances_;
+      uint64_t  countInstanceHits_;
+      uint64_t  countMetadataRequests_;  // Requests to "/instances/{id}/metadata/TransferSyntax"
+      uint64_t  countBytes_;             // Size of the raw frames and of the full DICOM files
+      uint64_t  elapsedMicroseconds_;
+
+      Statistics();
+
+      void Add(const Statistics& other);
+    };
+
   private:
     class DecodedFrame;
+    class RawFrame;
 
-    const DicomInstancesCollection&                collection_;
-    std::string                                    currentInstanceId_;
-    std::unique_ptr<OrthancPlugins::DicomInstance> currentInstance_;
-    
-  public:
-    explicit PluginFrameDecoder(const DicomInstancesCollection& collection) :
-      collection_(collection)
+    // Whether the frames of one instance can be read as raw frames
+    struct RawFrameInfo
+    {
+      bool                  isRaw_;
+      Orthanc::PixelFormat  format_;
+    };
+
+    // Parsed DICOM instance, whose size is the size of the DICOM file
+    struct CachedInstance
     {
-    }
+      std::string                                       id_;
+      size_t                                            size_;
+      boost::shared_ptr<OrthancPlugins::DicomInstance>  instance_;
+    };
+
+    typedef std::map<std::string, RawFrameInfo>  RawFrameInfos;
+    typedef std::list<CachedInstance>            Instances;
+
+    const DicomInstancesCollection&  collection_;
+    bool                             useRawFrames_;
+    RawFrameInfos                    rawFrameInfos_;
+    Instances                        instances_;  // Most recently used at the front
+    size_t                           instancesSize_;
+    size_t                           maximumInstancesSize_;
+
+    // Statistics about this decoder, reported in the logs
+    Statistics                       statistics_;
+
+    bool IsRawFrameCompatible(Orthanc::PixelFormat& format,
+                              const std::string& instanceId,
+                              const InputDicomInstance& instance);
+
+    const RawFrameInfo& GetRawFrameInfo(size_t index,
+                                        const std::string& instanceId);
+
+    OrthancPlugins::DicomInstance& GetInstance(const std::string& instanceId);
+
+    IDecodedFrame* DecodeFrameInternal(const Slice& slice);
+
+  public:
+    /**
+     * If "useRawFrames" is "true", the frames of the instances that
+     * are stored using an uncompressed transfer syntax are read
+     * directly from the "/instances/{id}/frames/{n}/raw" route, which
+     * avoids copying and parsing the full DICOM file in the plugin.
+     *
+     * The other instances are parsed as a whole, and are kept in a
+     * LRU cache of "maximumInstancesSize" bytes, which avoids parsing
+     * the same instance several times if its frames are not accessed
+     * consecutively (e.g. multiframe instances and Siemens mosaics in
+     * 4D series). The most recently used instance is always kept.
+     **/
+    PluginFrameDecoder(const DicomInstancesCollection& collection,
+                       bool useRawFrames,
+                       size_t maximumInstancesSize);
+
+    virtual ~PluginFrameDecoder();
     
     virtual IDecodedFrame* DecodeFrame(const Slice& slice) ORTHANC_OVERRIDE;
+
+    /**
+     * Statistics accumulated by all the decoders that have been
+     * destroyed since the plugin was started. They are published as
+     * metrics, which allows to compare the raw frames against the
+     * parsing of the full DICOM files (cf. option "Neuro.RawFrames").
+     **/
+    static void GetTotalStatistics(Statistics& target);
+
+    class Factory : public IFactory
+    {
+    private:
+      const DicomInstancesCollection&  collection_;
+      bool                             useRawFrames_;
+      size_t                           maximumInstancesSize_;
+
+    public:
+      Factory(const DicomInstancesCollection& collection,
+              bool useRawFrames,
+              size_t maximumInstancesSize) :
+        collection_(collection),
+        useRawFrames_(useRawFrames),
+        maximumInstancesSize_(maximumInstancesSize)
+      {
+      }
+
+      virtual IDicomFrameDecoder* CreateDecoder() ORTHANC_OVERRIDE
+      {
+        return new PluginFrameDecoder(collection_, useRawFrames_, maximumInstancesSize_);
+      }
+    };
   };
 }
@@ -0,0 +1,111 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PluginToolbox.h"
+
+#include "../../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Toolbox.h>
+
+#include <limits>
+
+
+namespace Neuro
+{
+  void PluginToolbox::GetResource(Json::Value& target,
+                                  const std::string& uri)
+  {
+    if (!OrthancPlugins::RestApiGet(target, uri, false))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem, "Missing resource: " + uri);
+    }
+    else if (target.type() != Json::objectValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+
+  void PluginToolbox::GetChildResources(std::vector<std::string>& children,
+                                        const std::string& uri,
+                                        const std::string& key)
+  {
+    Json::Value resource;
+    if (!OrthancPlugins::RestApiGet(resource, uri, false))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem, "Missing resource: " + uri);
+    }
+
+    if (resource.type() != Json::objectValue ||
+        !resource.isMember(key) ||
+        resource[key].type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    children.resize(resource[key].size());
+
+    for (Json::Value::ArrayIndex i = 0; i < resource[key].size(); i++)
+    {
+      if (resource[key][i].type() != Json::stringValue)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+      else
+      {
+        children[i] = resource[key][i].asString();
+      }
+    }
+  }
+
+
+  void PluginToolbox::GetSeriesInstances(std::vector<std::string>& instances,
+                                         const std::string& seriesId)
+  {
+    GetChildResources(instances, "/series/" + seriesId, "Instances");
+  }
+
+
+  std::string PluginToolbox::GetMainDicomTag(const Json::Value& resource,
+                                             const char* field,
+                                             const char* tag)
+  {
+    if (resource.isMember(field) &&
+        resource[field].type() == Json::objectValue &&
+        resource[field].isMember(tag) &&
+        resource[field][tag].type() == Json::stringValue)
+    {
+      return Orthanc::Toolbox::StripSpaces(resource[field][tag].asString());
+    }
+    else
+    {
+      return "";
+    }
+  }
+
+
+  void PluginToolbox::CheckAnswerSize(uint64_t size)
+  {
+    if (size > static_cast<uint64_t>(std::numeric_limits<uint32_t>::max()))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                      "The NIfTI file is too large to be sent (4GB limit), consider compressing it");
+    }
+  }
+}
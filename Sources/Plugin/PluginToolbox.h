@@ -0,0 +1,53 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <json/value.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+namespace Neuro
+{
+  // Helpers to access the resources of Orthanc through its REST API
+  class PluginToolbox
+  {
+  public:
+    static void GetResource(Json::Value& target,
+                            const std::string& uri);
+
+    // Lists the children of a resource, as given by the Orthanc REST API
+    static void GetChildResources(std::vector<std::string>& children,
+                                  const std::string& uri,
+                                  const std::string& key);
+
+    static void GetSeriesInstances(std::vector<std::string>& instances,
+                                   const std::string& seriesId);
+
+    // Returns an empty string if the tag is absent from the main DICOM tags of the resource
+    static std::string GetMainDicomTag(const Json::Value& resource,
+                                       const char* field,
+                                       const char* tag);
+
+    // Throws if an answer of "size" bytes cannot be sent by the plugin SDK (4GB limit)
+    static void CheckAnswerSize(uint64_t size);
+  };
+}
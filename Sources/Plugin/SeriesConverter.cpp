@@ -0,0 +1,562 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "SeriesConverter.h"
+
+#include "PluginFrameDecoder.h"
+#include "PluginToolbox.h"
+
+#include "../Framework/GzipOutputStream.h"
+#include "../Framework/IDicomInstanceReader.h"
+#include "../Framework/NeuroToolbox.h"
+#include "../Framework/ParallelGzipOutputStream.h"
+#include "../Framework/StringOutputStream.h"
+
+#include <Logging.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <algorithm>
+
+
+namespace Neuro
+{
+  static void AcquireUIHFrameSequence(InputDicomInstance& instance,
+                                      const std::string& instanceId)
+  {
+    const std::string uri = "/instances/" + instanceId + "/content/" + DICOM_TAG_UIH_MR_VFRAME_SEQUENCE.Format();
+
+    Json::Value uih;
+    if (OrthancPlugins::RestApiGet(uih, uri, false) &&
+        uih.type() == Json::arrayValue)
+    {
+      for (Json::Value::ArrayIndex i = 0; i < uih.size(); i++)
+      {
+        Json::Value tags2;
+
+        if (uih[i].type() != Json::stringValue ||
+            !OrthancPlugins::RestApiGet(tags2, uri + "/" + uih[i].asString(), false) ||
+            tags2.type() != Json::arrayValue)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+
+        Orthanc::DicomMap m;
+
+        for (Json::Value::ArrayIndex j = 0; j < tags2.size(); j++)
+        {
+          Orthanc::DicomTag tag(0, 0);
+          std::string value;
+
+          if (tags2[j].type() != Json::stringValue ||
+              !Orthanc::DicomTag::ParseHexadecimal(tag, tags2[j].asCString()) ||
+              !OrthancPlugins::RestApiGetString(value, uri + "/" + uih[i].asString() + "/" + tags2[j].asString(), false))
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+          }
+          else
+          {
+            m.SetValue(tag, value, false);
+          }
+        }
+
+        instance.AddUIHFrameSequenceItem(m);
+      }
+    }
+  }
+
+
+  InputDicomInstance* SeriesConverter::AcquireInstance(const std::string& instanceId) const
+  {
+#if 0
+    /**
+     * This version uses DCMTK. It should be avoided for performance, as
+     * it requires reading the entire DICOM files from the disk, whereas
+     * "OrthancPluginDicomInstanceToJson()" will only read the DICOM
+     * files up to pixel data, and will take advantage of the caching
+     * mechanisms implemented inside the Orthanc core.
+     **/
+    OrthancPlugins::MemoryBuffer dicom;
+    dicom.GetDicomInstance(instanceId);
+
+    Orthanc::ParsedDicomFile parsed(dicom.GetData(), dicom.GetSize());
+    return new InputDicomInstance(parsed);
+
+#else
+    /**
+     * The "Short" format avoids generating and parsing the names and
+     * the types of all the tags. Only the tags that are actually used
+     * by "InputDicomInstance" are kept afterward. The binary tags are
+     * included, as they contain the Siemens CSA header (0029,1010):
+     * This avoids a second request to the Orthanc core for Siemens
+     * instances. As some manufacturers store large private binary
+     * blobs (e.g. Siemens 0029,1020 or GE private groups), the values
+     * above "MAX_STRING_LENGTH" bytes are replaced by null values.
+     **/
+    static const uint32_t MAX_STRING_LENGTH = 64 * 1024;
+
+    Json::Value json;
+
+    {
+      OrthancPlugins::OrthancString s;
+      s.Assign(OrthancPluginDicomInstanceToJson(
+                 OrthancPlugins::GetGlobalContext(), instanceId.c_str(), OrthancPluginDicomToJsonFormat_Short,
+                 static_cast<OrthancPluginDicomToJsonFlags>(OrthancPluginDicomToJsonFlags_IncludeBinary |
+                                                            OrthancPluginDicomToJsonFlags_IncludePrivateTags |
+                                                            OrthancPluginDicomToJsonFlags_IncludeUnknownTags |
+                                                            OrthancPluginDicomToJsonFlags_StopAfterPixelData |
+                                                            OrthancPluginDicomToJsonFlags_SkipGroupLengths),
+                 MAX_STRING_LENGTH));
+
+      if (s.GetContent() == NULL ||
+          !OrthancPlugins::ReadJson(json, s.GetContent()))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem, "Missing instance: " + instanceId);
+      }
+    }
+
+    Orthanc::DicomMap tags;
+    NeuroToolbox::ParseShortDicomAsJson(tags, json, requiredTags_);
+
+    std::unique_ptr<InputDicomInstance> instance(new InputDicomInstance(tags));
+
+    switch (instance->GetManufacturer())
+    {
+      case Manufacturer_Siemens:
+      {
+        const std::string key = DICOM_TAG_SIEMENS_CSA_HEADER.Format();
+
+        std::string csa;
+        if (json.isMember(key) &&
+            NeuroToolbox::DecodeBinaryDicomAsJson(csa, json[key]))
+        {
+          // The CSA header is already part of the JSON, as a binary value
+          instance->GetCSAHeader().Load(csa);
+        }
+        else if (OrthancPlugins::RestApiGetString(csa, "/instances/" + instanceId + "/content/" + key, false))
+        {
+          // Fallback if the CSA header is missing from the JSON, or
+          // if it is larger than "MAX_STRING_LENGTH"
+          instance->GetCSAHeader().Load(csa);
+        }
+        break;
+      }
+
+      case Manufacturer_UIH:
+      {
+        const std::string key = DICOM_TAG_UIH_MR_VFRAME_SEQUENCE.Format();
+
+        if (json.isMember(key) &&
+            json[key].type() == Json::arrayValue)
+        {
+          // The items of the sequence are already part of the JSON
+          // returned by "OrthancPluginDicomInstanceToJson()"
+          const Json::Value& sequence = json[key];
+
+          for (Json::Value::ArrayIndex i = 0; i < sequence.size(); i++)
+          {
+            Orthanc::DicomMap m;
+            NeuroToolbox::ParseShortDicomAsJson(m, sequence[i]);
+            instance->AddUIHFrameSequenceItem(m);
+          }
+        }
+        else
+        {
+          // Fallback to the browsing of the content of the instance
+          // through the REST API, which is much slower
+          AcquireUIHFrameSequence(*instance, instanceId);
+        }
+        break;
+      }
+
+      default:
+        break;
+    }
+
+    return instance.release();
+#endif
+  }
+
+
+  class SeriesConverter::InstanceReader : public IDicomInstanceReader
+  {
+  private:
+    const SeriesConverter&  that_;
+
+  public:
+    explicit InstanceReader(const SeriesConverter& that) :
+      that_(that)
+    {
+    }
+
+    virtual InputDicomInstance* ReadInstance(const std::string& orthancId) ORTHANC_OVERRIDE
+    {
+      return that_.AcquireInstance(orthancId);
+    }
+  };
+
+
+  SeriesConverter::SeriesConverter() :
+    compressionLevel_(6),  // Same as the default of "Orthanc::GzipCompressor"
+    compressionThreads_(1),
+    decodingThreads_(1),
+    loadingThreads_(1),
+    useRawFrames_(true),
+    frameCacheSize_(256 * 1024 * 1024),
+    instanceCacheSize_(64 * 1024 * 1024),
+    mappedThreshold_(0)
+  {
+    InputDicomInstance::ListRequiredTags(requiredTags_);
+  }
+
+
+  void SeriesConverter::SetCompression(unsigned int level,
+                                       unsigned int countThreads)
+  {
+    if (level > 9)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "The compression level must be between 0 and 9");
+    }
+
+    compressionLevel_ = static_cast<uint8_t>(level);
+    compressionThreads_ = std::max(1u, countThreads);
+  }
+
+
+  void SeriesConverter::SetDecodingThreads(unsigned int countThreads)
+  {
+    decodingThreads_ = std::max(1u, countThreads);
+  }
+
+
+  void SeriesConverter::SetLoadingThreads(unsigned int countThreads)
+  {
+    loadingThreads_ = std::max(1u, countThreads);
+  }
+
+
+  void SeriesConverter::SetMemoryMapping(uint64_t threshold,
+                                         const std::string& temporaryDirectory)
+  {
+    mappedThreshold_ = threshold;
+    temporaryDirectory_ = temporaryDirectory;
+  }
+
+
+  void SeriesConverter::SetCache(NiftiCache* cache)
+  {
+    cache_.reset(cache);
+  }
+
+
+  NiftiCache& SeriesConverter::GetCache() const
+  {
+    if (cache_.get() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      return *cache_;
+    }
+  }
+
+
+  void SeriesConverter::LoadSeries(DicomInstancesCollection& collection,
+                                   const std::string& seriesId,
+                                   const std::vector<std::string>& instances) const
+  {
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    InstanceReader reader(*this);
+    IDicomInstanceReader::Apply(collection, reader, instances, loadingThreads_);
+
+    if (!instances.empty())
+    {
+      const boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+      LOG(INFO) << "Metadata of the " << instances.size() << " instance(s) of series " << seriesId
+                << " loaded in " << elapsed.total_milliseconds() << "ms ("
+                << (elapsed.total_microseconds() / instances.size()) << "us per instance)";
+    }
+  }
+
+
+  void SeriesConverter::CreateNiftiHeader(nifti_image& nifti,
+                                          std::vector<Slice>& slices,
+                                          const DicomInstancesCollection& collection,
+                                          const std::string& slicesRange,
+                                          const std::string& volumesRange)
+  {
+    collection.CreateNiftiHeader(nifti, slices);
+
+    if (!slicesRange.empty() ||
+        !volumesRange.empty())
+    {
+      size_t firstSlice = 0;
+      size_t endSlice = DicomInstancesCollection::GetCountSlices(nifti);
+      size_t firstVolume = 0;
+      size_t endVolume = DicomInstancesCollection::GetCountVolumes(nifti);
+
+      if (!slicesRange.empty())
+      {
+        NeuroToolbox::ParseIndexRange(firstSlice, endSlice, slicesRange);
+      }
+
+      if (!volumesRange.empty())
+      {
+        NeuroToolbox::ParseIndexRange(firstVolume, endVolume, volumesRange);
+      }
+
+      DicomInstancesCollection::ExtractSubVolume(nifti, slices, firstSlice, endSlice, firstVolume, endVolume);
+    }
+  }
+
+
+  void SeriesConverter::FormatSidecar(Json::Value& target,
+                                      const DicomInstancesCollection& collection,
+                                      const nifti_image& header,
+                                      const std::vector<Slice>& slices)
+  {
+    collection.FormatSidecar(target, header, slices);
+    target["ConversionSoftware"] = "Orthanc neuroimaging plugin";
+    target["ConversionSoftwareVersion"] = ORTHANC_PLUGIN_VERSION;
+  }
+
+
+  void SeriesConverter::WriteNifti(NiftiWriter& writer,
+                                   const nifti_image& nifti,
+                                   const DicomInstancesCollection& collection,
+                                   const std::vector<Slice>& slices,
+                                   bool randomAccess,
+                                   NiftiWriter::IProgressListener* listener) const
+  {
+    if (listener != NULL)
+    {
+      writer.SetProgressListener(*listener);
+    }
+
+    writer.WriteHeader(nifti);
+
+    if (randomAccess)
+    {
+      // The instances are decoded in storage order, each of them only once
+      if (decodingThreads_ > 1)
+      {
+        PluginFrameDecoder::Factory factory(collection, useRawFrames_, instanceCacheSize_);
+        IDicomFrameDecoder::ApplyRandomAccess(writer, factory, slices, decodingThreads_);
+      }
+      else
+      {
+        PluginFrameDecoder decoder(collection, useRawFrames_, instanceCacheSize_);
+        IDicomFrameDecoder::ApplyRandomAccess(writer, decoder, slices);
+      }
+    }
+    else
+    {
+      // The slices must be decoded in the order of the NIfTI volume
+      if (decodingThreads_ > 1)
+      {
+        PluginFrameDecoder::Factory factory(collection, useRawFrames_, instanceCacheSize_);
+        IDicomFrameDecoder::Apply(writer, factory, slices, decodingThreads_, frameCacheSize_);
+      }
+      else
+      {
+        PluginFrameDecoder decoder(collection, useRawFrames_, instanceCacheSize_);
+        IDicomFrameDecoder::Apply(writer, decoder, slices, frameCacheSize_);
+      }
+    }
+  }
+
+
+  void* SeriesConverter::AllocateNifti(NiftiFile& target,
+                                       size_t size) const
+  {
+    if (mappedThreshold_ != 0 &&
+        size >= mappedThreshold_)
+    {
+      return target.CreateMappedFile(temporaryDirectory_, size);
+    }
+    else
+    {
+      target.GetMemory().resize(size);
+      return &target.GetMemory()[0];
+    }
+  }
+
+
+  void SeriesConverter::CreateNifti(NiftiFile& target,
+                                    const nifti_image& nifti,
+                                    const std::vector<Slice>& slices,
+                                    const DicomInstancesCollection& collection,
+                                    bool compress,
+                                    NiftiWriter::IProgressListener* listener) const
+  {
+    /**
+     * The Orthanc plugin SDK doesn't provide a primitive to stream a
+     * non-multipart HTTP body, so the answer has to be sent as a single
+     * buffer. The header and the slices are written directly into this
+     * buffer as they get decoded, which avoids the intermediate copy of
+     * the full volume into a "ChunkedBuffer" that would be flattened
+     * afterward.
+     **/
+    if (compress)
+    {
+      StringOutputStream output(target.GetMemory());
+
+      // The compression is done slice by slice, which never holds the uncompressed file
+      if (compressionThreads_ > 1)
+      {
+        ParallelGzipOutputStream gzip(output, compressionLevel_, compressionThreads_);
+        NiftiWriter writer(gzip);
+        WriteNifti(writer, nifti, collection, slices, false /* sequential */, listener);
+        gzip.Finish();
+      }
+      else
+      {
+        GzipOutputStream gzip(output, compressionLevel_);
+        NiftiWriter writer(gzip);
+        WriteNifti(writer, nifti, collection, slices, false /* sequential */, listener);
+        gzip.Finish();
+      }
+    }
+    else
+    {
+      // The size of the file is known in advance: The slices are written in place
+      const size_t size = NiftiWriter::ComputeFileSize(nifti);
+
+      NiftiWriter writer(AllocateNifti(target, size), size);
+      WriteNifti(writer, nifti, collection, slices, true /* random access */, listener);
+
+      if (writer.GetPosition() != size)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                        "The NIfTI file is smaller than expected");
+      }
+    }
+  }
+
+
+  void SeriesConverter::CreatePartialNifti(std::string& target,
+                                           size_t& offset,
+                                           const nifti_image& nifti,
+                                           const std::vector<Slice>& slices,
+                                           const DicomInstancesCollection& collection,
+                                           uint64_t start,
+                                           uint64_t end) const
+  {
+    size_t firstSlice, endSlice;
+    NiftiWriter::LocateSlices(firstSlice, endSlice, nifti, start, end);
+
+    if (endSlice > slices.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    const std::vector<Slice> selected(slices.begin() + firstSlice, slices.begin() + endSlice);
+    const size_t sliceSize = NiftiWriter::ComputeSliceSize(nifti);
+    const size_t size = NiftiWriter::GetHeaderSize() + selected.size() * sliceSize;
+
+    LOG(INFO) << "Partial NIfTI file: Decoding " << selected.size() << " out of " << slices.size() << " slice(s)";
+
+    target.resize(size);
+
+    NiftiWriter writer(&target[0], size);
+    WriteNifti(writer, nifti, collection, selected, true /* random access */, NULL /* no listener */);
+
+    if (writer.GetPosition() != size)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError,
+                                      "The NIfTI file is smaller than expected");
+    }
+
+    // If "start" is in the header, "firstSlice" is zero
+    offset = static_cast<size_t>(start - static_cast<uint64_t>(firstSlice) * static_cast<uint64_t>(sliceSize));
+  }
+
+
+  void SeriesConverter::StoreInCache(const std::string& seriesId,
+                                     const std::string& fingerprint,
+                                     bool compress,
+                                     const NiftiFile& nifti) const
+  {
+    try
+    {
+      GetCache().Store(seriesId, fingerprint, compress, nifti.GetData(), nifti.GetSize());
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      // Not being able to cache the file is not an error for the client
+      LOG(ERROR) << "Cannot cache the NIfTI file of series " << seriesId << ": " << e.What();
+    }
+  }
+
+
+  void SeriesConverter::ConvertSeries(NiftiFile& target,
+                                      Json::Value* sidecar,
+                                      const std::string& seriesId,
+                                      bool compress,
+                                      NiftiWriter::IProgressListener* listener) const
+  {
+    std::vector<std::string> instances;
+    PluginToolbox::GetSeriesInstances(instances, seriesId);
+
+    std::string fingerprint;
+    bool isCached = false;
+
+    if (cache_.get() != NULL)
+    {
+      NiftiCache::ComputeFingerprint(fingerprint, instances);
+      isCached = cache_->Lookup(target.GetCachedFile(), seriesId, fingerprint, compress);
+    }
+
+    if (isCached &&
+        sidecar == NULL)
+    {
+      return;
+    }
+
+    // If the NIfTI file is cached, only the DICOM tags are needed
+    DicomInstancesCollection collection;
+    LoadSeries(collection, seriesId, instances);
+
+    nifti_image header;
+    std::vector<Slice> slices;
+    collection.CreateNiftiHeader(header, slices);
+
+    if (sidecar != NULL)
+    {
+      FormatSidecar(*sidecar, collection, header, slices);
+    }
+
+    if (!isCached)
+    {
+      if (!compress)
+      {
+        PluginToolbox::CheckAnswerSize(NiftiWriter::ComputeFileSize(header));
+      }
+
+      CreateNifti(target, header, slices, collection, compress, listener);
+
+      if (cache_.get() != NULL)
+      {
+        StoreInCache(seriesId, fingerprint, compress, target);
+      }
+    }
+  }
+}
@@ -0,0 +1,223 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "NiftiFile.h"
+
+#include "../Framework/DicomInstancesCollection.h"
+#include "../Framework/NiftiCache.h"
+#include "../Framework/NiftiWriter.h"
+
+#include <boost/noncopyable.hpp>
+#include <json/value.h>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+
+namespace Neuro
+{
+  /**
+   * Conversion of the series that are stored in Orthanc to NIfTI,
+   * using the parameters of the "Neuro" configuration section. The
+   * DICOM tags are read through the REST API of Orthanc, and the
+   * frames are decoded by "PluginFrameDecoder". The parameters must be
+   * set before the converter is shared between several threads.
+   **/
+  class SeriesConverter : public boost::noncopyable
+  {
+  private:
+    class InstanceReader;
+
+    uint8_t                      compressionLevel_;
+    unsigned int                 compressionThreads_;
+    unsigned int                 decodingThreads_;
+    unsigned int                 loadingThreads_;
+    bool                         useRawFrames_;
+    size_t                       frameCacheSize_;
+    size_t                       instanceCacheSize_;
+    uint64_t                     mappedThreshold_;
+    std::string                  temporaryDirectory_;
+    std::set<Orthanc::DicomTag>  requiredTags_;  // Tags that are needed to create "InputDicomInstance"
+    std::unique_ptr<NiftiCache>  cache_;
+
+  public:
+    SeriesConverter();
+
+    // The level of gzip compression must be between 0 and 9
+    void SetCompression(unsigned int level,
+                        unsigned int countThreads);
+
+    uint8_t GetCompressionLevel() const
+    {
+      return compressionLevel_;
+    }
+
+    unsigned int GetCompressionThreads() const
+    {
+      return compressionThreads_;
+    }
+
+    // Number of threads decoding the frames of one NIfTI file
+    void SetDecodingThreads(unsigned int countThreads);
+
+    unsigned int GetDecodingThreads() const
+    {
+      return decodingThreads_;
+    }
+
+    // Number of threads reading the DICOM tags of the instances of one series
+    void SetLoadingThreads(unsigned int countThreads);
+
+    unsigned int GetLoadingThreads() const
+    {
+      return loadingThreads_;
+    }
+
+    // Whether to read the uncompressed frames directly, without parsing the full DICOM file
+    void SetRawFrames(bool useRawFrames)
+    {
+      useRawFrames_ = useRawFrames;
+    }
+
+    bool IsRawFrames() const
+    {
+      return useRawFrames_;
+    }
+
+    // Memory budget of the cache of the decoded frames that are used by non-consecutive slices
+    void SetFrameCacheSize(size_t size /* in bytes */)
+    {
+      frameCacheSize_ = size;
+    }
+
+    size_t GetFrameCacheSize() const
+    {
+      return frameCacheSize_;
+    }
+
+    // Memory budget of the cache of the parsed DICOM instances, in each frame decoder
+    void SetInstanceCacheSize(size_t size /* in bytes */)
+    {
+      instanceCacheSize_ = size;
+    }
+
+    size_t GetInstanceCacheSize() const
+    {
+      return instanceCacheSize_;
+    }
+
+    /**
+     * Uncompressed NIfTI files above "threshold" bytes are written to
+     * a memory-mapped temporary file in "temporaryDirectory" (0 to
+     * disable). If the directory is empty, the default temporary
+     * directory of the system is used.
+     **/
+    void SetMemoryMapping(uint64_t threshold,
+                          const std::string& temporaryDirectory);
+
+    // Optional persistent cache of the NIfTI files generated for series (takes ownership, can be NULL)
+    void SetCache(NiftiCache* cache);
+
+    bool HasCache() const
+    {
+      return cache_.get() != NULL;
+    }
+
+    NiftiCache& GetCache() const;
+
+    InputDicomInstance* AcquireInstance(const std::string& instanceId) const;
+
+    void LoadSeries(DicomInstancesCollection& collection,
+                    const std::string& seriesId,
+                    const std::vector<std::string>& instances) const;
+
+    /**
+     * Creates the NIfTI header of a series, restricted to the sub-volume
+     * given by the "slicesRange" and "volumesRange" arguments, which are
+     * formatted as "first" or "first-last" (0-based indices). An empty
+     * range selects all the slices or all the volumes.
+     **/
+    static void CreateNiftiHeader(nifti_image& nifti,
+                                  std::vector<Slice>& slices,
+                                  const DicomInstancesCollection& collection,
+                                  const std::string& slicesRange,
+                                  const std::string& volumesRange);
+
+    // Same fields as dcm2niix to identify the software that created the NIfTI file
+    static void FormatSidecar(Json::Value& target,
+                              const DicomInstancesCollection& collection,
+                              const nifti_image& header,
+                              const std::vector<Slice>& slices);
+
+    void WriteNifti(NiftiWriter& writer,
+                    const nifti_image& nifti,
+                    const DicomInstancesCollection& collection,
+                    const std::vector<Slice>& slices,
+                    bool randomAccess,
+                    NiftiWriter::IProgressListener* listener /* can be NULL */) const;
+
+    // Preallocates the memory area of an uncompressed NIfTI file
+    void* AllocateNifti(NiftiFile& target,
+                        size_t size) const;
+
+    void CreateNifti(NiftiFile& target,
+                     const nifti_image& nifti,
+                     const std::vector<Slice>& slices,
+                     const DicomInstancesCollection& collection,
+                     bool compress,
+                     NiftiWriter::IProgressListener* listener /* can be NULL */) const;
+
+    /**
+     * Only decodes the slices that overlap the bytes "[start, end)" of
+     * the uncompressed NIfTI file. The header and these slices are
+     * written into "target", in which the byte "start" of the full file
+     * is located at "offset".
+     **/
+    void CreatePartialNifti(std::string& target,
+                            size_t& offset,
+                            const nifti_image& nifti,
+                            const std::vector<Slice>& slices,
+                            const DicomInstancesCollection& collection,
+                            uint64_t start,
+                            uint64_t end) const;
+
+    // Not being able to cache the file is only logged, as it is not an error for the client
+    void StoreInCache(const std::string& seriesId,
+                      const std::string& fingerprint,
+                      bool compress,
+                      const NiftiFile& nifti) const;
+
+    /**
+     * Converts a full series, taking advantage of the cache of NIfTI
+     * files (if enabled). If "sidecar" is not NULL, it is filled with the
+     * JSON sidecar of the NIfTI file, from the same DICOM tags that are
+     * used to create the NIfTI header. The "listener" (that can be NULL)
+     * is notified after each slice, and can interrupt the conversion by
+     * throwing an exception.
+     **/
+    void ConvertSeries(NiftiFile& target,
+                       Json::Value* sidecar,
+                       const std::string& seriesId,
+                       bool compress,
+                       NiftiWriter::IProgressListener* listener) const;
+  };
+}
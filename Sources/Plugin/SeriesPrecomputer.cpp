@@ -0,0 +1,312 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "SeriesPrecomputer.h"
+
+#include "PluginToolbox.h"
+
+#include "../../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <cassert>
+
+
+namespace Neuro
+{
+  // Interrupts the conversion as soon as the precomputer is stopped
+  class SeriesPrecomputer::CancellationListener : public NiftiWriter::IProgressListener
+  {
+  private:
+    SeriesPrecomputer&  that_;
+
+  public:
+    explicit CancellationListener(SeriesPrecomputer& that) :
+      that_(that)
+    {
+    }
+
+    virtual void SignalProgress(size_t position) ORTHANC_OVERRIDE
+    {
+      if (that_.IsDone())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CanceledJob);
+      }
+    }
+  };
+
+
+  bool SeriesPrecomputer::IsDone()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return done_;
+  }
+
+  bool SeriesPrecomputer::DequeueSeries(std::string& seriesId)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (;;)
+    {
+      if (done_)
+      {
+        return false;
+      }
+
+      for (std::deque<std::string>::iterator it = queue_.begin(); it != queue_.end(); ++it)
+      {
+        if (running_.find(*it) == running_.end())
+        {
+          seriesId = *it;
+          queue_.erase(it);
+          queued_.erase(seriesId);
+          running_.insert(seriesId);
+          return true;
+        }
+      }
+
+      queueChanged_.wait(lock);
+    }
+  }
+
+  void SeriesPrecomputer::SignalSeriesDone(const std::string& seriesId)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      running_.erase(seriesId);
+    }
+
+    // The same series might be waiting in the queue
+    queueChanged_.notify_all();
+  }
+
+  void SeriesPrecomputer::Process(const std::string& seriesId)
+  {
+    Json::Value series;
+    if (!OrthancPlugins::RestApiGet(series, "/series/" + seriesId, false))
+    {
+      return;  // The series was deleted in the meantime
+    }
+
+    const std::string modality = PluginToolbox::GetMainDicomTag(series, "MainDicomTags", "Modality");
+    if (modality != "MR" &&
+        modality != "PT")
+    {
+      return;
+    }
+
+    std::vector<std::string> instances;
+    PluginToolbox::GetSeriesInstances(instances, seriesId);
+
+    std::string fingerprint;
+    NiftiCache::ComputeFingerprint(fingerprint, instances);
+
+    if (converter_.GetCache().Contains(seriesId, fingerprint, compress_))
+    {
+      return;
+    }
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    {
+      CancellationListener listener(*this);
+      NiftiFile nifti;
+      converter_.ConvertSeries(nifti, NULL, seriesId, compress_, &listener);
+    }
+
+    const boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      countConverted_++;
+      totalDuration_ += elapsed.total_milliseconds();
+    }
+
+    LOG(INFO) << "Series " << seriesId << " precomputed as NIfTI in " << elapsed.total_milliseconds() << "ms";
+  }
+
+  void SeriesPrecomputer::Worker(SeriesPrecomputer* that)
+  {
+    assert(that != NULL);
+
+    std::string seriesId;
+
+    while (that->DequeueSeries(seriesId))
+    {
+      try
+      {
+        that->Process(seriesId);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        if (that->IsDone())
+        {
+          // Either canceled by "CancellationListener", or the REST
+          // API of Orthanc is not available anymore
+          LOG(INFO) << "Precomputation of the NIfTI file of series " << seriesId << " interrupted by the shutdown";
+          return;
+        }
+
+        LOG(ERROR) << "Cannot precompute the NIfTI file of series " << seriesId << ": " << e.What();
+
+        boost::mutex::scoped_lock lock(that->mutex_);
+        that->countFailed_++;
+      }
+      catch (...)
+      {
+        LOG(ERROR) << "Native exception while precomputing the NIfTI file of series " << seriesId;
+
+        boost::mutex::scoped_lock lock(that->mutex_);
+        that->countFailed_++;
+      }
+
+      that->SignalSeriesDone(seriesId);
+    }
+  }
+
+  SeriesPrecomputer::SeriesPrecomputer(const SeriesConverter& converter,
+                                       size_t queueSize,
+                                       bool compress) :
+    converter_(converter),
+    queueSize_(queueSize),
+    compress_(compress),
+    done_(false),
+    countConverted_(0),
+    countFailed_(0),
+    countDropped_(0),
+    totalDuration_(0)
+  {
+    if (!converter.HasCache())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "The precomputation of NIfTI files requires a cache");
+    }
+
+    if (queueSize == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "The size of the queue of the series to be precomputed cannot be zero");
+    }
+  }
+
+
+  SeriesPrecomputer::~SeriesPrecomputer()
+  {
+    Stop();
+  }
+
+  void SeriesPrecomputer::Start(unsigned int countThreads)
+  {
+    if (!workers_.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      done_ = false;
+    }
+
+    for (unsigned int i = 0; i < countThreads; i++)
+    {
+      workers_.push_back(new boost::thread(Worker, this));
+    }
+  }
+
+  void SeriesPrecomputer::SignalStop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      done_ = true;
+    }
+
+    queueChanged_.notify_all();
+  }
+
+  void SeriesPrecomputer::Stop()
+  {
+    SignalStop();
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      workers_[i]->join();
+      delete workers_[i];
+    }
+
+    workers_.clear();
+  }
+
+  void SeriesPrecomputer::Enqueue(const std::string& seriesId)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (queued_.find(seriesId) != queued_.end())
+      {
+        return;  // Already waiting
+      }
+
+      if (queue_.size() >= queueSize_)
+      {
+        LOG(WARNING) << "The queue of the series to be converted to NIfTI is full, the oldest series "
+                     << "is dropped and will be converted on demand";
+
+        queued_.erase(queue_.front());
+        queue_.pop_front();
+        countDropped_++;
+      }
+
+      queue_.push_back(seriesId);
+      queued_.insert(seriesId);
+    }
+
+    queueChanged_.notify_one();
+  }
+
+  void SeriesPrecomputer::PublishMetrics()
+  {
+    OrthancPluginContext* context = OrthancPlugins::GetGlobalContext();
+
+    uint64_t countConverted, countFailed, countDropped, totalDuration;
+    size_t queueSize;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      queueSize = queue_.size();
+      countConverted = countConverted_;
+      countFailed = countFailed_;
+      countDropped = countDropped_;
+      totalDuration = totalDuration_;
+    }
+
+    // The throughput is the rate of "orthanc_neuro_precompute_converted_count"
+    OrthancPluginSetMetricsValue(context, "orthanc_neuro_precompute_queue_size",
+                                 static_cast<float>(queueSize), OrthancPluginMetricsType_Default);
+    OrthancPluginSetMetricsValue(context, "orthanc_neuro_precompute_converted_count",
+                                 static_cast<float>(countConverted), OrthancPluginMetricsType_Default);
+    OrthancPluginSetMetricsValue(context, "orthanc_neuro_precompute_failed_count",
+                                 static_cast<float>(countFailed), OrthancPluginMetricsType_Default);
+    OrthancPluginSetMetricsValue(context, "orthanc_neuro_precompute_dropped_count",
+                                 static_cast<float>(countDropped), OrthancPluginMetricsType_Default);
+    OrthancPluginSetMetricsValue(context, "orthanc_neuro_precompute_average_duration_ms",
+                                 (countConverted == 0 ? 0.0f :
+                                  static_cast<float>(totalDuration) / static_cast<float>(countConverted)),
+                                 OrthancPluginMetricsType_Default);
+  }}
@@ -0,0 +1,101 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "SeriesConverter.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+
+namespace Neuro
+{
+  /**
+   * Pool of workers that convert the MR and PET series as soon as they
+   * are stable, off the request path. The NIfTI files are stored in the
+   * cache of NIfTI files of the converter, so that "/series/{id}/nifti"
+   * only has to read them. A series is queued at most once, and is never
+   * converted by two workers at the same time. If the queue is full, the
+   * oldest series is dropped and is converted on demand. The conversions
+   * that are running when the precomputer is stopped are interrupted
+   * between two slices.
+   **/
+  class SeriesPrecomputer : public boost::noncopyable
+  {
+  private:
+    class CancellationListener;
+
+    const SeriesConverter&       converter_;
+    size_t                       queueSize_;
+    bool                         compress_;
+    std::vector<boost::thread*>  workers_;
+
+    boost::mutex                 mutex_;
+    boost::condition_variable    queueChanged_;
+    bool                         done_;
+    std::deque<std::string>      queue_;    // Series waiting for a worker, the oldest first
+    std::set<std::string>        queued_;   // Content of "queue_"
+    std::set<std::string>        running_;  // Series that are being converted by a worker
+    uint64_t                     countConverted_;
+    uint64_t                     countFailed_;
+    uint64_t                     countDropped_;
+    uint64_t                     totalDuration_;  // In milliseconds
+
+    bool IsDone();
+
+    /**
+     * Waits for the oldest series that is not being converted by
+     * another worker, and marks it as running. Returns "false" if the
+     * precomputer is stopped.
+     **/
+    bool DequeueSeries(std::string& seriesId);
+
+    void SignalSeriesDone(const std::string& seriesId);
+
+    void Process(const std::string& seriesId);
+
+    static void Worker(SeriesPrecomputer* that);
+
+  public:
+    // The "converter" must have a cache, and must outlive the precomputer
+    SeriesPrecomputer(const SeriesConverter& converter,
+                      size_t queueSize,
+                      bool compress);
+
+    ~SeriesPrecomputer();
+
+    void Start(unsigned int countThreads);
+
+    // Asks the workers to stop, without waiting for them
+    void SignalStop();
+
+    void Stop();
+
+    void Enqueue(const std::string& seriesId);
+
+    void PublishMetrics();
+  };
+}
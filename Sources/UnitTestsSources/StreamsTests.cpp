@@ -0,0 +1,1118 @@
+/**
+ * Neuroimaging plugin for Orthanc
+ * Copyright (C) 2021-2026 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include <gtest/gtest.h>
+
+#include "../Framework/DecodedFrameCache.h"
+#include "../Framework/GzipOutputStream.h"
+#include "../Framework/IDicomFrameDecoder.h"
+#include "../Framework/IDicomInstanceReader.h"
+#include "../Framework/MappedTemporaryFile.h"
+#include "../Framework/NiftiCache.h"
+#include "../Framework/NiftiWriter.h"
+#include "../Framework/ParallelGzipOutputStream.h"
+#include "../Framework/StringOutputStream.h"
+
+#include <Compression/GzipCompressor.h>
+#include <Images/Image.h>
+#include <OrthancException.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+
+static void CreateTestHeader(nifti_image& nifti,
+                             unsigned int width,
+                             unsigned int height,
+                             unsigned int depth)
+{
+  memset(&nifti, 0, sizeof(nifti));
+  nifti.nifti_type = NIFTI_FTYPE_NIFTI1_1;
+  nifti.datatype = NIFTI_TYPE_UINT16;
+  nifti.nbyper = 2;
+  nifti.scl_slope = 1;
+  nifti.dim[0] = nifti.ndim = 3;
+  nifti.dim[1] = nifti.nx = width;
+  nifti.dim[2] = nifti.ny = height;
+  nifti.dim[3] = nifti.nz = depth;
+  nifti.pixdim[1] = nifti.dx = 1;
+  nifti.pixdim[2] = nifti.dy = 1;
+  nifti.pixdim[3] = nifti.dz = 1;
+  nifti.nvox = width * height * depth;
+}
+
+
+static void FillTestSlice(Orthanc::ImageAccessor& slice,
+                          unsigned int seed)
+{
+  for (unsigned int y = 0; y < slice.GetHeight(); y++)
+  {
+    uint16_t* p = reinterpret_cast<uint16_t*>(slice.GetRow(y));
+    for (unsigned int x = 0; x < slice.GetWidth(); x++)
+    {
+      p[x] = static_cast<uint16_t>(seed * 1000 + y * 10 + x);
+    }
+  }
+}
+
+
+TEST(NiftiWriter, OutputStream)
+{
+  nifti_image nifti;
+  CreateTestHeader(nifti, 3, 2, 4);
+
+  Orthanc::Image slice(Orthanc::PixelFormat_Grayscale16, 3, 2, false);
+
+  std::string buffered;
+
+  {
+    Neuro::NiftiWriter writer;
+    writer.WriteHeader(nifti);
+
+    for (unsigned int z = 0; z < 4; z++)
+    {
+      FillTestSlice(slice, z);
+      writer.AddSlice(slice);
+    }
+
+    writer.Flatten(buffered, false);
+  }
+
+  std::string streamed;
+
+  {
+    Neuro::StringOutputStream output(streamed);
+    Neuro::NiftiWriter writer(output);
+    writer.WriteHeader(nifti);
+
+    for (unsigned int z = 0; z < 4; z++)
+    {
+      FillTestSlice(slice, z);
+      writer.AddSlice(slice);
+    }
+
+    std::string s;
+    ASSERT_THROW(writer.Flatten(s, false), Orthanc::OrthancException);
+  }
+
+  ASSERT_EQ(Neuro::NiftiWriter::ComputeFileSize(nifti), buffered.size());
+  ASSERT_EQ(buffered, streamed);
+
+  // Check the vertical flip of the last slice
+  const uint16_t* voxels = reinterpret_cast<const uint16_t*>(streamed.c_str() + 352);
+  ASSERT_EQ(3010u, voxels[3 * 2 * 3]);
+  ASSERT_EQ(3000u, voxels[3 * 2 * 3 + 3]);
+}
+
+
+TEST(NiftiWriter, InPlace)
+{
+  nifti_image nifti;
+  CreateTestHeader(nifti, 3, 2, 4);
+
+  // Slice with a pitch that is larger than its row size
+  Orthanc::Image slice(Orthanc::PixelFormat_Grayscale16, 3, 2, false);
+  Orthanc::Image large(Orthanc::PixelFormat_Grayscale16, 5, 2, false);
+  Orthanc::ImageAccessor region;
+  large.GetRegion(region, 1, 0, 3, 2);
+
+  std::string streamed;
+
+  {
+    Neuro::StringOutputStream output(streamed);
+    Neuro::NiftiWriter writer(output);
+    writer.WriteHeader(nifti);
+
+    for (unsigned int z = 0; z < 4; z++)
+    {
+      FillTestSlice(slice, z);
+      writer.AddSlice(slice);
+    }
+
+    ASSERT_EQ(streamed.size(), writer.GetPosition());
+  }
+
+  std::string inPlace;
+  inPlace.resize(Neuro::NiftiWriter::ComputeFileSize(nifti));
+
+  {
+    Neuro::NiftiWriter writer(&inPlace[0], inPlace.size());
+    writer.WriteHeader(nifti);
+
+    for (unsigned int z = 0; z < 4; z++)
+    {
+      FillTestSlice(region, z);
+      writer.AddSlice(region);
+    }
+
+    ASSERT_EQ(inPlace.size(), writer.GetPosition());
+
+    // No room left for another slice
+    ASSERT_THROW(writer.AddSlice(region), Orthanc::OrthancException);
+
+    std::string s;
+    ASSERT_THROW(writer.Flatten(s, false), Orthanc::OrthancException);
+  }
+
+  ASSERT_EQ(streamed, inPlace);
+}
+
+
+TEST(NiftiWriter, LocateSlices)
+{
+  nifti_image nifti;
+  CreateTestHeader(nifti, 3, 2, 4);
+
+  const size_t header = Neuro::NiftiWriter::GetHeaderSize();
+  ASSERT_EQ(352u, header);
+  ASSERT_EQ(12u, Neuro::NiftiWriter::ComputeSliceSize(nifti));
+  ASSERT_EQ(header + 4u * 12u, Neuro::NiftiWriter::ComputeFileSize(nifti));
+
+  size_t first, end;
+  Neuro::NiftiWriter::LocateSlices(first, end, nifti, 0, header);
+  ASSERT_EQ(0u, first);  ASSERT_EQ(0u, end);
+  Neuro::NiftiWriter::LocateSlices(first, end, nifti, 0, header + 1);
+  ASSERT_EQ(0u, first);  ASSERT_EQ(1u, end);
+  Neuro::NiftiWriter::LocateSlices(first, end, nifti, header + 12, header + 24);
+  ASSERT_EQ(1u, first);  ASSERT_EQ(2u, end);
+  Neuro::NiftiWriter::LocateSlices(first, end, nifti, header + 11, header + 25);
+  ASSERT_EQ(0u, first);  ASSERT_EQ(3u, end);
+  Neuro::NiftiWriter::LocateSlices(first, end, nifti, header + 47, header + 48);
+  ASSERT_EQ(3u, first);  ASSERT_EQ(4u, end);
+  Neuro::NiftiWriter::LocateSlices(first, end, nifti, 100, 1000);  // Clamped to the end of the file
+  ASSERT_EQ(0u, first);  ASSERT_EQ(4u, end);
+  ASSERT_THROW(Neuro::NiftiWriter::LocateSlices(first, end, nifti, 10, 5), Orthanc::OrthancException);
+
+  // Writing the located slices gives the same bytes as the full file
+  Orthanc::Image slice(Orthanc::PixelFormat_Grayscale16, 3, 2, false);
+  
+  std::string full;
+  full.resize(Neuro::NiftiWriter::ComputeFileSize(nifti));
+
+  {
+    Neuro::NiftiWriter writer(&full[0], full.size());
+    writer.WriteHeader(nifti);
+    for (unsigned int z = 0; z < 4; z++)
+    {
+      FillTestSlice(slice, z);
+      writer.WriteSlice(z, slice);
+    }
+  }
+
+  const size_t start = header + 17;
+  Neuro::NiftiWriter::LocateSlices(first, end, nifti, start, start + 20);
+  ASSERT_EQ(1u, first);  ASSERT_EQ(4u, end);
+
+  std::string partial;
+  partial.resize(header + (end - first) * 12u);
+
+  {
+    Neuro::NiftiWriter writer(&partial[0], partial.size());
+    writer.WriteHeader(nifti);
+    for (size_t z = first; z < end; z++)
+    {
+      FillTestSlice(slice, z);
+      writer.WriteSlice(z - first, slice);
+    }
+  }
+
+  ASSERT_EQ(full.substr(start, 20), partial.substr(start - first * 12u, 20));
+  ASSERT_EQ(full.substr(0, header), partial.substr(0, header));
+}
+
+
+TEST(NiftiWriter, FormatHeader)
+{
+  nifti_image nifti;
+  CreateTestHeader(nifti, 3, 2, 4);
+
+  std::string written;
+
+  {
+    Neuro::NiftiWriter writer;
+    writer.WriteHeader(nifti);
+    writer.Flatten(written, false);
+  }
+
+  ASSERT_EQ(Neuro::NiftiWriter::GetHeaderSize(), written.size());
+
+  nifti_1_header serialized;
+  Neuro::NiftiWriter::SerializeHeader(serialized, nifti);
+  ASSERT_EQ(0, memcmp(&serialized, written.c_str(), sizeof(serialized)));
+
+  Json::Value json;
+  Neuro::NiftiWriter::FormatHeader(json, nifti);
+  ASSERT_EQ(Json::objectValue, json.type());
+  ASSERT_EQ(348, json["sizeof_hdr"].asInt());
+  ASSERT_FLOAT_EQ(352.0f, json["vox_offset"].asFloat());
+  ASSERT_EQ(8u, json["dim"].size());
+  ASSERT_EQ(3, json["dim"][1].asInt());
+  ASSERT_EQ(4u, json["srow_x"].size());
+  ASSERT_EQ(Json::stringValue, json["descrip"].type());
+
+  nifti.nifti_type = NIFTI_FTYPE_ANALYZE;
+  ASSERT_THROW(Neuro::NiftiWriter::FormatHeader(json, nifti), Orthanc::OrthancException);
+}
+
+
+namespace
+{
+  class TestProgressListener : public Neuro::NiftiWriter::IProgressListener
+  {
+  private:
+    boost::mutex         mutex_;
+    std::vector<size_t>  positions_;
+    size_t               abortAfter_;
+
+  public:
+    explicit TestProgressListener(size_t abortAfter) :
+      abortAfter_(abortAfter)
+    {
+    }
+
+    virtual void SignalProgress(size_t position) ORTHANC_OVERRIDE
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      positions_.push_back(position);
+
+      if (positions_.size() >= abortAfter_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CanceledJob);
+      }
+    }
+
+    const std::vector<size_t>& GetPositions() const
+    {
+      return positions_;
+    }
+  };
+}
+
+
+TEST(NiftiWriter, ProgressListener)
+{
+  nifti_image nifti;
+  CreateTestHeader(nifti, 3, 2, 4);
+
+  Orthanc::Image slice(Orthanc::PixelFormat_Grayscale16, 3, 2, false);
+  FillTestSlice(slice, 0);
+
+  const size_t header = Neuro::NiftiWriter::GetHeaderSize();
+
+  {
+    std::string streamed;
+    Neuro::StringOutputStream output(streamed);
+
+    TestProgressListener listener(100);
+    Neuro::NiftiWriter writer(output);
+    writer.SetProgressListener(listener);
+    writer.WriteHeader(nifti);
+    ASSERT_TRUE(listener.GetPositions().empty());
+
+    for (unsigned int z = 0; z < 4; z++)
+    {
+      writer.AddSlice(slice);
+    }
+
+    ASSERT_EQ(4u, listener.GetPositions().size());
+    for (size_t z = 0; z < 4; z++)
+    {
+      ASSERT_EQ(header + (z + 1) * 12u, listener.GetPositions()[z]);
+    }
+  }
+
+  {
+    std::string inPlace;
+    inPlace.resize(Neuro::NiftiWriter::ComputeFileSize(nifti));
+
+    TestProgressListener listener(2);
+    Neuro::NiftiWriter writer(&inPlace[0], inPlace.size());
+    writer.SetProgressListener(listener);
+    writer.WriteHeader(nifti);
+
+    writer.WriteSlice(3, slice);
+    ASSERT_THROW(writer.WriteSlice(1, slice), Orthanc::OrthancException);  // Aborted by the listener
+
+    ASSERT_EQ(2u, listener.GetPositions().size());
+    ASSERT_EQ(header + 12u, listener.GetPositions()[0]);
+    ASSERT_EQ(header + 24u, listener.GetPositions()[1]);
+  }
+}
+
+
+TEST(NiftiWriter, Conversion)
+{
+  // Slice with a pitch that is larger than its row size
+  Orthanc::Image large(Orthanc::PixelFormat_Grayscale16, 25, 2, false);
+  Orthanc::ImageAccessor slice;
+  large.GetRegion(slice, 1, 0, 21, 2);
+  FillTestSlice(slice, 3);
+
+  nifti_image nifti;
+  CreateTestHeader(nifti, 21, 2, 1);
+  nifti.datatype = NIFTI_TYPE_INT32;
+  nifti.nbyper = 4;
+
+  {
+    std::string s;
+    s.resize(Neuro::NiftiWriter::ComputeFileSize(nifti));
+
+    Neuro::NiftiWriter writer(&s[0], s.size());
+    writer.WriteHeader(nifti);
+    writer.AddSlice(slice);
+    ASSERT_EQ(s.size(), writer.GetPosition());
+
+    const int32_t* voxels = reinterpret_cast<const int32_t*>(s.c_str() + 352);
+    ASSERT_EQ(3010, voxels[0]);
+    ASSERT_EQ(3030, voxels[20]);
+    ASSERT_EQ(3000, voxels[21]);
+    ASSERT_EQ(3020, voxels[41]);
+  }
+
+  nifti.datatype = NIFTI_TYPE_FLOAT32;
+  nifti.nbyper = 4;
+
+  {
+    std::string s;
+    s.resize(Neuro::NiftiWriter::ComputeFileSize(nifti));
+
+    Neuro::NiftiWriter writer(&s[0], s.size());
+    writer.WriteHeader(nifti);
+    writer.WriteSlice(0, slice);
+
+    const float* voxels = reinterpret_cast<const float*>(s.c_str() + 352);
+    ASSERT_FLOAT_EQ(3010.0f, voxels[0]);
+    ASSERT_FLOAT_EQ(3020.0f, voxels[41]);
+  }
+
+  {
+    // Rescaling of the slice
+    std::string s;
+    s.resize(Neuro::NiftiWriter::ComputeFileSize(nifti));
+
+    Neuro::NiftiWriter writer(&s[0], s.size());
+    writer.WriteHeader(nifti);
+    writer.AddSlice(slice, 0.5, -1000);
+
+    const float* voxels = reinterpret_cast<const float*>(s.c_str() + 352);
+    ASSERT_FLOAT_EQ(505.0f, voxels[0]);
+    ASSERT_FLOAT_EQ(510.0f, voxels[41]);
+  }
+
+  {
+    Orthanc::Image slice32(Orthanc::PixelFormat_Grayscale32, 3, 2, false);
+    for (unsigned int y = 0; y < 2; y++)
+    {
+      uint32_t* p = reinterpret_cast<uint32_t*>(slice32.GetRow(y));
+      for (unsigned int x = 0; x < 3; x++)
+      {
+        p[x] = 4000000000u + y * 10 + x;
+      }
+    }
+
+    nifti_image nifti32;
+    CreateTestHeader(nifti32, 3, 2, 1);
+    nifti32.datatype = NIFTI_TYPE_FLOAT32;
+    nifti32.nbyper = 4;
+
+    std::string s;
+    s.resize(Neuro::NiftiWriter::ComputeFileSize(nifti32));
+
+    Neuro::NiftiWriter writer(&s[0], s.size());
+    writer.WriteHeader(nifti32);
+    writer.AddSlice(slice32, 0.001, 0);
+
+    const float* voxels = reinterpret_cast<const float*>(s.c_str() + 352);
+    ASSERT_FLOAT_EQ(4000000.0f, voxels[3]);
+  }
+
+  nifti.datatype = NIFTI_TYPE_UINT8;
+  nifti.nbyper = 1;
+
+  {
+    // Narrowing is not supported
+    std::string s;
+    Neuro::StringOutputStream output(s);
+    Neuro::NiftiWriter writer(output);
+    writer.WriteHeader(nifti);
+    ASSERT_THROW(writer.AddSlice(slice), Orthanc::OrthancException);
+  }
+}
+
+
+TEST(NiftiWriter, PixelFormats)
+{
+  // The pixel formats that are copied as such into the NIfTI file
+  const Orthanc::PixelFormat formats[] = {
+    Orthanc::PixelFormat_Grayscale8,
+    Orthanc::PixelFormat_Grayscale16,
+    Orthanc::PixelFormat_SignedGrayscale16,
+    Orthanc::PixelFormat_Grayscale32,
+    Orthanc::PixelFormat_Float32,
+    Orthanc::PixelFormat_RGB24
+  };
+
+  const int datatypes[] = {
+    NIFTI_TYPE_UINT8,
+    NIFTI_TYPE_UINT16,
+    NIFTI_TYPE_INT16,
+    NIFTI_TYPE_UINT32,
+    NIFTI_TYPE_FLOAT32,
+    NIFTI_TYPE_RGB24
+  };
+
+  for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+  {
+    const unsigned int bpp = Orthanc::GetBytesPerPixel(formats[i]);
+
+    Orthanc::Image slice(formats[i], 5, 3, false);
+    for (unsigned int y = 0; y < slice.GetHeight(); y++)
+    {
+      uint8_t* p = reinterpret_cast<uint8_t*>(slice.GetRow(y));
+      for (unsigned int x = 0; x < slice.GetWidth() * bpp; x++)
+      {
+        p[x] = static_cast<uint8_t>(y * 100 + x);
+      }
+    }
+
+    nifti_image nifti;
+    CreateTestHeader(nifti, 5, 3, 2);
+    nifti.datatype = datatypes[i];
+    nifti.nbyper = bpp;
+
+    std::string s;
+    Neuro::StringOutputStream output(s);
+    Neuro::NiftiWriter writer(output);
+    writer.WriteHeader(nifti);
+    writer.AddSlice(slice);
+    writer.AddSlice(slice, 2, 3);  // The rescaling is ignored if no conversion is needed
+
+    ASSERT_EQ(Neuro::NiftiWriter::ComputeFileSize(nifti), s.size());
+    ASSERT_EQ(s.substr(352, 15 * bpp), s.substr(352 + 15 * bpp));
+
+    for (unsigned int y = 0; y < 3; y++)
+    {
+      ASSERT_EQ(0, memcmp(s.c_str() + 352 + y * 5 * bpp, slice.GetConstRow(2 - y), 5 * bpp));
+    }
+  }
+}
+
+
+TEST(MappedTemporaryFile, NiftiWriter)
+{
+  nifti_image nifti;
+  CreateTestHeader(nifti, 3, 2, 4);
+
+  Orthanc::Image slice(Orthanc::PixelFormat_Grayscale16, 3, 2, false);
+
+  std::string expected;
+
+  {
+    Neuro::StringOutputStream output(expected);
+    Neuro::NiftiWriter writer(output);
+    writer.WriteHeader(nifti);
+
+    for (unsigned int z = 0; z < 4; z++)
+    {
+      FillTestSlice(slice, z);
+      writer.AddSlice(slice);
+    }
+  }
+
+  Neuro::MappedTemporaryFile file("", Neuro::NiftiWriter::ComputeFileSize(nifti));
+  ASSERT_EQ(expected.size(), file.GetSize());
+
+  {
+    Neuro::NiftiWriter writer(file.GetData(), file.GetSize());
+    writer.WriteHeader(nifti);
+
+    for (unsigned int z = 0; z < 4; z++)
+    {
+      FillTestSlice(slice, z);
+      writer.AddSlice(slice);
+    }
+  }
+
+  ASSERT_EQ(0, memcmp(expected.c_str(), file.GetData(), expected.size()));
+
+  ASSERT_THROW(Neuro::MappedTemporaryFile("", 0), Orthanc::OrthancException);
+}
+
+
+TEST(NiftiCache, CompressionLevel)
+{
+  const std::string directory = (boost::filesystem::temp_directory_path() /
+                                 boost::filesystem::unique_path()).string();
+
+  ASSERT_EQ("a_b.nii", Neuro::NiftiCache::GetKey("a", "b", false, 6));
+  ASSERT_EQ("a_b-6.nii.gz", Neuro::NiftiCache::GetKey("a", "b", true, 6));
+  ASSERT_NE(Neuro::NiftiCache::GetKey("a", "b", true, 6), Neuro::NiftiCache::GetKey("a", "b", true, 9));
+  ASSERT_THROW(Neuro::NiftiCache::GetKey("a_c", "b", true, 6), Orthanc::OrthancException);
+
+  {
+    Neuro::NiftiCache cache(directory, 1024 * 1024, 6);
+    cache.Store("series", "fingerprint", false, "uncompressed");
+    cache.Store("series", "fingerprint", true, "compressed");
+    ASSERT_EQ(2u, cache.GetCountEntries());
+
+    std::unique_ptr<Neuro::MappedFile> content;
+    ASSERT_TRUE(cache.Lookup(content, "series", "fingerprint", true));
+    ASSERT_EQ("compressed", std::string(reinterpret_cast<const char*>(content->GetData()), content->GetSize()));
+    ASSERT_FALSE(cache.Lookup(content, "series", "nope", true));
+  }
+
+  {
+    // The files compressed at another level must not be served
+    Neuro::NiftiCache cache(directory, 1024 * 1024, 9);
+    ASSERT_EQ(2u, cache.GetCountEntries());
+
+    std::unique_ptr<Neuro::MappedFile> content;
+    ASSERT_FALSE(cache.Lookup(content, "series", "fingerprint", true));
+    ASSERT_TRUE(cache.Lookup(content, "series", "fingerprint", false));
+    ASSERT_EQ("uncompressed", std::string(reinterpret_cast<const char*>(content->GetData()), content->GetSize()));
+
+    cache.InvalidateSeries("series");
+    ASSERT_EQ(0u, cache.GetCountEntries());
+  }
+
+  boost::filesystem::remove_all(directory);
+}
+
+
+static void CreateTestBuffer(std::string& target,
+                             size_t size)
+{
+  target.resize(size);
+  for (size_t i = 0; i < size; i++)
+  {
+    target[i] = static_cast<char>((i * 7) % 13 + (i / 65536) % 3);
+  }
+}
+
+
+TEST(GzipOutputStream, Basic)
+{
+  std::string source;
+  CreateTestBuffer(source, 1000000);
+
+  std::string compressed;
+
+  {
+    Neuro::StringOutputStream output(compressed);
+    Neuro::GzipOutputStream gzip(output, 6);
+
+    for (size_t pos = 0; pos < source.size(); pos += 12345)
+    {
+      gzip.Write(source.c_str() + pos, std::min(static_cast<size_t>(12345), source.size() - pos));
+    }
+
+    gzip.Finish();
+    ASSERT_THROW(gzip.Write("a", 1), Orthanc::OrthancException);
+  }
+
+  ASSERT_LT(compressed.size(), source.size());
+
+  std::string uncompressed;
+  Orthanc::GzipCompressor compressor;
+  Orthanc::IBufferCompressor::Uncompress(uncompressed, compressor, compressed);
+  ASSERT_EQ(source, uncompressed);
+}
+
+
+TEST(ParallelGzipOutputStream, Basic)
+{
+  // Test sizes below one block, on a block boundary, and above several blocks
+  const size_t sizes[] = { 1, 1000, 1024 * 1024, 5 * 1024 * 1024 + 17 };
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(size_t); i++)
+  {
+    std::string source;
+    CreateTestBuffer(source, sizes[i]);
+
+    std::string compressed;
+
+    {
+      Neuro::StringOutputStream output(compressed);
+      Neuro::ParallelGzipOutputStream gzip(output, 6, 3);
+
+      for (size_t pos = 0; pos < source.size(); pos += 77777)
+      {
+        gzip.Write(source.c_str() + pos, std::min(static_cast<size_t>(77777), source.size() - pos));
+      }
+
+      gzip.Finish();
+      ASSERT_THROW(gzip.Finish(), Orthanc::OrthancException);
+    }
+
+    std::string uncompressed;
+    Orthanc::GzipCompressor compressor;
+    Orthanc::IBufferCompressor::Uncompress(uncompressed, compressor, compressed);
+    ASSERT_EQ(source, uncompressed);
+  }
+}
+
+
+namespace
+{
+  class TestDecodedFrame : public Neuro::IDicomFrameDecoder::IDecodedFrame
+  {
+  private:
+    Orthanc::Image  image_;
+
+  public:
+    explicit TestDecodedFrame(unsigned int seed) :
+      image_(Orthanc::PixelFormat_Grayscale16, 8, 8, false)
+    {
+      FillTestSlice(image_, seed);
+    }
+
+    virtual void GetRegion(Orthanc::ImageAccessor& region,
+                           unsigned int x,
+                           unsigned int y,
+                           unsigned int width,
+                           unsigned int height) ORTHANC_OVERRIDE
+    {
+      image_.GetRegion(region, x, y, width, height);
+    }
+
+    virtual size_t GetMemorySize() const ORTHANC_OVERRIDE
+    {
+      return image_.GetPitch() * image_.GetHeight();
+    }
+  };
+
+
+  class TestDecoder : public Neuro::IDicomFrameDecoder
+  {
+  public:
+    virtual IDecodedFrame* DecodeFrame(const Neuro::Slice& slice) ORTHANC_OVERRIDE
+    {
+      if (slice.GetInstanceIndexInCollection() == 1000)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+      }
+      else
+      {
+        return new TestDecodedFrame(slice.GetInstanceIndexInCollection() * 3 + slice.GetFrameNumber());
+      }
+    }
+  };
+
+
+  class TestDecoderFactory : public Neuro::IDicomFrameDecoder::IFactory
+  {
+  public:
+    virtual Neuro::IDicomFrameDecoder* CreateDecoder() ORTHANC_OVERRIDE
+    {
+      return new TestDecoder;
+    }
+  };
+}
+
+
+static void CreateTestSlices(std::vector<Neuro::Slice>& slices,
+                             size_t countInstances)
+{
+  // Each frame is split as 4 slices of size 4x4, as in a mosaic
+  for (size_t i = 0; i < countInstances; i++)
+  {
+    for (unsigned int j = 0; j < 4; j++)
+    {
+      slices.push_back(Neuro::Slice(i, i % 3, static_cast<int32_t>(i), (j % 2) * 4, (j / 2) * 4, 4, 4, 0, 0, 0, 0, 0, 1));
+    }
+  }
+}
+
+
+TEST(IDicomFrameDecoder, Parallel)
+{
+  std::vector<Neuro::Slice> slices;
+  CreateTestSlices(slices, 100);
+
+  nifti_image nifti;
+  CreateTestHeader(nifti, 4, 4, slices.size());
+
+  std::string sequential;
+
+  {
+    Neuro::StringOutputStream output(sequential);
+    Neuro::NiftiWriter writer(output);
+    writer.WriteHeader(nifti);
+
+    TestDecoder decoder;
+    Neuro::IDicomFrameDecoder::Apply(writer, decoder, slices, 0);
+  }
+
+  ASSERT_EQ(Neuro::NiftiWriter::ComputeFileSize(nifti), sequential.size());
+
+  for (unsigned int threads = 1; threads <= 4; threads++)
+  {
+    std::string parallel;
+
+    Neuro::StringOutputStream output(parallel);
+    Neuro::NiftiWriter writer(output);
+    writer.WriteHeader(nifti);
+
+    TestDecoderFactory factory;
+    Neuro::IDicomFrameDecoder::Apply(writer, factory, slices, threads, 0);
+
+    ASSERT_EQ(sequential, parallel);
+  }
+
+  // Errors in the workers must be reported to the caller
+  slices.push_back(Neuro::Slice(1000, 0, 1000, 0, 0, 4, 4, 0, 0, 0, 0, 0, 1));
+
+  {
+    std::string s;
+    Neuro::StringOutputStream output(s);
+    Neuro::NiftiWriter writer(output);
+    writer.WriteHeader(nifti);
+
+    TestDecoderFactory factory;
+    ASSERT_THROW(Neuro::IDicomFrameDecoder::Apply(writer, factory, slices, 3, 0), Orthanc::OrthancException);
+  }
+}
+
+
+namespace
+{
+  class CountingDecoder : public TestDecoder
+  {
+  private:
+    boost::mutex&  mutex_;
+    unsigned int&  count_;
+
+  public:
+    CountingDecoder(boost::mutex& mutex,
+                    unsigned int& count) :
+      mutex_(mutex),
+      count_(count)
+    {
+    }
+
+    virtual IDecodedFrame* DecodeFrame(const Neuro::Slice& slice) ORTHANC_OVERRIDE
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        count_++;
+      }
+
+      return TestDecoder::DecodeFrame(slice);
+    }
+  };
+
+
+  class CountingDecoderFactory : public Neuro::IDicomFrameDecoder::IFactory
+  {
+  private:
+    boost::mutex  mutex_;
+    unsigned int  count_;
+
+  public:
+    CountingDecoderFactory() :
+      count_(0)
+    {
+    }
+
+    unsigned int GetCount() const
+    {
+      return count_;
+    }
+
+    virtual Neuro::IDicomFrameDecoder* CreateDecoder() ORTHANC_OVERRIDE
+    {
+      return new CountingDecoder(mutex_, count_);
+    }
+  };
+}
+
+
+TEST(IDicomFrameDecoder, RandomAccess)
+{
+  static const size_t COUNT_INSTANCES = 20;
+
+  // The 4 tiles of each mosaic frame are interleaved in the NIfTI
+  // volume, so the runs of consecutive slices have a length of 1
+  std::vector<Neuro::Slice> slices;
+  for (unsigned int j = 0; j < 4; j++)
+  {
+    for (size_t i = 0; i < COUNT_INSTANCES; i++)
+    {
+      slices.push_back(Neuro::Slice(i, i % 3, static_cast<int32_t>(i), (j % 2) * 4, (j / 2) * 4, 4, 4, 0, 0, 0, 0, 0, 1));
+    }
+  }
+
+  nifti_image nifti;
+  CreateTestHeader(nifti, 4, 4, slices.size());
+
+  std::string sequential;
+
+  {
+    Neuro::StringOutputStream output(sequential);
+    Neuro::NiftiWriter writer(output);
+    writer.WriteHeader(nifti);
+
+    CountingDecoderFactory factory;
+    std::unique_ptr<Neuro::IDicomFrameDecoder> decoder(factory.CreateDecoder());
+    Neuro::IDicomFrameDecoder::Apply(writer, *decoder, slices, 0);
+    ASSERT_EQ(slices.size(), factory.GetCount());
+
+    // Random access is only possible if writing in place
+    ASSERT_THROW(Neuro::IDicomFrameDecoder::ApplyRandomAccess(writer, *decoder, slices), Orthanc::OrthancException);
+  }
+
+  for (unsigned int threads = 0; threads <= 4; threads++)
+  {
+    std::string randomAccess;
+    randomAccess.resize(Neuro::NiftiWriter::ComputeFileSize(nifti));
+
+    Neuro::NiftiWriter writer(&randomAccess[0], randomAccess.size());
+    writer.WriteHeader(nifti);
+
+    CountingDecoderFactory factory;
+
+    if (threads == 0)
+    {
+      std::unique_ptr<Neuro::IDicomFrameDecoder> decoder(factory.CreateDecoder());
+      Neuro::IDicomFrameDecoder::ApplyRandomAccess(writer, *decoder, slices);
+    }
+    else
+    {
+      Neuro::IDicomFrameDecoder::ApplyRandomAccess(writer, factory, slices, threads);
+    }
+
+    // Each frame is only decoded once
+    ASSERT_EQ(COUNT_INSTANCES, factory.GetCount());
+    ASSERT_EQ(randomAccess.size(), writer.GetPosition());
+    ASSERT_EQ(sequential, randomAccess);
+
+    // Sequential writing cannot be resumed after random access
+    ASSERT_THROW(writer.AddSlice(Orthanc::Image(Orthanc::PixelFormat_Grayscale16, 4, 4, false)), Orthanc::OrthancException);
+  }
+
+  // Errors in the workers must be reported to the caller
+  slices.push_back(Neuro::Slice(1000, 0, 1000, 0, 0, 4, 4, 0, 0, 0, 0, 0, 1));
+  CreateTestHeader(nifti, 4, 4, slices.size());
+
+  {
+    std::string s;
+    s.resize(Neuro::NiftiWriter::ComputeFileSize(nifti));
+
+    Neuro::NiftiWriter writer(&s[0], s.size());
+    writer.WriteHeader(nifti);
+
+    TestDecoderFactory factory;
+    ASSERT_THROW(Neuro::IDicomFrameDecoder::ApplyRandomAccess(writer, factory, slices, 3), Orthanc::OrthancException);
+  }
+}
+
+
+TEST(IDicomFrameDecoder, FrameCache)
+{
+  static const size_t COUNT_INSTANCES = 20;
+  static const size_t FRAME_SIZE = 8 * 8 * 2;  // The mosaic frames of "TestDecoder" have 4 tiles
+
+  // Same interleaving of the mosaic tiles as in the "RandomAccess" test
+  std::vector<Neuro::Slice> slices;
+  for (unsigned int j = 0; j < 4; j++)
+  {
+    for (size_t i = 0; i < COUNT_INSTANCES; i++)
+    {
+      slices.push_back(Neuro::Slice(i, i % 3, static_cast<int32_t>(i), (j % 2) * 4, (j / 2) * 4, 4, 4, 0, 0, 0, 0, 0, 1));
+    }
+  }
+
+  nifti_image nifti;
+  CreateTestHeader(nifti, 4, 4, slices.size());
+
+  std::string reference;
+
+  {
+    Neuro::StringOutputStream output(reference);
+    Neuro::NiftiWriter writer(output);
+    writer.WriteHeader(nifti);
+
+    TestDecoder decoder;
+    Neuro::IDicomFrameDecoder::Apply(writer, decoder, slices, 0);
+  }
+
+  {
+    // The budget allows to keep all the frames
+    Neuro::DecodedFrameCache cache(slices, COUNT_INSTANCES * FRAME_SIZE);
+
+    TestDecoder decoder;
+    for (size_t i = 0; i < slices.size(); i++)
+    {
+      std::unique_ptr<Neuro::IDicomFrameDecoder::IDecodedFrame> frame(cache.DecodeFrame(decoder, slices[i]));
+      ASSERT_TRUE(frame.get() != NULL);
+      ASSERT_EQ(FRAME_SIZE, frame->GetMemorySize());
+    }
+
+    ASSERT_EQ(COUNT_INSTANCES, cache.GetMisses());
+    ASSERT_EQ(slices.size() - COUNT_INSTANCES, cache.GetHits());
+    ASSERT_EQ(0u, cache.GetCurrentSize());  // Frames are released after their last use
+  }
+
+  {
+    // The budget only allows to keep 5 frames
+    Neuro::DecodedFrameCache cache(slices, 5 * FRAME_SIZE);
+
+    TestDecoder decoder;
+    for (size_t i = 0; i < slices.size(); i++)
+    {
+      std::unique_ptr<Neuro::IDicomFrameDecoder::IDecodedFrame> frame(cache.DecodeFrame(decoder, slices[i]));
+      ASSERT_LE(cache.GetCurrentSize(), 5 * FRAME_SIZE);
+    }
+
+    ASSERT_EQ(slices.size(), cache.GetHits() + cache.GetMisses());
+    // Belady's policy does at least as well as keeping the same 5 frames during the 4 passes
+    ASSERT_LE(5u * 3u, cache.GetHits());
+  }
+
+  for (unsigned int threads = 0; threads <= 4; threads++)
+  {
+    for (unsigned int budget = 0; budget <= COUNT_INSTANCES; budget += 5)
+    {
+      std::string cached;
+
+      Neuro::StringOutputStream output(cached);
+      Neuro::NiftiWriter writer(output);
+      writer.WriteHeader(nifti);
+
+      CountingDecoderFactory factory;
+
+      if (threads == 0)
+      {
+        std::unique_ptr<Neuro::IDicomFrameDecoder> decoder(factory.CreateDecoder());
+        Neuro::IDicomFrameDecoder::Apply(writer, *decoder, slices, budget * FRAME_SIZE);
+      }
+      else
+      {
+        Neuro::IDicomFrameDecoder::Apply(writer, factory, slices, threads, budget * FRAME_SIZE);
+      }
+
+      ASSERT_EQ(reference, cached);
+
+      if (threads == 0 &&
+          budget == COUNT_INSTANCES)
+      {
+        // Each frame is only decoded once
+        ASSERT_EQ(COUNT_INSTANCES, factory.GetCount());
+      }
+      else
+      {
+        ASSERT_GE(slices.size(), factory.GetCount());
+      }
+    }
+  }
+}
+
+
+namespace
+{
+  class TestInstanceReader : public Neuro::IDicomInstanceReader
+  {
+  private:
+    std::string  failingId_;
+
+  public:
+    explicit TestInstanceReader(const std::string& failingId) :
+      failingId_(failingId)
+    {
+    }
+
+    virtual Neuro::InputDicomInstance* ReadInstance(const std::string& orthancId) ORTHANC_OVERRIDE
+    {
+      if (orthancId == failingId_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem, "Missing instance: " + orthancId);
+      }
+
+      // Shuffle the order in which the workers complete
+      const int32_t instanceNumber = boost::lexical_cast<int32_t>(orthancId);
+      boost::this_thread::sleep(boost::posix_time::microseconds((instanceNumber * 7919) % 1000));
+
+      Orthanc::DicomMap tags;
+      tags.SetValue(Orthanc::DICOM_TAG_ROWS, "4", false);
+      tags.SetValue(Orthanc::DICOM_TAG_COLUMNS, "4", false);
+      tags.SetValue(Orthanc::DICOM_TAG_BITS_ALLOCATED, "16", false);
+      tags.SetValue(Orthanc::DICOM_TAG_BITS_STORED, "16", false);
+      tags.SetValue(Orthanc::DICOM_TAG_HIGH_BIT, "15", false);
+      tags.SetValue(Orthanc::DICOM_TAG_PIXEL_REPRESENTATION, "1", false);
+      tags.SetValue(Orthanc::DICOM_TAG_SAMPLES_PER_PIXEL, "1", false);
+      tags.SetValue(Orthanc::DICOM_TAG_PHOTOMETRIC_INTERPRETATION, "MONOCHROME2", false);
+      tags.SetValue(Orthanc::DICOM_TAG_INSTANCE_NUMBER, orthancId, false);
+      tags.SetValue(Orthanc::DICOM_TAG_IMAGE_POSITION_PATIENT, "0\\0\\" + orthancId, false);
+      tags.SetValue(Orthanc::DICOM_TAG_IMAGE_ORIENTATION_PATIENT, "1\\0\\0\\0\\1\\0", false);
+      tags.SetValue(Orthanc::DICOM_TAG_PIXEL_SPACING, "1\\1", false);
+
+      return new Neuro::InputDicomInstance(tags);
+    }
+  };
+}
+
+
+TEST(IDicomInstanceReader, Parallel)
+{
+  std::vector<std::string> ids;
+  for (unsigned int i = 0; i < 50; i++)
+  {
+    ids.push_back(boost::lexical_cast<std::string>(i));
+  }
+
+  for (unsigned int countThreads = 1; countThreads <= 8; countThreads *= 2)
+  {
+    TestInstanceReader reader("");
+
+    Neuro::DicomInstancesCollection collection;
+    Neuro::IDicomInstanceReader::Apply(collection, reader, ids, countThreads);
+
+    ASSERT_EQ(ids.size(), collection.GetSize());
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+      ASSERT_EQ(ids[i], collection.GetOrthancId(i));
+      ASSERT_EQ(static_cast<int32_t>(i), collection.GetInstance(i).GetInstanceNumber());
+    }
+  }
+
+  {
+    TestInstanceReader reader("17");
+
+    Neuro::DicomInstancesCollection collection;
+
+    try
+    {
+      Neuro::IDicomInstanceReader::Apply(collection, reader, ids, 4);
+      ASSERT_TRUE(false);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      ASSERT_EQ(Orthanc::ErrorCode_InexistentItem, e.GetErrorCode());
+    }
+
+    ASSERT_EQ(0u, collection.GetSize());
+  }
+
+  {
+    TestInstanceReader reader("");
+    Neuro::DicomInstancesCollection collection;
+    ASSERT_THROW(Neuro::IDicomInstanceReader::Apply(collection, reader, ids, 0), Orthanc::OrthancException);
+  }
+}
@@ -19,7 +19,468 @@
 
 #include <gtest/gtest.h>
 
+#include "../Framework/BidsDataset.h"
+#include "../Framework/DicomInstancesCollection.h"
+#include "../Framework/NeuroToolbox.h"
+#include "../Framework/NiftiWriter.h"
+#include "../Framework/PixelKernels.h"
+
 #include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/lexical_cast.hpp>
+
+
+TEST(NeuroToolbox, ParseShortDicomAsJson)
+{
+  Json::Value json = Json::objectValue;
+  json["0008,0070"] = "SIEMENS";
+  json["0008,0060"] = "MR";
+  json["0010,0010"] = "Hello^World";
+  json["0019,1029"] = "1\\2\\3";
+  json["0029,1010"] = Json::nullValue;
+  json["0065,1051"] = Json::arrayValue;
+  json["nope"] = "nope";
+
+  std::set<Orthanc::DicomTag> tags;
+  tags.insert(Orthanc::DICOM_TAG_MANUFACTURER);
+  tags.insert(Orthanc::DICOM_TAG_MODALITY);
+  tags.insert(Orthanc::DicomTag(0x0019, 0x1029));
+  tags.insert(Neuro::DICOM_TAG_SIEMENS_CSA_HEADER);
+  tags.insert(Neuro::DICOM_TAG_UIH_MR_VFRAME_SEQUENCE);
+
+  Orthanc::DicomMap m;
+  Neuro::NeuroToolbox::ParseShortDicomAsJson(m, json, tags);
+
+  std::set<Orthanc::DicomTag> found;
+  m.GetTags(found);
+  ASSERT_EQ(3u, found.size());
+  ASSERT_EQ("SIEMENS", m.GetStringValue(Orthanc::DICOM_TAG_MANUFACTURER, "", false));
+  ASSERT_EQ("MR", m.GetStringValue(Orthanc::DICOM_TAG_MODALITY, "", false));
+
+  std::vector<double> v;
+  ASSERT_TRUE(Neuro::NeuroToolbox::ParseVector(v, m, Orthanc::DicomTag(0x0019, 0x1029)));
+  ASSERT_EQ(3u, v.size());
+  ASSERT_DOUBLE_EQ(3.0, v[2]);
+
+  ASSERT_THROW(Neuro::NeuroToolbox::ParseShortDicomAsJson(m, Json::arrayValue, tags), Orthanc::OrthancException);
+
+  Neuro::NeuroToolbox::ParseShortDicomAsJson(m, json);
+  found.clear();
+  m.GetTags(found);
+  ASSERT_EQ(4u, found.size());
+  ASSERT_EQ("Hello^World", m.GetStringValue(Orthanc::DICOM_TAG_PATIENT_NAME, "", false));
+
+  std::string binary;
+  ASSERT_TRUE(Neuro::NeuroToolbox::DecodeBinaryDicomAsJson(binary, "data:application/octet-stream;base64,SGVsbG8="));
+  ASSERT_EQ("Hello", binary);
+  ASSERT_FALSE(Neuro::NeuroToolbox::DecodeBinaryDicomAsJson(binary, "Hello"));
+  ASSERT_FALSE(Neuro::NeuroToolbox::DecodeBinaryDicomAsJson(binary, Json::nullValue));
+
+  json["0029,1010"] = "data:application/octet-stream;base64,SGVsbG8=";
+  Neuro::NeuroToolbox::ParseShortDicomAsJson(m, json, tags);
+  ASSERT_FALSE(m.LookupStringValue(binary, Neuro::DICOM_TAG_SIEMENS_CSA_HEADER, false));
+  ASSERT_TRUE(m.LookupStringValue(binary, Neuro::DICOM_TAG_SIEMENS_CSA_HEADER, true));
+  ASSERT_EQ("Hello", binary);
+}
+
+
+TEST(NeuroToolbox, ParseHttpRange)
+{
+  uint64_t start, end;
+
+  ASSERT_EQ(Neuro::HttpRange_Satisfiable, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=0-499", 1000));
+  ASSERT_EQ(0u, start);  ASSERT_EQ(500u, end);
+  ASSERT_EQ(Neuro::HttpRange_Satisfiable, Neuro::NeuroToolbox::ParseHttpRange(start, end, " bytes=500-999 ", 1000));
+  ASSERT_EQ(500u, start);  ASSERT_EQ(1000u, end);
+  ASSERT_EQ(Neuro::HttpRange_Satisfiable, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=900-", 1000));
+  ASSERT_EQ(900u, start);  ASSERT_EQ(1000u, end);
+  ASSERT_EQ(Neuro::HttpRange_Satisfiable, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=900-5000", 1000));
+  ASSERT_EQ(900u, start);  ASSERT_EQ(1000u, end);
+  ASSERT_EQ(Neuro::HttpRange_Satisfiable, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=-100", 1000));
+  ASSERT_EQ(900u, start);  ASSERT_EQ(1000u, end);
+  ASSERT_EQ(Neuro::HttpRange_Satisfiable, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=-5000", 1000));
+  ASSERT_EQ(0u, start);  ASSERT_EQ(1000u, end);
+  ASSERT_EQ(Neuro::HttpRange_Satisfiable, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=999-999", 1000));
+  ASSERT_EQ(999u, start);  ASSERT_EQ(1000u, end);
+
+  ASSERT_EQ(Neuro::HttpRange_Unsatisfiable, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=1000-", 1000));
+  ASSERT_EQ(Neuro::HttpRange_Unsatisfiable, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=1000-2000", 1000));
+  ASSERT_EQ(Neuro::HttpRange_Unsatisfiable, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=-0", 1000));
+
+  ASSERT_EQ(Neuro::HttpRange_Ignored, Neuro::NeuroToolbox::ParseHttpRange(start, end, "", 1000));
+  ASSERT_EQ(Neuro::HttpRange_Ignored, Neuro::NeuroToolbox::ParseHttpRange(start, end, "items=0-10", 1000));
+  ASSERT_EQ(Neuro::HttpRange_Ignored, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=0-10,20-30", 1000));
+  ASSERT_EQ(Neuro::HttpRange_Ignored, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=10-5", 1000));
+  ASSERT_EQ(Neuro::HttpRange_Ignored, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=a-5", 1000));
+  ASSERT_EQ(Neuro::HttpRange_Ignored, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=-", 1000));
+  ASSERT_EQ(Neuro::HttpRange_Ignored, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=10", 1000));
+  ASSERT_EQ(Neuro::HttpRange_Ignored, Neuro::NeuroToolbox::ParseHttpRange(start, end, "bytes=99999999999999999999-", 1000));
+}
+
+
+TEST(NeuroToolbox, IsPartialContentSupported)
+{
+  Json::Value configuration = Json::objectValue;
+  ASSERT_TRUE(Neuro::NeuroToolbox::IsPartialContentSupported(configuration));
+
+  configuration["HttpDescribeErrors"] = true;
+  ASSERT_TRUE(Neuro::NeuroToolbox::IsPartialContentSupported(configuration));
+
+  configuration["HttpDescribeErrors"] = false;
+  ASSERT_FALSE(Neuro::NeuroToolbox::IsPartialContentSupported(configuration));
+
+  configuration["HttpDescribeErrors"] = "nope";
+  ASSERT_THROW(Neuro::NeuroToolbox::IsPartialContentSupported(configuration), Orthanc::OrthancException);
+}
+
+
+TEST(NeuroToolbox, ParseIndexRange)
+{
+  size_t start, end;
+  Neuro::NeuroToolbox::ParseIndexRange(start, end, "5");
+  ASSERT_EQ(5u, start);  ASSERT_EQ(6u, end);
+  Neuro::NeuroToolbox::ParseIndexRange(start, end, "0-4");
+  ASSERT_EQ(0u, start);  ASSERT_EQ(5u, end);
+  Neuro::NeuroToolbox::ParseIndexRange(start, end, " 10 - 12 ");
+  ASSERT_EQ(10u, start);  ASSERT_EQ(13u, end);
+
+  ASSERT_THROW(Neuro::NeuroToolbox::ParseIndexRange(start, end, ""), Orthanc::OrthancException);
+  ASSERT_THROW(Neuro::NeuroToolbox::ParseIndexRange(start, end, "-4"), Orthanc::OrthancException);
+  ASSERT_THROW(Neuro::NeuroToolbox::ParseIndexRange(start, end, "4-"), Orthanc::OrthancException);
+  ASSERT_THROW(Neuro::NeuroToolbox::ParseIndexRange(start, end, "4-2"), Orthanc::OrthancException);
+  ASSERT_THROW(Neuro::NeuroToolbox::ParseIndexRange(start, end, "a"), Orthanc::OrthancException);
+}
+
+
+TEST(PixelKernels, Consistency)
+{
+  const Neuro::InstructionSet original = Neuro::PixelKernels::GetInstructionSet();
+  ASSERT_TRUE(Neuro::PixelKernels::IsSupported(original));
+  ASSERT_TRUE(Neuro::PixelKernels::IsSupported(Neuro::InstructionSet_Scalar));
+
+  // The lengths are chosen to cover the values that don't fill a full SIMD register
+  static const size_t COUNT = 77;
+
+  std::vector<uint8_t> source(4 * COUNT);
+  for (size_t i = 0; i < source.size(); i++)
+  {
+    source[i] = static_cast<uint8_t>(i * 37 + 11);
+  }
+
+  const uint8_t* u8 = &source[0];
+  const uint16_t* u16 = reinterpret_cast<const uint16_t*>(&source[0]);
+  const int16_t* s16 = reinterpret_cast<const int16_t*>(&source[0]);
+  const uint32_t* u32 = reinterpret_cast<const uint32_t*>(&source[0]);
+
+  for (int i = 0; i < 3; i++)
+  {
+    const Neuro::InstructionSet instructionSet = static_cast<Neuro::InstructionSet>(i);
+    if (!Neuro::PixelKernels::IsSupported(instructionSet))
+    {
+      ASSERT_THROW(Neuro::PixelKernels::SetInstructionSet(instructionSet), Orthanc::OrthancException);
+      continue;
+    }
+
+    Neuro::PixelKernels::SetInstructionSet(instructionSet);
+    ASSERT_EQ(instructionSet, Neuro::PixelKernels::GetInstructionSet());
+
+    for (size_t count = 0; count <= COUNT; count++)
+    {
+      std::vector<uint16_t> a(count + 1, 42);
+      Neuro::PixelKernels::SwapBytes16(&a[0], u16, count);
+      for (size_t j = 0; j < count; j++)
+      {
+        ASSERT_EQ(static_cast<uint16_t>((u16[j] >> 8) | (u16[j] << 8)), a[j]);
+      }
+      ASSERT_EQ(42u, a[count]);  // No overflow
+
+      Neuro::PixelKernels::SwapBytes16(&a[0], &a[0], count);  // In place
+      for (size_t j = 0; j < count; j++)
+      {
+        ASSERT_EQ(u16[j], a[j]);
+      }
+
+      std::vector<uint32_t> b(count + 1, 42);
+      Neuro::PixelKernels::SwapBytes32(&b[0], u32, count);
+      for (size_t j = 0; j < count; j++)
+      {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(&u32[j]);
+        const uint8_t* q = reinterpret_cast<const uint8_t*>(&b[j]);
+        ASSERT_TRUE(p[0] == q[3] && p[1] == q[2] && p[2] == q[1] && p[3] == q[0]);
+      }
+      ASSERT_EQ(42u, b[count]);
+
+      std::vector<uint16_t> c(count + 1, 42);
+      Neuro::PixelKernels::WidenUInt8ToUInt16(&c[0], u8, count);
+      for (size_t j = 0; j < count; j++)
+      {
+        ASSERT_EQ(u8[j], c[j]);
+      }
+      ASSERT_EQ(42u, c[count]);
+
+      std::vector<int32_t> d(count + 1, 42);
+      Neuro::PixelKernels::WidenUInt16ToInt32(&d[0], u16, count);
+      for (size_t j = 0; j < count; j++)
+      {
+        ASSERT_EQ(static_cast<int32_t>(u16[j]), d[j]);
+      }
+      ASSERT_EQ(42, d[count]);
+
+      Neuro::PixelKernels::WidenInt16ToInt32(&d[0], s16, count);
+      for (size_t j = 0; j < count; j++)
+      {
+        ASSERT_EQ(static_cast<int32_t>(s16[j]), d[j]);
+      }
+      ASSERT_EQ(42, d[count]);
+
+      std::vector<float> e(count + 1, 42);
+      Neuro::PixelKernels::RescaleUInt16ToFloat32(&e[0], u16, count, 0.5f, -3.0f);
+      for (size_t j = 0; j < count; j++)
+      {
+        ASSERT_FLOAT_EQ(static_cast<float>(u16[j]) * 0.5f - 3.0f, e[j]);
+      }
+      ASSERT_FLOAT_EQ(42.0f, e[count]);
+
+      Neuro::PixelKernels::RescaleInt16ToFloat32(&e[0], s16, count, 2.0f, 1024.0f);
+      for (size_t j = 0; j < count; j++)
+      {
+        ASSERT_FLOAT_EQ(static_cast<float>(s16[j]) * 2.0f + 1024.0f, e[j]);
+      }
+      ASSERT_FLOAT_EQ(42.0f, e[count]);
+
+      Neuro::PixelKernels::RescaleUInt32ToFloat32(&e[0], u32, count, 1.0f, 0.0f);
+      for (size_t j = 0; j < count; j++)
+      {
+        ASSERT_EQ(static_cast<float>(u32[j]), e[j]);  // Same rounding as the scalar cast
+      }
+      ASSERT_FLOAT_EQ(42.0f, e[count]);
+    }
+  }
+
+  Neuro::PixelKernels::SetInstructionSet(original);
+}
+
+
+static void AddPetInstance(Neuro::DicomInstancesCollection& target,
+                           unsigned int instanceNumber,
+                           const std::string& rescaleSlope)
+{
+  Orthanc::DicomMap tags;
+  tags.SetValue(0x0008, 0x0060, "PT", false);
+  tags.SetValue(0x0008, 0x0070, "GE MEDICAL SYSTEMS", false);
+  tags.SetValue(0x0020, 0x0013, boost::lexical_cast<std::string>(instanceNumber), false);
+  tags.SetValue(0x0028, 0x1052, "0", false);
+  tags.SetValue(0x0028, 0x1053, rescaleSlope, false);
+  tags.SetValue(0x0008, 0x0016, "1.2.840.10008.5.1.4.1.1.128", false);
+  tags.SetValue(0x0028, 0x0002, "1", false);
+  tags.SetValue(0x0028, 0x0004, "MONOCHROME2", false);
+  tags.SetValue(0x0028, 0x0010, "128", false);
+  tags.SetValue(0x0028, 0x0011, "128", false);
+  tags.SetValue(0x0028, 0x0100, "16", false);
+  tags.SetValue(0x0028, 0x0101, "16", false);
+  tags.SetValue(0x0028, 0x0102, "15", false);
+  tags.SetValue(0x0028, 0x0103, "1", false);
+  tags.SetValue(0x0008, 0x0032, "101812.967223", false);
+  tags.SetValue(0x0018, 0x0050, "3.27", false);
+  tags.SetValue(0x0020, 0x0032, "-350\\-350\\" + boost::lexical_cast<std::string>(3.27 * instanceNumber), false);
+  tags.SetValue(0x0020, 0x0037, "1\\0\\0\\0\\1\\0", false);
+  tags.SetValue(0x0028, 0x0030, "5.46875\\5.46875", false);
+  std::unique_ptr<Neuro::InputDicomInstance> dicom(new Neuro::InputDicomInstance(tags));
+  target.AddInstance(dicom.release(), "nope");
+}
+
+
+TEST(DicomInstancesCollection, VaryingRescale)
+{
+  {
+    Neuro::DicomInstancesCollection instances;
+    AddPetInstance(instances, 1, "2.5");
+    AddPetInstance(instances, 2, "2.5");
+
+    nifti_image nifti;
+    std::vector<Neuro::Slice> slices;
+    instances.CreateNiftiHeader(nifti, slices);
+    ASSERT_EQ(NIFTI_TYPE_INT16, nifti.datatype);
+    ASSERT_EQ(2, nifti.nbyper);
+    ASSERT_FLOAT_EQ(2.5f, nifti.scl_slope);
+    ASSERT_EQ(352u + 128u * 128u * 2u * 2u, Neuro::NiftiWriter::ComputeFileSize(nifti));
+  }
+
+  {
+    // Each PET slice has its own rescale slope, which cannot be stored in the NIfTI header
+    Neuro::DicomInstancesCollection instances;
+    AddPetInstance(instances, 1, "2.5");
+    AddPetInstance(instances, 2, "0.75");
+
+    nifti_image nifti;
+    std::vector<Neuro::Slice> slices;
+    instances.CreateNiftiHeader(nifti, slices);
+    ASSERT_EQ(NIFTI_TYPE_FLOAT32, nifti.datatype);
+    ASSERT_EQ(4, nifti.nbyper);
+    ASSERT_FLOAT_EQ(1.0f, nifti.scl_slope);
+    ASSERT_FLOAT_EQ(0.0f, nifti.scl_inter);
+    ASSERT_EQ(352u + 128u * 128u * 4u * 2u, Neuro::NiftiWriter::ComputeFileSize(nifti));
+
+    ASSERT_EQ(2u, slices.size());
+    ASSERT_DOUBLE_EQ(2.5 + 0.75, slices[0].GetRescaleSlope() + slices[1].GetRescaleSlope());
+    ASSERT_DOUBLE_EQ(2.5 * 0.75, slices[0].GetRescaleSlope() * slices[1].GetRescaleSlope());
+  }
+}
+
+
+TEST(DicomInstancesCollection, ExtractSubVolume)
+{
+  Neuro::DicomInstancesCollection instances;
+  for (unsigned int i = 1; i <= 4; i++)
+  {
+    AddPetInstance(instances, i, "1");
+  }
+
+  nifti_image full;
+  std::vector<Neuro::Slice> slices;
+  instances.CreateNiftiHeader(full, slices);
+  ASSERT_EQ(3, full.ndim);
+  ASSERT_EQ(4u, Neuro::DicomInstancesCollection::GetCountSlices(full));
+  ASSERT_EQ(1u, Neuro::DicomInstancesCollection::GetCountVolumes(full));
+
+  nifti_image nifti = full;
+  std::vector<Neuro::Slice> selected = slices;
+  ASSERT_THROW(Neuro::DicomInstancesCollection::ExtractSubVolume(nifti, selected, 2, 5, 0, 1), Orthanc::OrthancException);
+  ASSERT_THROW(Neuro::DicomInstancesCollection::ExtractSubVolume(nifti, selected, 2, 2, 0, 1), Orthanc::OrthancException);
+  ASSERT_THROW(Neuro::DicomInstancesCollection::ExtractSubVolume(nifti, selected, 0, 4, 1, 2), Orthanc::OrthancException);
+
+  Neuro::DicomInstancesCollection::ExtractSubVolume(nifti, selected, 1, 3, 0, 1);
+  ASSERT_EQ(3, nifti.ndim);
+  ASSERT_EQ(2, nifti.nz);
+  ASSERT_EQ(128 * 128 * 2, static_cast<int>(nifti.nvox));
+  ASSERT_EQ(352u + 128u * 128u * 2u * 2u, Neuro::NiftiWriter::ComputeFileSize(nifti));
+
+  ASSERT_EQ(2u, selected.size());
+  ASSERT_EQ(slices[1].GetInstanceNumber(), selected[0].GetInstanceNumber());
+  ASSERT_EQ(slices[2].GetInstanceNumber(), selected[1].GetInstanceNumber());
+
+  // The origin is moved to the first selected slice
+  for (unsigned int i = 0; i < 3; i++)
+  {
+    ASSERT_FLOAT_EQ(full.sto_xyz.m[i][3] + full.sto_xyz.m[i][2], nifti.sto_xyz.m[i][3]);
+    ASSERT_FLOAT_EQ(full.sto_xyz.m[i][2], nifti.sto_xyz.m[i][2]);
+  }
+
+  ASSERT_FLOAT_EQ(nifti.sto_xyz.m[0][3], nifti.qoffset_x);
+  ASSERT_FLOAT_EQ(nifti.sto_xyz.m[1][3], nifti.qoffset_y);
+  ASSERT_FLOAT_EQ(nifti.sto_xyz.m[2][3], nifti.qoffset_z);
+
+  // The slice timing of the full stack doesn't apply to a subset of the slices
+  nifti = full;
+  nifti.slice_code = NIFTI_SLICE_ALT_INC;
+  nifti.slice_end = 3;
+  nifti.slice_duration = 0.5f;
+  selected = slices;
+  Neuro::DicomInstancesCollection::ExtractSubVolume(nifti, selected, 1, 3, 0, 1);
+  ASSERT_EQ(NIFTI_SLICE_UNKNOWN, nifti.slice_code);
+  ASSERT_EQ(0, nifti.slice_start);
+  ASSERT_EQ(0, nifti.slice_end);
+  ASSERT_FLOAT_EQ(0.0f, nifti.slice_duration);
+
+  // Simulate a 4D series with 2 volumes, whose time axis is shifted
+  // to the first selected volume, and whose slice timing is kept
+  nifti = full;
+  nifti.ndim = nifti.dim[0] = 4;
+  nifti.nt = nifti.dim[4] = 2;
+  nifti.pixdim[4] = nifti.dt = 2.5f;
+  nifti.toffset = 1.0f;
+  nifti.slice_code = NIFTI_SLICE_ALT_INC;
+  selected = slices;
+  selected.insert(selected.end(), slices.begin(), slices.end());
+  Neuro::DicomInstancesCollection::ExtractSubVolume(nifti, selected, 0, 4, 1, 2);
+  ASSERT_EQ(1, nifti.nt);
+  ASSERT_EQ(4u, selected.size());
+  ASSERT_FLOAT_EQ(3.5f, nifti.toffset);
+  ASSERT_EQ(NIFTI_SLICE_ALT_INC, nifti.slice_code);
+}
+
+
+TEST(DicomInstancesCollection, FormatSidecar)
+{
+  Neuro::DicomInstancesCollection instances;
+  AddPetInstance(instances, 1, "1");
+  AddPetInstance(instances, 2, "1");
+
+  nifti_image nifti;
+  std::vector<Neuro::Slice> slices;
+  instances.CreateNiftiHeader(nifti, slices);
+
+  Json::Value sidecar;
+  ASSERT_THROW(instances.FormatSidecar(sidecar, nifti, std::vector<Neuro::Slice>()), Orthanc::OrthancException);
+
+  // No echo time, no repetition time, and no phase encoding in these PET instances
+  instances.FormatSidecar(sidecar, nifti, slices);
+  ASSERT_EQ(Json::objectValue, sidecar.type());
+  ASSERT_EQ(3u, sidecar.size());
+  ASSERT_EQ("PT", sidecar["Modality"].asString());
+  ASSERT_EQ("GE", sidecar["Manufacturer"].asString());
+  ASSERT_DOUBLE_EQ(3.27, sidecar["SliceThickness"].asDouble());
+}
+
+
+TEST(BidsDataset, Classify)
+{
+  std::string task, suffix;
+  ASSERT_EQ(Neuro::BidsDatatype_Anatomical, Neuro::BidsDataset::ClassifySeries(task, suffix, "MR", "t1_mprage_sag"));
+  ASSERT_EQ("T1w", suffix);
+  ASSERT_TRUE(task.empty());
+  ASSERT_EQ(Neuro::BidsDatatype_Anatomical, Neuro::BidsDataset::ClassifySeries(task, suffix, "MR", "T2 FLAIR"));
+  ASSERT_EQ("FLAIR", suffix);
+  ASSERT_EQ(Neuro::BidsDatatype_Diffusion, Neuro::BidsDataset::ClassifySeries(task, suffix, "MR", "ep2d_diff_64dir"));
+  ASSERT_EQ("dwi", suffix);
+  ASSERT_EQ(Neuro::BidsDatatype_Functional, Neuro::BidsDataset::ClassifySeries(task, suffix, "MR", "BOLD resting state"));
+  ASSERT_EQ("bold", suffix);
+  ASSERT_EQ("rest", task);
+  ASSERT_EQ(Neuro::BidsDatatype_Functional, Neuro::BidsDataset::ClassifySeries(task, suffix, "MR", "fMRI n-back"));
+  ASSERT_EQ("fmrinback", task);
+  ASSERT_EQ(Neuro::BidsDatatype_PET, Neuro::BidsDataset::ClassifySeries(task, suffix, "PT", "anything"));
+  ASSERT_EQ("pet", suffix);
+  ASSERT_EQ(Neuro::BidsDatatype_Unknown, Neuro::BidsDataset::ClassifySeries(task, suffix, "MR", "AAHead_Scout"));
+  ASSERT_EQ(Neuro::BidsDatatype_Unknown, Neuro::BidsDataset::ClassifySeries(task, suffix, "CT", "t1"));
+  ASSERT_EQ(Neuro::BidsDatatype_Unknown, Neuro::BidsDataset::ClassifySeries(task, suffix, "MR", ""));
+
+  // Keywords are only matched as whole words
+  ASSERT_EQ(Neuro::BidsDatatype_Anatomical, Neuro::BidsDataset::ClassifySeries(task, suffix, "MR", "T1 restore"));
+  ASSERT_EQ("T1w", suffix);
+  ASSERT_TRUE(task.empty());
+  ASSERT_EQ(Neuro::BidsDatatype_Unknown, Neuro::BidsDataset::ClassifySeries(task, suffix, "MR", "region of interest"));
+  ASSERT_EQ(Neuro::BidsDatatype_Unknown, Neuro::BidsDataset::ClassifySeries(task, suffix, "MR", "t2star_map"));
+  ASSERT_EQ(Neuro::BidsDatatype_Unknown, Neuro::BidsDataset::ClassifySeries(task, suffix, "MR", "diffeomorphic"));
+  ASSERT_EQ(Neuro::BidsDatatype_Anatomical, Neuro::BidsDataset::ClassifySeries(task, suffix, "MR", "AX-T2W"));
+  ASSERT_EQ("T2w", suffix);
+}
+
+
+TEST(BidsDataset, Paths)
+{
+  ASSERT_EQ("P12345", Neuro::BidsDataset::SanitizeLabel("P-123_45 "));
+  ASSERT_THROW(Neuro::BidsDataset dataset(""), Orthanc::OrthancException);
+  ASSERT_THROW(Neuro::BidsDataset dataset("sub_01"), Orthanc::OrthancException);
+
+  Neuro::BidsDataset dataset("01");
+  ASSERT_THROW(dataset.AddSeries("a", "ses-1", "MR", "t1", 1), Orthanc::OrthancException);
+
+  ASSERT_TRUE(dataset.AddSeries("a", "20240101", "MR", "t1_mprage", 5));
+  ASSERT_TRUE(dataset.AddSeries("b", "20240101", "MR", "t1_mprage", 3));
+  ASSERT_FALSE(dataset.AddSeries("c", "20240101", "MR", "localizer", 1));
+  ASSERT_FALSE(dataset.AddSeries("f", "20240101", "MR", "ep2d_diff_64dir", 2));  // No ".bval" and ".bvec" yet
+  ASSERT_TRUE(dataset.AddSeries("d", "20240101", "MR", "rest bold", 7));
+  ASSERT_TRUE(dataset.AddSeries("e", "", "PT", "FDG", 1));
+
+  ASSERT_EQ(4u, dataset.GetCountSeries());
+  ASSERT_EQ("a", dataset.GetOrthancId(0));
+  ASSERT_EQ("sub-01/ses-20240101/anat/sub-01_ses-20240101_run-2_T1w", dataset.GetPath(0));
+  ASSERT_EQ("sub-01/ses-20240101/anat/sub-01_ses-20240101_run-1_T1w", dataset.GetPath(1));
+  ASSERT_EQ("sub-01/ses-20240101/func/sub-01_ses-20240101_task-rest_bold", dataset.GetPath(2));
+  ASSERT_EQ("sub-01/pet/sub-01_pet", dataset.GetPath(3));
+  ASSERT_THROW(dataset.GetPath(4), Orthanc::OrthancException);
+}
 
 
 #if ORTHANC_ENABLE_DCMTK == 1